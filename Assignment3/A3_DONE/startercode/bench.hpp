@@ -0,0 +1,704 @@
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include "camera.hpp"
+#include "compressed.hpp"
+#include "density.hpp"
+#include "draw.hpp"
+#include "engine.hpp"
+#include "filter.hpp"
+#include "markers.hpp"
+#include "picking.hpp"
+#include "quake.hpp"
+#include "quakeindex.hpp"
+#include "quakestats.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <string>
+#include <vector>
+
+// Command-line benchmarks for QuakeVis. The catalog benchmarks run
+// before any window is created, so they work on machines without a
+// display; the rendering benchmarks open their own window.
+namespace Bench {
+
+    double secondsSince(std::chrono::steady_clock::time_point start);
+    // Times loading a catalog and prints rows/s and MB/s
+    int load(std::string filename);
+    // Loads a catalog with 1..maxThreads threads (0 means every hardware
+    // thread) and prints rows/s and MB/s for each, best of a few runs
+    int ingest(std::string filename, int maxThreads);
+    // Times opening a catalog from text and from its binary cache
+    int cache(std::string filename);
+    // Times regional queries through QuakeSpatialIndex against a full
+    // scan, checking that both find the same quakes
+    int region(std::string filename);
+    // Times window statistics from QuakeStatistics against summing the
+    // window's rows, checking that both agree
+    int stats(std::string filename);
+    // Plays 2000 frames from the middle of a catalog at the default
+    // speed, timing DensityMap updated from the window's entered and
+    // expired rows against rebuilding it every frame, and checks that
+    // both end up equal
+    int density(std::string filename);
+    // Times QuakePicker on random views of a window holding about 100k
+    // quakes (or the whole catalog if smaller), on the globe and the flat
+    // map, against testing every quake in the window
+    int pick(std::string filename);
+    // Times QuakeFilter::select over a whole catalog against evaluating
+    // the filter row by row, checking that both select the same rows. With
+    // no expression, runs a few that use every operator.
+    int filter(std::string filename, std::string expression);
+    // Packs a catalog into CompressedQuakes, reports its memory and
+    // quantization error against the columns, and times time range, box
+    // and largest magnitude queries on both, checking that they agree
+    int compress(std::string filename);
+    // Compares frame time of drawing n markers with Draw::sphere against
+    // MarkerRenderer, for 1k, 10k and 100k markers
+    int markers();
+    // Writes a synthetic catalog of the given number of rows from passes
+    // over the rows of an existing catalog, the k-th pass k seconds later,
+    // merged so the result stays in time order
+    int makeCatalog(std::string source, std::string filename, long long rows);
+
+    // Definitions below
+
+    inline double secondsSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    inline int load(std::string filename) {
+        MappedFile file(filename);
+        if (!file.isOpen()) {
+            std::cout << "Failed to open " << filename << std::endl;
+            return EXIT_FAILURE;
+        }
+        double megabytes = file.size() / (1024.0 * 1024.0);
+        file.close();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        EarthquakeDatabase db(filename);
+        double elapsed = secondsSince(start);
+        int rows = db.getMaxIndex() + 1;
+        printf("%s: %d rows, %.1f MB in %.2f ms (%.2f Mrows/s, %.1f MB/s)\n",
+               filename.c_str(), rows, megabytes, elapsed * 1000,
+               rows / elapsed / 1e6, megabytes / elapsed);
+        return EXIT_SUCCESS;
+    }
+
+    inline int ingest(std::string filename, int maxThreads) {
+        MappedFile file(filename);
+        if (!file.isOpen()) {
+            std::cout << "Failed to open " << filename << std::endl;
+            return EXIT_FAILURE;
+        }
+        double megabytes = file.size() / (1024.0 * 1024.0);
+        file.close();
+        if (maxThreads <= 0)
+            maxThreads = Parallel::defaultThreads();
+        // Warm the page cache so every run measures parsing, not the disk
+        EarthquakeDatabase(filename, maxThreads);
+        printf("%s: %.1f MB\n", filename.c_str(), megabytes);
+        printf("threads   ms        Mrows/s   MB/s\n");
+        for (int threads = 1; threads <= maxThreads; threads++) {
+            double best = 0;
+            int rows = 0;
+            for (int run = 0; run < 3; run++) {
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                EarthquakeDatabase db(filename, threads);
+                double elapsed = secondsSince(start);
+                rows = db.getMaxIndex() + 1;
+                if (run == 0 || elapsed < best)
+                    best = elapsed;
+            }
+            printf("%-9d %-9.2f %-9.2f %.1f\n", threads, best * 1000, rows / best / 1e6, megabytes / best);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    inline int cache(std::string filename) {
+        long long size, time;
+        if (!getFileStamp(filename, size, time)) {
+            std::cout << "Failed to open " << filename << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::string cacheFile = EarthquakeDatabase::cacheFilename(filename);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        EarthquakeDatabase text(filename);
+        double textTime = secondsSince(start);
+        start = std::chrono::steady_clock::now();
+        bool written = text.writeCache(cacheFile, size, time);
+        double writeTime = secondsSince(start);
+        if (!written) {
+            std::cout << "Failed to write " << cacheFile << std::endl;
+            return EXIT_FAILURE;
+        }
+        start = std::chrono::steady_clock::now();
+        EarthquakeDatabase cached;
+        cached.loadCached(filename);
+        double cachedTime = secondsSince(start);
+        printf("%s: %d rows\n", filename.c_str(), text.getMaxIndex() + 1);
+        printf("parse text   %.2f ms\n", textTime * 1000);
+        printf("write cache  %.2f ms\n", writeTime * 1000);
+        printf("open cache   %.3f ms\n", cachedTime * 1000);
+        return EXIT_SUCCESS;
+    }
+
+    inline int region(std::string filename) {
+        EarthquakeDatabase db;
+        if (!db.loadCached(filename)) {
+            std::cout << "Failed to open " << filename << std::endl;
+            return EXIT_FAILURE;
+        }
+        int nRows = db.getMaxIndex() + 1;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        QuakeSpatialIndex index;
+        index.build(&db);
+        printf("%s: %d rows, %d cells, built in %.2f ms\n", filename.c_str(), nRows,
+               index.getCellCount(), secondsSince(start) * 1000);
+
+        // Random 20x20 degree boxes and 500 km circles over 5 year windows
+        const int nQueries = 1000;
+        double tMin = db.getSeconds(0), tMax = db.getSeconds(nRows - 1);
+        double span = 5 * 365 * 24 * 3600.0;
+        srand(4611);
+        double indexTime = 0, scanTime = 0;
+        long long found = 0;
+        std::vector<int> result;
+        for (int q = 0; q < nQueries; q++) {
+            bool circle = q % 2 == 1;
+            float lat = rand() % 160 - 80, lon = rand() % 360 - 180;
+            double t0 = tMin + (tMax - tMin) * (rand() / (double)RAND_MAX), t1 = t0 + span;
+            result.clear();
+            start = std::chrono::steady_clock::now();
+            if (circle)
+                index.queryRadius(lat, lon, 500, t0, t1, result);
+            else
+                index.queryBox(lat, lat + 20, lon, lon + 20 > 180 ? lon - 340 : lon + 20, t0, t1, result);
+            indexTime += secondsSince(start);
+            start = std::chrono::steady_clock::now();
+            int scanned = 0;
+            for (int i = 0; i < nRows; i++) {
+                double t = db.getSeconds(i);
+                if (t < t0 || t > t1)
+                    continue;
+                float qLat = db.getLatitude(i), qLon = db.getLongitude(i);
+                bool inside;
+                if (circle) {
+                    inside = greatCircleKm(lat, lon, qLat, qLon) <= 500;
+                } else {
+                    float dLon = qLon - lon;
+                    if (dLon < 0)
+                        dLon += 360;
+                    inside = qLat >= lat && qLat <= lat + 20 && dLon <= 20;
+                }
+                if (inside)
+                    scanned++;
+            }
+            scanTime += secondsSince(start);
+            if (scanned != (int)result.size()) {
+                printf("Query %d: index found %d quakes, scan found %d\n", q, (int)result.size(), scanned);
+                return EXIT_FAILURE;
+            }
+            found += scanned;
+        }
+        printf("%d queries, %.1f results each\n", nQueries, found / (double)nQueries);
+        printf("index  %.2f us/query\n", indexTime / nQueries * 1e6);
+        printf("scan   %.2f us/query\n", scanTime / nQueries * 1e6);
+        return EXIT_SUCCESS;
+    }
+
+    inline int stats(std::string filename) {
+        EarthquakeDatabase db;
+        if (!db.loadCached(filename)) {
+            std::cout << "Failed to open " << filename << std::endl;
+            return EXIT_FAILURE;
+        }
+        int nRows = db.getMaxIndex() + 1;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        QuakeStatistics statistics;
+        statistics.build(&db);
+        printf("%s: %d rows, %d buckets, built in %.2f ms\n", filename.c_str(), nRows,
+               statistics.getBucketCount(), secondsSince(start) * 1000);
+
+        // Random windows of Config::timeWindow, as the panel shows
+        const int nQueries = 1000;
+        double tMin = db.getSeconds(0), tMax = db.getSeconds(nRows - 1);
+        srand(4611);
+        double statsTime = 0, scanTime = 0;
+        long long counted = 0;
+        for (int q = 0; q < nQueries; q++) {
+            double t1 = tMin + (tMax - tMin) * (rand() / (double)RAND_MAX), t0 = t1 - Config::timeWindow;
+            start = std::chrono::steady_clock::now();
+            QuakeSummary s = statistics.query(t0, t1);
+            statsTime += secondsSince(start);
+            start = std::chrono::steady_clock::now();
+            int count = 0;
+            double energy = 0;
+            float maxMagnitude = std::numeric_limits<float>::lowest();
+            for (int i = 0; i < nRows; i++) {
+                double t = db.getSeconds(i);
+                if (t < t0 || t > t1)
+                    continue;
+                count++;
+                energy += seismicEnergy(db.getMagnitude(i));
+                maxMagnitude = std::max(maxMagnitude, db.getMagnitude(i));
+            }
+            scanTime += secondsSince(start);
+            if (count != s.count || maxMagnitude != s.maxMagnitude
+                || fabs(energy - s.energy) > 1e-9 * energy + 1e6) {
+                printf("Query %d: statistics found %d quakes, scan found %d\n", q, s.count, count);
+                return EXIT_FAILURE;
+            }
+            counted += count;
+        }
+        printf("%d queries, %.1f quakes each\n", nQueries, counted / (double)nQueries);
+        printf("buckets  %.2f us/query\n", statsTime / nQueries * 1e6);
+        printf("scan     %.2f us/query\n", scanTime / nQueries * 1e6);
+        return EXIT_SUCCESS;
+    }
+
+    inline int density(std::string filename) {
+        EarthquakeDatabase db;
+        if (!db.loadCached(filename)) {
+            std::cout << "Failed to open " << filename << std::endl;
+            return EXIT_FAILURE;
+        }
+        int nRows = db.getMaxIndex() + 1;
+        DensityMap incremental, rebuilt;
+        incremental.initialize(&db, Config::densityWidth, Config::densityHeight, Config::densityRadius);
+        rebuilt.initialize(&db, Config::densityWidth, Config::densityHeight, Config::densityRadius);
+        TimeWindowCursor window;
+        window.reset(&db, Config::timeWindow);
+
+        // 30 days per frame at 60 frames per second, as QuakeVis plays
+        const int frames = 2000;
+        double step = 30 * 24 * 3600 / 60.0;
+        double tMiddle = (db.getSeconds(db.getMinIndex()) + db.getSeconds(nRows - 1)) / 2;
+        double updateTime = 0, rebuildTime = 0;
+        long long changed = 0, inWindow = 0;
+        for (int f = 0; f < frames; f++) {
+            window.moveTo(tMiddle + f * step);
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            incremental.update(window);
+            updateTime += secondsSince(start);
+            start = std::chrono::steady_clock::now();
+            rebuilt.rebuild(window);
+            rebuildTime += secondsSince(start);
+            for (int a = 0; a < window.getAddedCount(); a++)
+                changed += window.getAdded(a).size();
+            for (int r = 0; r < window.getRemovedCount(); r++)
+                changed += window.getRemoved(r).size();
+            inWindow += window.getEnd() - window.getStart() + 1;
+        }
+        for (int y = 0; y < Config::densityHeight; y++) {
+            for (int x = 0; x < Config::densityWidth; x++) {
+                if (incremental.at(x, y) != rebuilt.at(x, y)) {
+                    printf("Texel (%d, %d): incremental %d, rebuilt %d\n", x, y, incremental.at(x, y), rebuilt.at(x, y));
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+        printf("%s: %d frames, %.1f quakes in the window and %.1f entering or leaving per frame\n",
+               filename.c_str(), frames, inWindow / (double)frames, changed / (double)frames);
+        printf("incremental  %.2f us/frame\n", updateTime / frames * 1e6);
+        printf("rebuild      %.2f us/frame\n", rebuildTime / frames * 1e6);
+        return EXIT_SUCCESS;
+    }
+
+    inline int pick(std::string filename) {
+        EarthquakeDatabase db;
+        if (!db.loadCached(filename)) {
+            std::cout << "Failed to open " << filename << std::endl;
+            return EXIT_FAILURE;
+        }
+        int nRows = db.getMaxIndex() + 1;
+        QuakeSpatialIndex index;
+        index.build(&db);
+        QuakePicker picker;
+        picker.reset(&db, &index);
+        // Earth::getPosition needs no GL resources
+        Earth earth;
+        // About 100k rows around the middle of the catalog
+        int first = std::max(db.getMinIndex(), nRows / 2 - 50000), last = std::min(nRows / 2 + 50000, nRows - 1);
+        TimeWindowCursor window;
+        window.reset(&db, db.getSeconds(last) - db.getSeconds(first));
+        window.moveTo(db.getSeconds(last));
+        printf("%s: %d quakes in the window\n", filename.c_str(), window.getEnd() - window.getStart() + 1);
+
+        const int nQueries = 2000, width = 1280, height = 720;
+        const float radius = Config::pickPixels;
+        srand(4611);
+        double pickTime = 0, scanTime = 0;
+        int hits = 0;
+        for (int q = 0; q < nQueries; q++) {
+            float spherical = q % 4 == 3 ? 0 : 1;
+            earth.setSpherical(spherical);
+            float dist = spherical == 1 ? 1.3 + 3 * (rand() / (float)RAND_MAX) : 3 + 4 * (rand() / (float)RAND_MAX);
+            float lat = spherical == 1 ? (rand() / (float)RAND_MAX - 0.5) * 2.8 : (rand() / (float)RAND_MAX - 0.5) * 0.5;
+            float lon = spherical == 1 ? (rand() / (float)RAND_MAX) * 2 * M_PI : (rand() / (float)RAND_MAX - 0.5) * 0.5;
+            OrbitCamera camera(dist, lat, lon, Perspective(40, 16/9., 0.1, 10));
+            // Half of the mice near a quake, the rest anywhere
+            int x = rand() % width, y = rand() % height;
+            int row = window.getStart() + rand() % (window.getEnd() - window.getStart() + 1);
+            float qx, qy;
+            if (q % 2 == 0 && camera.project(earth.getPosition(db.getLatitude(row), db.getLongitude(row)), qx, qy)) {
+                x = (int)((qx + 1) * width / 2) + rand() % 25 - 12;
+                y = (int)((1 - qy) * height / 2) + rand() % 25 - 12;
+            }
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            int picked = picker.pick(camera, earth, window, x, y, width, height, radius);
+            pickTime += secondsSince(start);
+
+            // Every quake in the window: visible, on screen within radius
+            start = std::chrono::steady_clock::now();
+            float ndcX = 2.0f * x / width - 1, ndcY = 1 - 2.0f * y / height;
+            vec3 eye = camera.getEye();
+            float best = radius * radius, pickedDistance = -1;
+            int scanned = -1;
+            for (int i = window.getStart(); i <= window.getEnd(); i++) {
+                vec3 p = earth.getPosition(db.getLatitude(i), db.getLongitude(i));
+                float px, py;
+                if ((spherical == 1 && glm::dot(p, eye) < 1) || !camera.project(p, px, py))
+                    continue;
+                float dx = (px - ndcX) * width / 2, dy = (py - ndcY) * height / 2;
+                float distance = dx * dx + dy * dy;
+                if (i == picked)
+                    pickedDistance = distance;
+                if (distance <= best) {
+                    best = distance;
+                    scanned = i;
+                }
+            }
+            scanTime += secondsSince(start);
+            // Equally near quakes may be picked in either order
+            if ((picked < 0) != (scanned < 0) || (picked >= 0 && pickedDistance != best)) {
+                printf("Query %d: picked row %d, scan found row %d\n", q, picked, scanned);
+                return EXIT_FAILURE;
+            }
+            if (picked >= 0)
+                hits++;
+        }
+        printf("%d queries, %d hits\n", nQueries, hits);
+        printf("pick  %.2f us/query\n", pickTime / nQueries * 1e6);
+        printf("scan  %.2f us/query\n", scanTime / nQueries * 1e6);
+        return EXIT_SUCCESS;
+    }
+
+    inline int filter(std::string filename, std::string expression) {
+        EarthquakeDatabase db;
+        if (!db.loadCached(filename)) {
+            std::cout << "Failed to open " << filename << std::endl;
+            return EXIT_FAILURE;
+        }
+        int nRows = db.getMaxIndex() + 1;
+        std::vector<std::string> expressions;
+        if (!expression.empty()) {
+            expressions.push_back(expression);
+        } else {
+            expressions.push_back("mag >= 6.5 && depth < 70 && lat in [-10, 20]");
+            expressions.push_back("mag > 7 || !(lon in [-180, 0]) && depth <= 33");
+            expressions.push_back("(mag == 6 || mag != 6.5) && !(lat < -20 || lat > 20) # tropics");
+            expressions.push_back("");
+        }
+        printf("%s: %d rows\n", filename.c_str(), nRows);
+        for (size_t e = 0; e < expressions.size(); e++) {
+            QuakeFilter f;
+            if (!f.compile(expressions[e])) {
+                std::cout << f.getError() << std::endl;
+                return EXIT_FAILURE;
+            }
+            // Best of a few runs, as the first one also faults the columns in
+            QuakeSelection selection;
+            double compiledTime = std::numeric_limits<double>::max();
+            for (int run = 0; run < 5; run++) {
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                f.select(db, selection);
+                compiledTime = std::min(compiledTime, secondsSince(start));
+            }
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            int matched = 0;
+            std::vector<char> rowByRow(nRows);
+            for (int i = 0; i < nRows; i++) {
+                rowByRow[i] = f.matches(db, i);
+                matched += rowByRow[i];
+            }
+            double rowTime = secondsSince(start);
+            for (int i = 0; i < nRows; i++) {
+                if (selection.contains(i) != (rowByRow[i] != 0)) {
+                    printf("\"%s\": row %d differs\n", expressions[e].c_str(), i);
+                    return EXIT_FAILURE;
+                }
+            }
+            if (selection.count() != matched) {
+                printf("\"%s\": selected %d rows, expected %d\n", expressions[e].c_str(), selection.count(), matched);
+                return EXIT_FAILURE;
+            }
+            printf("\"%s\": %d rows selected\n", expressions[e].c_str(), matched);
+            printf("  compiled    %8.2f ms  %7.1f Mrows/s\n", compiledTime * 1000, nRows / compiledTime / 1e6);
+            printf("  row by row  %8.2f ms  %7.1f Mrows/s\n", rowTime * 1000, nRows / rowTime / 1e6);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    inline int compress(std::string filename) {
+        EarthquakeDatabase db;
+        if (!db.loadCached(filename)) {
+            std::cout << "Failed to open " << filename << std::endl;
+            return EXIT_FAILURE;
+        }
+        int nRows = db.getMaxIndex() + 1;
+        size_t columnBytes = (size_t)nRows * (sizeof(double) + 4 * sizeof(float) + sizeof(MagType));
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        CompressedQuakes packed;
+        packed.build(db);
+        double buildTime = secondsSince(start);
+        printf("%s: %d rows in %d blocks, packed in %.1f ms\n", filename.c_str(), nRows,
+               packed.getBlockCount(), buildTime * 1000);
+        printf("columns     %10.2f MB  %5.2f bytes/row\n", columnBytes / 1e6, columnBytes / (double)nRows);
+        printf("compressed  %10.2f MB  %5.2f bytes/row  (%.1fx smaller)\n", packed.getBytes() / 1e6,
+               packed.getBytes() / (double)nRows, columnBytes / (double)packed.getBytes());
+
+        // Largest difference of each decoded field from the columns
+        QuakeColumns decoded;
+        decoded.resize(nRows);
+        start = std::chrono::steady_clock::now();
+        for (int b = 0; b < packed.getBlockCount(); b++)
+            packed.decode(b, decoded);
+        double decodeTime = secondsSince(start);
+        double timeError = 0, locationError = 0, depthError = 0, magError = 0;
+        for (int i = 0; i < nRows; i++) {
+            timeError = std::max(timeError, fabs(decoded.seconds[i] - db.getSeconds(i)));
+            locationError = std::max(locationError, (double)greatCircleKm(decoded.latitudes[i], decoded.longitudes[i],
+                                                                          db.getLatitude(i), db.getLongitude(i)) * 1000);
+            depthError = std::max(depthError, (double)fabs(decoded.depths[i] - db.getDepth(i)));
+            magError = std::max(magError, (double)fabs(decoded.magnitudes[i] - db.getMagnitude(i)));
+            if (strncmp(decoded.magTypes[i].code, db.getMagnitudeType(i), sizeof(MagType)) != 0) {
+                printf("Row %d: magnitude type %s decoded as %s\n", i, db.getMagnitudeType(i), decoded.magTypes[i].code);
+                return EXIT_FAILURE;
+            }
+        }
+        printf("decoded every row in %.1f ms; largest errors: time %.2f ms, location %.2f m, depth %.3f km, magnitude %.3f\n",
+               decodeTime * 1000, timeError * 1000, locationError, depthError, magError);
+
+        // Random one year ranges, and 20x20 degree boxes and largest
+        // magnitudes over five years
+        const int nQueries = 1000;
+        const double *seconds = &db.getColumns().seconds[0];
+        double tMin = seconds[0], tMax = seconds[nRows - 1];
+        double year = 365 * 24 * 3600.0;
+        double rangeTime[2] = {0, 0}, boxTime[2] = {0, 0}, maxTime[2] = {0, 0};
+        std::vector<int> found;
+        srand(4611);
+        for (int q = 0; q < nQueries; q++) {
+            double t0 = tMin + (tMax - tMin) * (rand() / (double)RAND_MAX), t1 = t0 + year;
+            start = std::chrono::steady_clock::now();
+            int first = std::lower_bound(seconds, seconds + nRows, t0) - seconds;
+            int last = std::upper_bound(seconds, seconds + nRows, t1) - seconds;
+            rangeTime[0] += secondsSince(start);
+            start = std::chrono::steady_clock::now();
+            IndexRange range = packed.findTimeRange(t0, t1);
+            rangeTime[1] += secondsSince(start);
+            if (range.first != first || range.last != last) {
+                printf("Range %d: rows [%d, %d) from the columns, [%d, %d) packed\n", q, first, last, range.first, range.last);
+                return EXIT_FAILURE;
+            }
+
+            t1 = t0 + 5 * year;
+            float lat = rand() % 160 - 80, lon = rand() % 340 - 180;
+            start = std::chrono::steady_clock::now();
+            int inBox = 0;
+            first = std::lower_bound(seconds, seconds + nRows, t0) - seconds;
+            last = std::upper_bound(seconds, seconds + nRows, t1) - seconds;
+            for (int i = first; i < last; i++) {
+                float qLat = db.getLatitude(i), qLon = db.getLongitude(i);
+                if (qLat >= lat && qLat <= lat + 20 && qLon >= lon && qLon <= lon + 20)
+                    inBox++;
+            }
+            boxTime[0] += secondsSince(start);
+            found.clear();
+            start = std::chrono::steady_clock::now();
+            packed.queryBox(lat, lat + 20, lon, lon + 20, t0, t1, found);
+            boxTime[1] += secondsSince(start);
+            if ((int)found.size() != inBox) {
+                printf("Box %d: %d quakes from the columns, %d packed\n", q, inBox, (int)found.size());
+                return EXIT_FAILURE;
+            }
+
+            start = std::chrono::steady_clock::now();
+            float largest = std::numeric_limits<float>::lowest();
+            for (int i = first; i < last; i++)
+                largest = std::max(largest, db.getMagnitude(i));
+            maxTime[0] += secondsSince(start);
+            start = std::chrono::steady_clock::now();
+            float packedLargest = packed.maxMagnitude(t0, t1);
+            maxTime[1] += secondsSince(start);
+            if (fabs(packedLargest - largest) > magError + 1e-6) {
+                printf("Magnitude %d: %.2f from the columns, %.2f packed\n", q, largest, packedLargest);
+                return EXIT_FAILURE;
+            }
+        }
+        printf("%d queries each       columns     compressed\n", nQueries);
+        printf("1 year row range    %8.2f us    %8.2f us\n", rangeTime[0] / nQueries * 1e6, rangeTime[1] / nQueries * 1e6);
+        printf("5 year 20x20 box    %8.2f us    %8.2f us\n", boxTime[0] / nQueries * 1e6, boxTime[1] / nQueries * 1e6);
+        printf("5 year largest mag  %8.2f us    %8.2f us\n", maxTime[0] / nQueries * 1e6, maxTime[1] / nQueries * 1e6);
+        return EXIT_SUCCESS;
+    }
+
+    inline int markers() {
+        Engine engine;
+        SDL_Window *window = engine.createWindow("Marker benchmark", 1280, 720);
+        // Measure rendering, not vsync
+        SDL_GL_SetSwapInterval(0);
+        OrbitCamera camera(5, 0, 0, Perspective(40, 16/9., 0.1, 10));
+        MarkerRenderer renderer;
+        renderer.initialize(&engine);
+        printf("GL renderer: %s, instancing %s\n", (const char*)glGetString(GL_RENDERER),
+               instancingSupported() ? "supported" : "not supported");
+        printf("markers   Draw::sphere ms/frame   MarkerRenderer ms/frame\n");
+        int counts[3] = {1000, 10000, 100000};
+        srand(4611);
+        for (int c = 0; c < 3; c++) {
+            // Random markers on the unit sphere, sized like quakes
+            int n = counts[c];
+            std::vector<vec3> positions(n);
+            std::vector<float> radii(n);
+            for (int i = 0; i < n; i++) {
+                float lat = (rand() / (float)RAND_MAX - 0.5f) * M_PI, lon = (rand() / (float)RAND_MAX - 0.5f) * 2 * M_PI;
+                positions[i] = vec3(cos(lat) * sin(lon), sin(lat), cos(lat) * cos(lon));
+                radii[i] = 0.01f + 0.03f * rand() / (float)RAND_MAX;
+            }
+            double frameTime[2];
+            for (int path = 0; path < 2; path++) {
+                // At least one frame, and enough frames to fill a second
+                int frames = 0;
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                do {
+                    glClearColor(0, 0, 0, 1);
+                    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                    glMatrixMode(GL_MODELVIEW);
+                    glLoadIdentity();
+                    glEnable(GL_LIGHTING);
+                    vec4 lightPosition(0, 0, 0, 1);
+                    vec3 lightColor(0.8, 0.8, 0.8);
+                    glEnable(GL_LIGHT0);
+                    glLightfv(GL_LIGHT0, GL_POSITION, &lightPosition[0]);
+                    glLightfv(GL_LIGHT0, GL_DIFFUSE, &lightColor[0]);
+                    camera.apply();
+                    glEnable(GL_BLEND);
+                    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                    if (path == 0) {
+                        glColor4f(1, 0, 0, 0.5);
+                        for (int i = 0; i < n; i++)
+                            Draw::sphere(positions[i], radii[i]);
+                    } else {
+                        renderer.clear();
+                        for (int i = 0; i < n; i++)
+                            renderer.add(positions[i], radii[i], vec4(1, 0, 0, 0.5));
+                        renderer.draw(lightColor);
+                    }
+                    glFinish();
+                    SDL_GL_SwapWindow(window);
+                    frames++;
+                } while (secondsSince(start) < 1);
+                frameTime[path] = secondsSince(start) / frames;
+            }
+            printf("%-9d %-23.2f %.2f\n", n, frameTime[0] * 1000, frameTime[1] * 1000);
+        }
+        SDL_DestroyWindow(window);
+        return EXIT_SUCCESS;
+    }
+
+    inline int makeCatalog(std::string source, std::string filename, long long rows) {
+        MappedFile in(source);
+        if (!in.isOpen() || in.size() == 0) {
+            std::cout << "Failed to open " << source << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::vector<std::string> lines;
+        const char *p = in.data(), *end = in.data() + in.size();
+        while (p < end) {
+            const char *newline = (const char*)memchr(p, '\n', end - p);
+            const char *lineEnd = newline != NULL ? newline : end;
+            if (lineEnd - p >= CatalogFormat::minRowLength)
+                lines.push_back(std::string(p, lineEnd));
+            p = lineEnd + 1;
+        }
+        if (lines.empty()) {
+            std::cout << "No rows in " << source << std::endl;
+            return EXIT_FAILURE;
+        }
+        // Times in hundredths of a second, the precision of the seconds
+        // column, so shifted times are exact
+        const long long hundredthsPerDay = 100LL * Civil::SECONDS_PER_DAY;
+        std::vector<long long> times(lines.size());
+        for (size_t i = 0; i < lines.size(); i++) {
+            const char *line = lines[i].c_str();
+            int length = lines[i].size();
+            long long day = Civil::daysFromCivil(
+                CatalogFormat::parseInt(line, length, CatalogFormat::yearOffset, CatalogFormat::yearWidth),
+                CatalogFormat::parseInt(line, length, CatalogFormat::monthOffset, CatalogFormat::monthWidth),
+                CatalogFormat::parseInt(line, length, CatalogFormat::dayOffset, CatalogFormat::dayWidth));
+            int hour = CatalogFormat::parseInt(line, length, CatalogFormat::hourOffset, CatalogFormat::hourWidth);
+            int minute = CatalogFormat::parseInt(line, length, CatalogFormat::minuteOffset, CatalogFormat::minuteWidth);
+            double second = CatalogFormat::parseDecimal(line, length, CatalogFormat::secondOffset, CatalogFormat::secondWidth);
+            times[i] = day * hundredthsPerDay + (hour * 3600 + minute * 60) * 100LL + llround(second * 100);
+        }
+        std::vector<int> order(lines.size());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return times[a] < times[b]; });
+
+        std::ofstream out(filename.c_str(), std::ios::binary);
+        if (!out) {
+            std::cout << "Failed to create " << filename << std::endl;
+            return EXIT_FAILURE;
+        }
+        // Each pass is the source in time order; pass k holds the first
+        // rows - k*n rows of it if that is fewer than all n. Repeatedly
+        // writing the earliest next row of any pass merges them.
+        struct Next {
+            long long time;
+            long long pass;
+            size_t position;
+            bool operator>(const Next &other) const {
+                return time != other.time ? time > other.time : pass > other.pass;
+            }
+        };
+        long long n = lines.size();
+        std::priority_queue<Next, std::vector<Next>, std::greater<Next> > heads;
+        for (long long pass = 0; pass * n < rows; pass++) {
+            Next next = {times[order[0]] + pass * 100, pass, 0};
+            heads.push(next);
+        }
+        while (!heads.empty()) {
+            Next next = heads.top();
+            heads.pop();
+            std::string line = lines[order[next.position]];
+            long long day = next.time / hundredthsPerDay - (next.time % hundredthsPerDay < 0 ? 1 : 0);
+            long long ofDay = next.time - day * hundredthsPerDay;
+            Civil::CivilDate date = Civil::civilFromDays(day);
+            char fields[32];
+            snprintf(fields, sizeof(fields), "%4d %2d %2d  %2d %2d %2d.%02d", date.year, date.month, date.day,
+                     (int)(ofDay / 360000), (int)(ofDay / 6000 % 60), (int)(ofDay / 100 % 60), (int)(ofDay % 100));
+            line.replace(CatalogFormat::yearOffset, CatalogFormat::secondOffset + CatalogFormat::secondWidth
+                         - CatalogFormat::yearOffset, fields);
+            out << line << '\n';
+            next.position++;
+            if ((long long)next.position < std::min(n, rows - next.pass * n)) {
+                next.time = times[order[next.position]] + next.pass * 100;
+                heads.push(next);
+            }
+        }
+        std::cout << "Wrote " << rows << " rows to " << filename << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+}
+
+#endif
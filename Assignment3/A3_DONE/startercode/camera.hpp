@@ -12,6 +12,8 @@ public:
                 float zmin = 0.1, float zmax = 10):
         fov(fov), aspect(aspect), zmin(zmin), zmax(zmax) {}
     void apply();
+    float getFov() const { return fov; }
+    float getAspect() const { return aspect; }
 protected:
     float fov, aspect, zmin, zmax;
 };
@@ -23,7 +25,21 @@ public:
         dist(dist), lat(lat), lon(lon), pers(pers) {}
     void apply();
     void onMouseMotion(SDL_MouseMotionEvent&);
+    // Zooms in and out, staying outside the unit sphere
+    void onMouseWheel(SDL_MouseWheelEvent&);
+    float getDistance() const { return dist; }
+    // Camera position in world coordinates
+    vec3 getEye() const;
+    // Unit direction of the eye ray through a point given in normalized
+    // device coordinates
+    vec3 getRayDirection(float x, float y) const;
+    // Normalized device coordinates of a world point; returns false if
+    // the point is behind the camera
+    bool project(vec3 p, float &x, float &y) const;
+    const Perspective &getPerspective() const { return pers; }
 protected:
+    // Camera axes matching gluLookAt in apply()
+    void getAxes(vec3 &forward, vec3 &right, vec3 &up) const;
     float dist, lat, lon;
     Perspective pers;
 };
@@ -40,10 +56,40 @@ inline void OrbitCamera::apply() {
     pers.apply();
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
-    vec3 eye = dist*vec3(sin(lon)*cos(lat), sin(lat), cos(lon)*cos(lat));
+    vec3 eye = getEye();
     gluLookAt(eye.x,eye.y,eye.z, 0,0,0, 0,1,0);
 }
 
+inline vec3 OrbitCamera::getEye() const {
+    return dist*vec3(sin(lon)*cos(lat), sin(lat), cos(lon)*cos(lat));
+}
+
+inline void OrbitCamera::getAxes(vec3 &forward, vec3 &right, vec3 &up) const {
+    forward = -glm::normalize(getEye());
+    right = glm::normalize(glm::cross(forward, vec3(0,1,0)));
+    up = glm::cross(right, forward);
+}
+
+inline vec3 OrbitCamera::getRayDirection(float x, float y) const {
+    vec3 forward, right, up;
+    getAxes(forward, right, up);
+    float h = tan(pers.getFov() * M_PI / 360);
+    return glm::normalize(forward + x * h * pers.getAspect() * right + y * h * up);
+}
+
+inline bool OrbitCamera::project(vec3 p, float &x, float &y) const {
+    vec3 forward, right, up;
+    getAxes(forward, right, up);
+    vec3 v = p - getEye();
+    float depth = glm::dot(v, forward);
+    if (depth <= 0)
+        return false;
+    float h = tan(pers.getFov() * M_PI / 360);
+    x = glm::dot(v, right) / (depth * h * pers.getAspect());
+    y = glm::dot(v, up) / (depth * h);
+    return true;
+}
+
 inline void OrbitCamera::onMouseMotion(SDL_MouseMotionEvent &e) {
     if (!(e.state & SDL_BUTTON_LMASK))
         return;
@@ -55,4 +101,12 @@ inline void OrbitCamera::onMouseMotion(SDL_MouseMotionEvent &e) {
         lat = M_PI/2 - 0.001;
 }
 
+inline void OrbitCamera::onMouseWheel(SDL_MouseWheelEvent &e) {
+    dist *= pow(0.9f, (float)e.y);
+    if (dist < 1.2)
+        dist = 1.2;
+    if (dist > 8)
+        dist = 8;
+}
+
 #endif
@@ -0,0 +1,95 @@
+#ifndef CIVIL_HPP
+#define CIVIL_HPP
+
+#include <cmath>
+
+// Conversions between UTC calendar dates and seconds since 1970-01-01,
+// using the proleptic Gregorian calendar. These are plain arithmetic:
+// no time zone, no mktime/localtime, no loops, any year, and safe to call
+// from any thread. The day conversions follow Howard Hinnant's
+// days_from_civil / civil_from_days algorithms.
+namespace Civil {
+
+    const int SECONDS_PER_DAY = 86400;
+
+    struct CivilDate {
+        int year, month, day;
+    };
+
+    struct CivilTime {
+        int year, month, day;
+        int hour, minute;
+        double second;
+    };
+
+    // Days since 1970-01-01 of the given date (month 1-12)
+    long long daysFromCivil(int year, int month, int day);
+    // Date of a day count since 1970-01-01
+    CivilDate civilFromDays(long long days);
+    double secondsFromCivil(int year, int month, int day, int hour, int minute, double second);
+    CivilTime civilFromSeconds(double seconds);
+
+    // Batch versions for whole arrays of timestamps
+    void civilFromSeconds(const double *seconds, int count, CivilTime *out);
+    void secondsFromCivil(const CivilTime *times, int count, double *out);
+
+    // Definitions below
+
+    inline long long daysFromCivil(int year, int month, int day) {
+        // Count years from March so the leap day is the last day of the year
+        long long y = year - (month <= 2 ? 1 : 0);
+        long long era = (y >= 0 ? y : y - 399) / 400;
+        long long yearOfEra = y - era * 400;
+        long long dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+        long long dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+        return era * 146097 + dayOfEra - 719468;
+    }
+
+    inline CivilDate civilFromDays(long long days) {
+        long long z = days + 719468;
+        long long era = (z >= 0 ? z : z - 146096) / 146097;
+        long long dayOfEra = z - era * 146097;
+        long long yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+        long long dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+        long long mp = (5 * dayOfYear + 2) / 153;
+        int day = (int)(dayOfYear - (153 * mp + 2) / 5 + 1);
+        int month = (int)(mp < 10 ? mp + 3 : mp - 9);
+        int year = (int)(yearOfEra + era * 400 + (month <= 2 ? 1 : 0));
+        return CivilDate{year, month, day};
+    }
+
+    inline double secondsFromCivil(int year, int month, int day, int hour, int minute, double second) {
+        return (double)daysFromCivil(year, month, day) * SECONDS_PER_DAY
+            + hour * 3600 + minute * 60 + second;
+    }
+
+    inline CivilTime civilFromSeconds(double seconds) {
+        double days = std::floor(seconds / SECONDS_PER_DAY);
+        double secondOfDay = seconds - days * SECONDS_PER_DAY;
+        CivilDate date = civilFromDays((long long)days);
+        int wholeSeconds = (int)secondOfDay;
+        CivilTime t;
+        t.year = date.year;
+        t.month = date.month;
+        t.day = date.day;
+        t.hour = wholeSeconds / 3600;
+        t.minute = wholeSeconds / 60 % 60;
+        t.second = secondOfDay - (t.hour * 3600 + t.minute * 60);
+        return t;
+    }
+
+    inline void civilFromSeconds(const double *seconds, int count, CivilTime *out) {
+        for (int i = 0; i < count; i++)
+            out[i] = civilFromSeconds(seconds[i]);
+    }
+
+    inline void secondsFromCivil(const CivilTime *times, int count, double *out) {
+        for (int i = 0; i < count; i++) {
+            const CivilTime &t = times[i];
+            out[i] = secondsFromCivil(t.year, t.month, t.day, t.hour, t.minute, t.second);
+        }
+    }
+
+}
+
+#endif
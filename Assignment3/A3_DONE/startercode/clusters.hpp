@@ -0,0 +1,153 @@
+#ifndef CLUSTERS_HPP
+#define CLUSTERS_HPP
+
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <algorithm>
+#include <unordered_map>
+#include "filter.hpp"
+#include "quake.hpp"
+
+// Quakes of one cell merged into a single marker
+struct QuakeCluster {
+    // Total radiated energy in joules
+    double energy;
+    // Sum of the quakes' unit position vectors weighted by energy
+    double x, y, z;
+    int count;
+};
+
+// Aggregates the quakes in a TimeWindowCursor into cells of roughly
+// equal area, so dense windows draw one marker per cell instead of one
+// per quake. The cells are kept up to date from the ranges that entered
+// and left the window, so sliding the window costs only the quakes that
+// changed; the cells are rebuilt only when their size changes.
+class QuakeClusters {
+public:
+    QuakeClusters(): db(NULL), selection(NULL), cellDegrees(0), nBands(0) {}
+    void reset(const EarthquakeDatabase *db);
+    // Leaves out the rows selection does not contain (NULL keeps them all);
+    // takes effect at the next rebuild
+    void setSelection(const QuakeSelection *s) { selection = s; }
+    // Sets the cell size, rebuilding from the window if it changed
+    void setCellDegrees(float degrees, const TimeWindowCursor &window);
+    float getCellDegrees() const { return cellDegrees; }
+    // Applies the ranges that entered and left in the window's last moveTo
+    void update(const TimeWindowCursor &window);
+    // Clears the cells and adds every quake in the window
+    void rebuild(const TimeWindowCursor &window);
+    int size() const { return cells.size(); }
+
+    typedef std::unordered_map<int, QuakeCluster>::const_iterator const_iterator;
+    const_iterator begin() const { return cells.begin(); }
+    const_iterator end() const { return cells.end(); }
+
+    // Energy-weighted centre of a cluster in degrees
+    static void getLocation(const QuakeCluster &c, float &latitude, float &longitude);
+    // Magnitude of a single quake releasing the cluster's total energy
+    static float getMagnitude(const QuakeCluster &c);
+    // Cell size that spans about the given number of pixels at the
+    // Earth's surface for a camera at distance dist from its centre,
+    // rounded to a power of two so small zooms do not cause rebuilds
+    static float cellDegreesFor(float dist, float fovDegrees, int viewportHeight, float pixels);
+protected:
+    const EarthquakeDatabase *db;
+    const QuakeSelection *selection;
+    float cellDegrees;
+    int nBands;
+    std::unordered_map<int, QuakeCluster> cells;
+
+    int cellOf(float latitude, float longitude) const;
+    void addRows(int first, int last, int sign);
+};
+
+// Definitions below
+
+inline void QuakeClusters::reset(const EarthquakeDatabase *database) {
+    db = database;
+    cellDegrees = 0;
+    cells.clear();
+}
+
+inline void QuakeClusters::setCellDegrees(float degrees, const TimeWindowCursor &window) {
+    if (degrees == cellDegrees)
+        return;
+    cellDegrees = degrees;
+    nBands = (int)ceil(180 / cellDegrees);
+    rebuild(window);
+}
+
+inline int QuakeClusters::cellOf(float latitude, float longitude) const {
+    // Equal-height bands split into cos(latitude)-proportional cells, as
+    // in QuakeSpatialIndex
+    int band = std::min(std::max((int)floor((latitude + 90) / cellDegrees), 0), nBands - 1);
+    float centre = -90 + (band + 0.5f) * cellDegrees;
+    int nCells = std::max((int)floor(360 / cellDegrees * cos(centre * M_PI / 180) + 0.5), 1);
+    int cell = std::min(std::max((int)floor((longitude + 180) / 360 * nCells), 0), nCells - 1);
+    int maxCells = (int)ceil(360 / cellDegrees);
+    return band * maxCells + cell;
+}
+
+inline void QuakeClusters::addRows(int first, int last, int sign) {
+    for (int i = first; i < last; i++) {
+        if (selection != NULL && !selection->contains(i))
+            continue;
+        float lat = db->getLatitude(i), lon = db->getLongitude(i);
+        int key = cellOf(lat, lon);
+        QuakeCluster &c = cells[key];
+        if (sign < 0 && c.count <= 1) {
+            // Erase rather than subtract so rounding never leaves residue
+            cells.erase(key);
+            continue;
+        }
+        double e = sign * seismicEnergy(db->getMagnitude(i));
+        double phi = lat * M_PI / 180, theta = lon * M_PI / 180;
+        c.energy += e;
+        c.x += e * cos(phi) * sin(theta);
+        c.y += e * sin(phi);
+        c.z += e * cos(phi) * cos(theta);
+        c.count += sign;
+    }
+}
+
+inline void QuakeClusters::update(const TimeWindowCursor &window) {
+    if (db == NULL || cellDegrees == 0)
+        return;
+    for (int r = 0; r < window.getRemovedCount(); r++)
+        addRows(window.getRemoved(r).first, window.getRemoved(r).last, -1);
+    for (int a = 0; a < window.getAddedCount(); a++)
+        addRows(window.getAdded(a).first, window.getAdded(a).last, 1);
+}
+
+inline void QuakeClusters::rebuild(const TimeWindowCursor &window) {
+    cells.clear();
+    if (db == NULL || cellDegrees == 0)
+        return;
+    addRows(window.getStart(), window.getEnd() + 1, 1);
+}
+
+inline void QuakeClusters::getLocation(const QuakeCluster &c, float &latitude, float &longitude) {
+    double r = sqrt(c.x * c.x + c.y * c.y + c.z * c.z);
+    if (r == 0) {
+        latitude = longitude = 0;
+        return;
+    }
+    latitude = asin(std::min(std::max(c.y / r, -1.0), 1.0)) * 180 / M_PI;
+    longitude = atan2(c.x, c.z) * 180 / M_PI;
+}
+
+inline float QuakeClusters::getMagnitude(const QuakeCluster &c) {
+    if (c.energy <= 0)
+        return 0;
+    return (log10(c.energy) - 4.8) / 1.5;
+}
+
+inline float QuakeClusters::cellDegreesFor(float dist, float fovDegrees, int viewportHeight, float pixels) {
+    // World size of one pixel at the nearest point of the unit sphere
+    float pixelSize = 2 * (dist - 1) * tan(fovDegrees * M_PI / 360) / viewportHeight;
+    float degrees = pixels * pixelSize * 180 / M_PI;
+    degrees = pow(2.0f, floor(log2(degrees) + 0.5f));
+    return std::min(std::max(degrees, 0.125f), 45.0f);
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef COLUMN_HPP
+#define COLUMN_HPP
+
+#include <cstddef>
+#include <vector>
+
+// One column of a structure-of-arrays table. A column either owns its
+// values in a vector, or is a read-only view of memory owned by someone
+// else (e.g. a memory-mapped cache file). Any modification of a view
+// first copies the values into owned storage.
+template <typename T>
+class Column {
+public:
+    Column(): external(NULL), externalSize(0) {}
+    // Makes this column a view of count values at data; the memory must
+    // outlive the column or be replaced before it goes away
+    void view(const T *data, size_t count);
+    bool isView() const { return external != NULL; }
+    size_t size() const { return external != NULL ? externalSize : values.size(); }
+    bool empty() const { return size() == 0; }
+    const T *data() const { return external != NULL ? external : values.data(); }
+    T *data() { detach(); return values.data(); }
+    const T &operator[](size_t i) const { return data()[i]; }
+    const T *begin() const { return data(); }
+    const T *end() const { return data() + size(); }
+    const T &back() const { return data()[size() - 1]; }
+    void push_back(const T &value) { detach(); values.push_back(value); }
+    void append(const T *first, const T *last);
+    void reserve(size_t n) { detach(); values.reserve(n); }
+    void resize(size_t n) { detach(); values.resize(n); }
+    void clear() { external = NULL; externalSize = 0; values.clear(); }
+protected:
+    std::vector<T> values;
+    const T *external;
+    size_t externalSize;
+    // Copies viewed values into owned storage
+    void detach();
+};
+
+// Definitions below
+
+template <typename T>
+inline void Column<T>::view(const T *data, size_t count) {
+    values.clear();
+    values.shrink_to_fit();
+    external = data;
+    externalSize = count;
+}
+
+template <typename T>
+inline void Column<T>::append(const T *first, const T *last) {
+    detach();
+    values.insert(values.end(), first, last);
+}
+
+template <typename T>
+inline void Column<T>::detach() {
+    if (external == NULL)
+        return;
+    values.assign(external, external + externalSize);
+    external = NULL;
+    externalSize = 0;
+}
+
+#endif
@@ -0,0 +1,361 @@
+#ifndef COMPRESSED_HPP
+#define COMPRESSED_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include "quake.hpp"
+
+// Rows of an EarthquakeDatabase packed into blocks of blockRows rows, for
+// catalogs too large to keep as columns of floats and doubles. Within a
+// block every field is quantized to integers and stored relative to the
+// block's smallest value with just enough bits for the block's range
+// (frame-of-reference bit packing):
+//   time       milliseconds since the previous row (the first row's time
+//              is kept exactly in the block header)
+//   lat, lon   1e-5 degrees, about 1 m
+//   depth      0.1 km
+//   magnitude  0.1, in [0, 25.5] so at most 8 bits
+//   magType    index into a dictionary of the catalog's codes
+// Each block's header also holds the bounds of its time, location and
+// magnitude, so queries skip blocks whose bounds miss, answer from the
+// header when a block is wholly inside, and decode only what is left.
+class CompressedQuakes {
+public:
+    static const int blockRows = 1024;
+    enum Field { Time, Latitude, Longitude, Depth, Magnitude, MagnitudeType, nFields };
+
+    struct Block {
+        int firstRow, count;
+        // Where the block's values start in the stream, in bits; each
+        // field follows the one before it
+        uint64_t bitOffset;
+        // Exact time of the first row, and the decoded time of the last
+        double firstTime, lastTime;
+        float latMin, latMax, lonMin, lonMax, magMax;
+        // Per field: bits per value, and the value they are relative to
+        uint8_t bits[nFields];
+        int64_t reference[nFields];
+    };
+
+    CompressedQuakes(): nRows(0) {}
+    // Packs every row of db
+    void build(const EarthquakeDatabase &db);
+    int size() const { return nRows; }
+    int getBlockCount() const { return blocks.size(); }
+    const Block &getBlock(int b) const { return blocks[b]; }
+    // Memory used by the blocks, their headers and the dictionary
+    size_t getBytes() const;
+
+    // Decodes block b into rows [block.firstRow, block.firstRow + count)
+    // of out, which must already hold that many rows
+    void decode(int b, QuakeColumns &out) const;
+    // Decodes one field of block b; out has room for the block's rows
+    void decodeTimes(int b, double *out) const;
+    void decodeLocations(int b, float *latitudes, float *longitudes) const;
+    void decodeMagnitudes(int b, float *out) const;
+
+    // Rows with time in [t0, t1], like lower_bound(t0) and upper_bound(t1)
+    // on the times; decodes at most the two blocks at the ends
+    IndexRange findTimeRange(double t0, double t1) const;
+    // Appends to out the rows with latitude in [latMin, latMax],
+    // longitude in [lonMin, lonMax] and time in [t0, t1]
+    void queryBox(float latMin, float latMax, float lonMin, float lonMax,
+                  double t0, double t1, std::vector<int> &out) const;
+    // Largest magnitude of the rows with time in [t0, t1], or lowest
+    // float if there are none
+    float maxMagnitude(double t0, double t1) const;
+protected:
+    int nRows;
+    std::vector<Block> blocks;
+    std::vector<uint64_t> stream;
+    std::vector<MagType> magTypes;
+
+    // First block whose last row is at or after t
+    int findBlock(double t) const;
+    // Unpacks field f of block b as integers
+    void unpack(int b, Field f, int64_t *out) const;
+    uint64_t fieldOffset(const Block &block, Field f) const;
+};
+
+// Bits needed for values in [0, range]
+int bitsFor(uint64_t range);
+// Writes the low bits of value at bit pos of words, which must be long
+// enough and zero from pos on
+void writeBits(std::vector<uint64_t> &words, uint64_t pos, uint64_t value, int bits);
+// Reads bits (at most 64) bits at bit pos
+uint64_t readBits(const uint64_t *words, uint64_t pos, int bits);
+
+// Definitions below
+
+inline int bitsFor(uint64_t range) {
+    int bits = 0;
+    while (bits < 64 && (range >> bits) != 0)
+        bits++;
+    return bits;
+}
+
+inline void writeBits(std::vector<uint64_t> &words, uint64_t pos, uint64_t value, int bits) {
+    if (bits == 0)
+        return;
+    uint64_t w = pos >> 6;
+    int shift = pos & 63;
+    words[w] |= value << shift;
+    if (shift + bits > 64)
+        words[w + 1] |= value >> (64 - shift);
+}
+
+inline uint64_t readBits(const uint64_t *words, uint64_t pos, int bits) {
+    if (bits == 0)
+        return 0;
+    uint64_t w = pos >> 6;
+    int shift = pos & 63;
+    uint64_t v = words[w] >> shift;
+    if (shift + bits > 64)
+        v |= words[w + 1] << (64 - shift);
+    return bits == 64 ? v : v & (((uint64_t)1 << bits) - 1);
+}
+
+inline uint64_t CompressedQuakes::fieldOffset(const Block &block, Field f) const {
+    uint64_t offset = block.bitOffset;
+    for (int i = 0; i < f; i++)
+        offset += (uint64_t)block.count * block.bits[i];
+    return offset;
+}
+
+inline void CompressedQuakes::build(const EarthquakeDatabase &db) {
+    nRows = db.getMaxIndex() + 1;
+    blocks.clear();
+    stream.clear();
+    magTypes.clear();
+    uint64_t bitPos = 0;
+    std::vector<int64_t> values[nFields];
+    for (int first = 0; first < nRows; first += blockRows) {
+        Block block;
+        block.firstRow = first;
+        block.count = std::min(blockRows, nRows - first);
+        block.bitOffset = bitPos;
+        block.firstTime = db.getSeconds(first);
+
+        // Quantize
+        int64_t previous = 0;
+        for (int f = 0; f < nFields; f++)
+            values[f].resize(block.count);
+        for (int i = 0; i < block.count; i++) {
+            int row = first + i;
+            int64_t ms = llround((db.getSeconds(row) - block.firstTime) * 1000);
+            values[Time][i] = ms - previous;
+            previous = ms;
+            values[Latitude][i] = llround(db.getLatitude(row) * 1e5);
+            values[Longitude][i] = llround(db.getLongitude(row) * 1e5);
+            values[Depth][i] = llround(db.getDepth(row) * 10);
+            values[Magnitude][i] = std::min(std::max(llround(db.getMagnitude(row) * 10), 0LL), 255LL);
+            const char *code = db.getMagnitudeType(row);
+            size_t t = 0;
+            while (t < magTypes.size() && strncmp(magTypes[t].code, code, sizeof(MagType)) != 0)
+                t++;
+            if (t == magTypes.size()) {
+                MagType m;
+                strncpy(m.code, code, sizeof(m.code));
+                magTypes.push_back(m);
+            }
+            values[MagnitudeType][i] = t;
+        }
+        block.lastTime = block.firstTime + previous / 1000.0;
+
+        // Pack each field relative to its smallest value
+        for (int f = 0; f < nFields; f++) {
+            int64_t lo = *std::min_element(values[f].begin(), values[f].end());
+            int64_t hi = *std::max_element(values[f].begin(), values[f].end());
+            block.reference[f] = lo;
+            block.bits[f] = bitsFor((uint64_t)(hi - lo));
+            if (f == Latitude) {
+                block.latMin = (float)(lo / 1e5);
+                block.latMax = (float)(hi / 1e5);
+            } else if (f == Longitude) {
+                block.lonMin = (float)(lo / 1e5);
+                block.lonMax = (float)(hi / 1e5);
+            } else if (f == Magnitude) {
+                block.magMax = (float)(hi / 10.0);
+            }
+        }
+        uint64_t blockBits = 0;
+        for (int f = 0; f < nFields; f++)
+            blockBits += (uint64_t)block.count * block.bits[f];
+        stream.resize((bitPos + blockBits + 63) / 64 + 1, 0);
+        for (int f = 0; f < nFields; f++) {
+            for (int i = 0; i < block.count; i++) {
+                writeBits(stream, bitPos, (uint64_t)(values[f][i] - block.reference[f]), block.bits[f]);
+                bitPos += block.bits[f];
+            }
+        }
+        blocks.push_back(block);
+    }
+    stream.shrink_to_fit();
+    blocks.shrink_to_fit();
+}
+
+inline size_t CompressedQuakes::getBytes() const {
+    return stream.size() * sizeof(uint64_t) + blocks.size() * sizeof(Block) + magTypes.size() * sizeof(MagType);
+}
+
+inline void CompressedQuakes::unpack(int b, Field f, int64_t *out) const {
+    const Block &block = blocks[b];
+    uint64_t pos = fieldOffset(block, f);
+    int bits = block.bits[f];
+    int64_t reference = block.reference[f];
+    for (int i = 0; i < block.count; i++, pos += bits)
+        out[i] = reference + (int64_t)readBits(&stream[0], pos, bits);
+}
+
+inline void CompressedQuakes::decodeTimes(int b, double *out) const {
+    const Block &block = blocks[b];
+    int64_t deltas[blockRows];
+    unpack(b, Time, deltas);
+    int64_t ms = 0;
+    for (int i = 0; i < block.count; i++) {
+        ms += deltas[i];
+        out[i] = block.firstTime + ms / 1000.0;
+    }
+}
+
+// Dividing in double rounds like parsing the decimal text did, so values
+// with no more decimals than the quantum come back exactly
+
+inline void CompressedQuakes::decodeLocations(int b, float *latitudes, float *longitudes) const {
+    int64_t values[blockRows];
+    unpack(b, Latitude, values);
+    for (int i = 0; i < blocks[b].count; i++)
+        latitudes[i] = (float)(values[i] / 1e5);
+    unpack(b, Longitude, values);
+    for (int i = 0; i < blocks[b].count; i++)
+        longitudes[i] = (float)(values[i] / 1e5);
+}
+
+inline void CompressedQuakes::decodeMagnitudes(int b, float *out) const {
+    int64_t values[blockRows];
+    unpack(b, Magnitude, values);
+    for (int i = 0; i < blocks[b].count; i++)
+        out[i] = (float)(values[i] / 10.0);
+}
+
+inline void CompressedQuakes::decode(int b, QuakeColumns &out) const {
+    const Block &block = blocks[b];
+    int first = block.firstRow;
+    decodeTimes(b, out.seconds.data() + first);
+    decodeLocations(b, out.latitudes.data() + first, out.longitudes.data() + first);
+    decodeMagnitudes(b, out.magnitudes.data() + first);
+    int64_t values[blockRows];
+    unpack(b, Depth, values);
+    float *depths = out.depths.data() + first;
+    for (int i = 0; i < block.count; i++)
+        depths[i] = (float)(values[i] / 10.0);
+    unpack(b, MagnitudeType, values);
+    MagType *codes = out.magTypes.data() + first;
+    for (int i = 0; i < block.count; i++)
+        codes[i] = magTypes[values[i]];
+}
+
+inline int CompressedQuakes::findBlock(double t) const {
+    int lo = 0, hi = blocks.size();
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (blocks[mid].lastTime < t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+inline IndexRange CompressedQuakes::findTimeRange(double t0, double t1) const {
+    IndexRange range;
+    range.first = range.last = 0;
+    if (blocks.empty() || t1 < t0)
+        return range;
+    // First block that can hold a row at or after t0, then the first
+    // such row in it; likewise for the first row after t1
+    double bounds[2] = {t0, t1};
+    int rows[2];
+    for (int k = 0; k < 2; k++) {
+        int lo = 0, hi = blocks.size();
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (k == 0 ? blocks[mid].lastTime < bounds[k] : blocks[mid].lastTime <= bounds[k])
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo == (int)blocks.size()) {
+            rows[k] = nRows;
+            continue;
+        }
+        // The deltas are summed only up to the row sought
+        const Block &block = blocks[lo];
+        uint64_t pos = fieldOffset(block, Time);
+        int bits = block.bits[Time];
+        int64_t ms = 0;
+        int i = 0;
+        for (; i < block.count; i++, pos += bits) {
+            ms += block.reference[Time] + (int64_t)readBits(&stream[0], pos, bits);
+            double t = block.firstTime + ms / 1000.0;
+            if (k == 0 ? t >= bounds[k] : t > bounds[k])
+                break;
+        }
+        rows[k] = block.firstRow + i;
+    }
+    range.first = rows[0];
+    range.last = std::max(rows[1], rows[0]);
+    return range;
+}
+
+inline void CompressedQuakes::queryBox(float latMin, float latMax, float lonMin, float lonMax,
+                                       double t0, double t1, std::vector<int> &out) const {
+    double times[blockRows];
+    float latitudes[blockRows], longitudes[blockRows];
+    for (int b = findBlock(t0); b < (int)blocks.size(); b++) {
+        const Block &block = blocks[b];
+        if (block.firstTime > t1)
+            break;
+        if (block.latMax < latMin || block.latMin > latMax || block.lonMax < lonMin || block.lonMin > lonMax)
+            continue;
+        // Times are only decoded for blocks straddling the range
+        bool inside = block.firstTime >= t0 && block.lastTime <= t1;
+        if (!inside)
+            decodeTimes(b, times);
+        decodeLocations(b, latitudes, longitudes);
+        for (int i = 0; i < block.count; i++) {
+            if ((inside || (times[i] >= t0 && times[i] <= t1)) && latitudes[i] >= latMin && latitudes[i] <= latMax
+                && longitudes[i] >= lonMin && longitudes[i] <= lonMax)
+                out.push_back(block.firstRow + i);
+        }
+    }
+}
+
+inline float CompressedQuakes::maxMagnitude(double t0, double t1) const {
+    float m = std::numeric_limits<float>::lowest();
+    double times[blockRows];
+    float magnitudes[blockRows];
+    for (int b = findBlock(t0); b < (int)blocks.size(); b++) {
+        const Block &block = blocks[b];
+        if (block.firstTime > t1)
+            break;
+        // Inside the range: the header has the answer
+        if (block.firstTime >= t0 && block.lastTime <= t1) {
+            m = std::max(m, block.magMax);
+            continue;
+        }
+        decodeTimes(b, times);
+        decodeMagnitudes(b, magnitudes);
+        for (int i = 0; i < block.count; i++) {
+            if (times[i] >= t0 && times[i] <= t1)
+                m = std::max(m, magnitudes[i]);
+        }
+    }
+    return m;
+}
+
+#endif
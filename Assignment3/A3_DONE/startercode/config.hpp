@@ -1,7 +1,9 @@
 #ifndef CONFIG_HPP
 #define CONFIG_HPP
 
+#include <cstddef>
 #include <string>
+#include <vector>
 
 namespace Config {
 
@@ -11,8 +13,57 @@ namespace Config {
 
     const std::string quakeFile = dataDir + "\\earthquakes.txt";
 
+    // Height maps from finest to coarsest; the terrain uses the finest
+    // whose mesh at full detail fits in terrainBudgetBytes
+    const std::vector<std::string> heightFiles = {
+        dataDir + "\\height-1k.bmp",
+        dataDir + "\\height-512.bmp",
+        dataDir + "\\height-256s.bmp"
+    };
+
+    // Directory holding the shader files
+    const std::string codeDir = ".";
+
+    const std::string markerVert = codeDir + "\\marker.vert";
+    const std::string markerFrag = codeDir + "\\marker.frag";
+    const std::string quakeVert = codeDir + "\\quake.vert";
+    const std::string earthVert = codeDir + "\\earth.vert";
+    const std::string earthFrag = codeDir + "\\earth.frag";
+
     const float timeWindow = 365*24*3600;
 
+    // How often --follow checks the catalog for new rows when it is not
+    // notified of writes
+    const int followMilliseconds = 500;
+
+    // Terrain: height map value at sea level (which stays at radius 1),
+    // radius added per unit of height map value, quads along each side
+    // of a chunk, largest allowed on-screen error in pixels, and the GPU
+    // memory cached chunks may use
+    const float terrainSeaLevel = 0.5f;
+    const float terrainHeight = 0.04f;
+    const int terrainResolution = 16;
+    const float terrainPixelError = 2;
+    const size_t terrainBudgetBytes = 32 << 20;
+
+    // Approximate on-screen size of a cell when quakes are clustered
+    const float clusterPixels = 8;
+
+    // Density heatmap: grid size in texels (covering the globe like the
+    // Earth texture), kernel radius in texels, overlapping quake peaks at
+    // which the color saturates, and opacity of the overlay
+    const int densityWidth = 1024;
+    const int densityHeight = 512;
+    const int densityRadius = 6;
+    const float densitySaturation = 40;
+    const float densityOpacity = 0.85f;
+
+    // How far from a quake's marker (in pixels) the mouse still picks it
+    const float pickPixels = 8;
+
+    // Length of the time buckets the statistics panel aggregates over
+    const double statsBucketSeconds = 24*3600;
+
 }
 
 #endif
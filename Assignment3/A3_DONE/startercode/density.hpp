@@ -0,0 +1,221 @@
+#ifndef DENSITY_HPP
+#define DENSITY_HPP
+
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "config.hpp"
+#include "engine.hpp"
+#include "filter.hpp"
+#include "quake.hpp"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DENSITY_SSE2
+#endif
+
+// Kernel density of the quakes in a TimeWindowCursor, in an
+// equirectangular grid laid out like the Earth texture (row 0 at the
+// north pole, as in Earth::getTCoord). Every quake adds a Gaussian
+// kernel in fixed point, so quakes leaving the window subtract exactly
+// what they added and the grid never drifts. The kernel has the same
+// size in texels everywhere, so it looks narrower towards the poles.
+// Only rows touched since the last upload are converted to colors and
+// copied to the texture.
+class DensityMap {
+public:
+    DensityMap(): db(NULL), selection(NULL), width(0), height(0), radius(0), texture(0) {}
+    ~DensityMap();
+    // Allocates a width x height grid, with kernels reaching radius
+    // texels from the quake's texel. The texture is created by upload().
+    void initialize(const EarthquakeDatabase *db, int width, int height, int radius);
+    // Adds the rows that entered and subtracts those that left the
+    // window in its last moveTo
+    void update(const TimeWindowCursor &window);
+    // Clears the grid and adds every quake in the window
+    void rebuild(const TimeWindowCursor &window);
+    // Leaves out the rows selection does not contain (NULL keeps them all);
+    // takes effect at the next rebuild
+    void setSelection(const QuakeSelection *s) { selection = s; }
+    // Copies the rows changed since the last upload to the texture; all
+    // rows the first time
+    void upload();
+    Texture getTexture() const { return texture; }
+    // Density of a texel, where one quake adds densityScale at its centre
+    int at(int x, int y) const { return grid[y * width + x]; }
+    static const int densityScale = 1 << 12;
+protected:
+    DensityMap(const DensityMap&) = delete;
+    DensityMap& operator=(const DensityMap&) = delete;
+
+    const EarthquakeDatabase *db;
+    const QuakeSelection *selection;
+    int width, height, radius;
+    std::vector<int32_t> grid;
+    // (2 radius + 1)^2 weights, row by row
+    std::vector<int32_t> kernel;
+    std::vector<char> dirtyRows;
+    // RGBA colors for density >> lutShift, and the colored grid
+    static const int lutShift = 6;
+    std::vector<uint32_t> colors;
+    std::vector<uint32_t> pixels;
+    Texture texture;
+
+    void addRows(int first, int last, int sign);
+    void splat(float latitude, float longitude, int sign);
+};
+
+// dst[i] += src[i] (or -= if sign is negative) for i in [0, n)
+void addWeights(int32_t *dst, const int32_t *src, int n, int sign);
+
+// Definitions below
+
+inline void addWeights(int32_t *dst, const int32_t *src, int n, int sign) {
+    int i = 0;
+#ifdef DENSITY_SSE2
+    // Four texels per instruction; the tail is done one by one
+    if (sign > 0) {
+        for (; i + 4 <= n; i += 4) {
+            __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+            __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi32(d, s));
+        }
+    } else {
+        for (; i + 4 <= n; i += 4) {
+            __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+            __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_sub_epi32(d, s));
+        }
+    }
+#endif
+    if (sign > 0) {
+        for (; i < n; i++)
+            dst[i] += src[i];
+    } else {
+        for (; i < n; i++)
+            dst[i] -= src[i];
+    }
+}
+
+inline DensityMap::~DensityMap() {
+    if (texture != 0)
+        glDeleteTextures(1, &texture);
+}
+
+inline void DensityMap::initialize(const EarthquakeDatabase *database, int w, int h, int r) {
+    db = database;
+    width = w;
+    height = h;
+    radius = std::min(r, std::min(w, h) / 2 - 1);
+    grid.assign(width * height, 0);
+    dirtyRows.assign(height, 1);
+    pixels.assign(width * height, 0);
+
+    // Gaussian with the kernel's edge at two standard deviations
+    int span = 2 * radius + 1;
+    float sigma = std::max(radius / 2.0f, 0.5f);
+    kernel.resize(span * span);
+    for (int y = 0; y < span; y++) {
+        for (int x = 0; x < span; x++) {
+            float d2 = (x - radius) * (x - radius) + (y - radius) * (y - radius);
+            kernel[y * span + x] = d2 > (radius + 0.5f) * (radius + 0.5f) ? 0
+                : (int32_t)floor(densityScale * exp(-d2 / (2 * sigma * sigma)) + 0.5);
+        }
+    }
+
+    // Transparent through red and yellow to white, on a log scale that
+    // saturates at Config::densitySaturation quakes' peaks
+    int nColors = (int)(Config::densitySaturation * densityScale) >> lutShift;
+    colors.resize(nColors + 1);
+    for (int c = 0; c <= nColors; c++) {
+        float density = (float)(c << lutShift) / densityScale;
+        float t = std::min((float)(log(1 + density) / log(1 + Config::densitySaturation)), 1.0f);
+        float rgba[4] = {std::min(3 * t, 1.0f), std::min(std::max(3 * t - 1, 0.0f), 1.0f),
+                         std::min(std::max(3 * t - 2, 0.0f), 1.0f), std::min(2 * t, 1.0f) * Config::densityOpacity};
+        uint8_t *bytes = (uint8_t*)&colors[c];
+        for (int i = 0; i < 4; i++)
+            bytes[i] = (uint8_t)(rgba[i] * 255 + 0.5f);
+    }
+}
+
+inline void DensityMap::splat(float latitude, float longitude, int sign) {
+    int span = 2 * radius + 1;
+    int cx = (int)floor((longitude / 360 + 0.5f) * width);
+    int cy = std::min(std::max((int)floor((-latitude / 180 + 0.5f) * height), 0), height - 1);
+    // Left edge of the kernel, wrapped around in longitude
+    int left = ((cx - radius) % width + width) % width;
+    for (int ky = 0; ky < span; ky++) {
+        int y = cy - radius + ky;
+        if (y < 0 || y >= height)
+            continue;
+        dirtyRows[y] = 1;
+        int32_t *row = &grid[y * width];
+        const int32_t *weights = &kernel[ky * span];
+        // At most two runs: up to the right edge, then on from column 0
+        int first = std::min(span, width - left);
+        addWeights(row + left, weights, first, sign);
+        if (first < span)
+            addWeights(row, weights + first, span - first, sign);
+    }
+}
+
+inline void DensityMap::addRows(int first, int last, int sign) {
+    for (int i = first; i < last; i++) {
+        if (selection == NULL || selection->contains(i))
+            splat(db->getLatitude(i), db->getLongitude(i), sign);
+    }
+}
+
+inline void DensityMap::update(const TimeWindowCursor &window) {
+    if (db == NULL)
+        return;
+    for (int r = 0; r < window.getRemovedCount(); r++)
+        addRows(window.getRemoved(r).first, window.getRemoved(r).last, -1);
+    for (int a = 0; a < window.getAddedCount(); a++)
+        addRows(window.getAdded(a).first, window.getAdded(a).last, 1);
+}
+
+inline void DensityMap::rebuild(const TimeWindowCursor &window) {
+    if (db == NULL)
+        return;
+    std::fill(grid.begin(), grid.end(), 0);
+    std::fill(dirtyRows.begin(), dirtyRows.end(), 1);
+    addRows(window.getStart(), window.getEnd() + 1, 1);
+}
+
+inline void DensityMap::upload() {
+    if (db == NULL)
+        return;
+    if (texture == 0) {
+        // Created on first use, so the grid also works without a context
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    }
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    int nColors = colors.size();
+    for (int y = 0; y < height; ) {
+        if (!dirtyRows[y]) {
+            y++;
+            continue;
+        }
+        // Color and copy each run of dirty rows with one call
+        int end = y;
+        for (; end < height && dirtyRows[end]; end++) {
+            dirtyRows[end] = 0;
+            const int32_t *density = &grid[end * width];
+            uint32_t *rgba = &pixels[end * width];
+            for (int x = 0; x < width; x++)
+                rgba[x] = colors[std::min(std::max(density[x], 0) >> lutShift, nColors - 1)];
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, width, end - y, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[y * width]);
+        y = end;
+    }
+}
+
+#endif
@@ -0,0 +1,29 @@
+#version 120
+
+// Textured (or flat colored, for the mesh view) Earth lit like the
+// fixed-function pipeline with GL_COLOR_MATERIAL: global ambient plus
+// the diffuse term of GL_LIGHT0. An overlay (e.g. the quake density)
+// is blended over the lit surface by its alpha.
+uniform sampler2D earthTexture;
+uniform int textured;
+uniform sampler2D overlayTexture;
+uniform int overlaid;
+
+varying vec3 position;
+varying vec3 normal;
+varying vec2 uv;
+
+void main() {
+    vec3 n = normalize(normal);
+    vec3 l = normalize(gl_LightSource[0].position.xyz - position * gl_LightSource[0].position.w);
+    vec3 shade = gl_LightModel.ambient.rgb + gl_LightSource[0].diffuse.rgb * max(dot(n, l), 0.0);
+    vec4 color = gl_Color;
+    if (textured != 0)
+        color *= texture2D(earthTexture, uv);
+    vec3 lit = color.rgb * shade;
+    if (overlaid != 0) {
+        vec4 overlay = texture2D(overlayTexture, uv);
+        lit = mix(lit, overlay.rgb, overlay.a);
+    }
+    gl_FragColor = vec4(lit, color.a);
+}
@@ -1,7 +1,9 @@
 ﻿#ifndef EARTH_HPP
 #define EARTH_HPP
 
+#include "config.hpp"
 #include "engine.hpp"
+#include "shader.hpp"
 #include <vector>
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
@@ -20,9 +22,18 @@ public:
     float isSpherical();
     void setSpherical(float spherical);
     vec3 getPosition(float latitude, float longitude);
+    // Positions on the flat map and on the globe, whatever the current shape
+    vec3 getRectangularPosition(float latitude, float longitude);
+    vec3 getSphericalPosition(float latitude, float longitude);
     vec3 getNormal(float latitude, float longitude);
+    vec3 getRectangularNormal(float latitude, float longitude);
+    vec3 getSphericalNormal(float latitude, float longitude);
 	vec2 getTCoord(float latitude, float longitude);
     void draw(bool textured);
+    Texture getTexture() const { return texture; }
+    // RGBA texture laid out like the Earth texture and blended over it
+    // by its alpha, or 0 for none
+    void setOverlay(Texture overlay) { overlayTexture = overlay; }
 protected:
     int slices, stacks;
     int nVertices, nTriangles;
@@ -31,11 +42,16 @@ protected:
 
     // TODO: Define the necessary buffers and texture.
     // Feel free to add helper methods to update the buffers.
-	VertexBuffer vertexBuffer, normalBuffer, texCoordBuffer;
+	// Both shapes are uploaded once; earth.vert blends between them
+	VertexBuffer rectVertexBuffer, rectNormalBuffer;
+	VertexBuffer sphereVertexBuffer, sphereNormalBuffer;
+	VertexBuffer texCoordBuffer;
 	ElementBuffer indexBuffer;
 	Texture texture;
-	vector<vec3> vertices;
-	vector<vec3> normals;
+	Texture overlayTexture = 0;
+	ShaderProgram program;
+	vector<vec3> rectVertices, sphereVertices;
+	vector<vec3> rectNormals, sphereNormals;
 	vector<int> indices;
 	vector<vec2> texCoords;
 
@@ -57,38 +73,60 @@ inline void Earth::initialize(Engine *e, int sl, int st, float sp) {
 	nVertices = (slices + 1)*(stacks + 1);
 	nTriangles = 2 * slices*stacks;
 
-	//load in texture
+	//load in texture and the shader that morphs between shapes
 	texture = engine->loadTexture(Config::textureFile);
+	program = ShaderProgram(Config::earthVert, Config::earthFrag);
 
 	//fill out vertices, normals, and indices
 	populateVNTArrays();
 	populateIArray();
 
-	vertexBuffer = engine->allocateVertexBuffer(nVertices * sizeof(vec3));
-	normalBuffer = engine->allocateVertexBuffer(nVertices * sizeof(vec3));
+	rectVertexBuffer = engine->allocateVertexBuffer(nVertices * sizeof(vec3));
+	rectNormalBuffer = engine->allocateVertexBuffer(nVertices * sizeof(vec3));
+	sphereVertexBuffer = engine->allocateVertexBuffer(nVertices * sizeof(vec3));
+	sphereNormalBuffer = engine->allocateVertexBuffer(nVertices * sizeof(vec3));
 	indexBuffer = engine->allocateElementBuffer(indices.size() * sizeof(int));
 	texCoordBuffer = engine->allocateVertexBuffer(nVertices * sizeof(vec2));
 
 	//copy data over to buffers
-	engine->copyVertexData(vertexBuffer, &vertices[0], nVertices * sizeof(vec3));
-	engine->copyVertexData(normalBuffer, &normals[0], nVertices * sizeof(vec3));
+	engine->copyVertexData(rectVertexBuffer, &rectVertices[0], nVertices * sizeof(vec3));
+	engine->copyVertexData(rectNormalBuffer, &rectNormals[0], nVertices * sizeof(vec3));
+	engine->copyVertexData(sphereVertexBuffer, &sphereVertices[0], nVertices * sizeof(vec3));
+	engine->copyVertexData(sphereNormalBuffer, &sphereNormals[0], nVertices * sizeof(vec3));
 	engine->copyElementData(indexBuffer, &indices[0], indices.size() * sizeof(int));
 	engine->copyVertexData(texCoordBuffer, &texCoords[0], nVertices * sizeof(vec2));
+
+	//the CPU copies are no longer needed
+	rectVertices = vector<vec3>();
+	sphereVertices = vector<vec3>();
+	rectNormals = vector<vec3>();
+	sphereNormals = vector<vec3>();
+	texCoords = vector<vec2>();
 }
 /*-------------------------------------------------
 	populateVNTArrays: fill vertices, normals,
-						and texCoords arrays
+						and texCoords arrays for
+						both shapes
 -------------------------------------------------*/
 inline void Earth::populateVNTArrays() {
-	float xStep = 360.0 / slices;
-	float yStep = 180.0 / stacks;
-
-	//left to right, top to bottom
-	for (float y = 90; y >= -90; y -= yStep) {
-		for (float x = -180; x <= 180; x += xStep) {
-			vertices.push_back(getPosition(y, x)); //(lat, long)
-			normals.push_back(getNormal(y, x)); //(lat, long)
-			texCoords.push_back(getTCoord(y, x)); //(lat, long)
+	rectVertices.resize(nVertices);
+	sphereVertices.resize(nVertices);
+	rectNormals.resize(nVertices);
+	sphereNormals.resize(nVertices);
+	texCoords.resize(nVertices);
+
+	//left to right, top to bottom; integer steps so rounding can never
+	//add or drop a row or column at high slices/stacks
+	for (int j = 0; j <= stacks; j++) {
+		float y = 90 - 180.0 * j / stacks;
+		for (int i = 0; i <= slices; i++) {
+			float x = -180 + 360.0 * i / slices;
+			int v = j*(slices + 1) + i;
+			rectVertices[v] = getRectangularPosition(y, x); //(lat, long)
+			sphereVertices[v] = getSphericalPosition(y, x);
+			rectNormals[v] = getRectangularNormal(y, x);
+			sphereNormals[v] = getSphericalNormal(y, x);
+			texCoords[v] = getTCoord(y, x);
 		}
 	}
 }
@@ -120,22 +158,13 @@ inline float Earth::isSpherical() {
     return spherical;
 }
 /*-------------------------------------------------
-	setSpherical: update V and N buffers
-					to display mesh as a sphere
+	setSpherical: set the blend between rectangle
+					(0) and sphere (1)
+	(the buffers hold both shapes, so nothing is
+		re-uploaded; draw() passes s to the shader)
 -------------------------------------------------*/
 inline void Earth::setSpherical(float s) {
     spherical = s;
-
-    // TODO: Also update the relevant buffers.
-    // You should only need to update two buffers, not all of them.
-	//empty and repopulate V,N,T vectors
-	vertices = vector<vec3>();
-	normals = vector<vec3>();
-	texCoords = vector<vec2>();
-	populateVNTArrays();
-
-	engine->copyVertexData(vertexBuffer, &vertices[0], nVertices * sizeof(vec3));
-	engine->copyVertexData(normalBuffer, &normals[0], nVertices * sizeof(vec3));
 }
 /*-------------------------------------------------
 	getPosition: returns vec3 representing 3D
@@ -149,8 +178,32 @@ inline vec3 Earth::getPosition(float latitude, float longitude) {
     vec3 rectangularPosition(0,0,0), sphericalPosition(0,0,0);
 
     // TODO compute vertex positions on rectangle and sphere
+	rectangularPosition = getRectangularPosition(latitude, longitude);
+	sphericalPosition = getSphericalPosition(latitude, longitude);
+
+    if (spherical == 0)
+        return rectangularPosition;
+    else if (spherical == 1)
+        return sphericalPosition;
+    else {
+        // same blend as earth.vert
+        return glm::mix(rectangularPosition, sphericalPosition, spherical);
+    }
+}
+/*-------------------------------------------------
+	getRectangularPosition / getSphericalPosition:
+					position on the flat map and
+					on the unit sphere
+-------------------------------------------------*/
+inline vec3 Earth::getRectangularPosition(float latitude, float longitude) {
+	vec3 rectangularPosition(0, 0, 0);
 	rectangularPosition.x = (tWidth / 360.0)*longitude;
 	rectangularPosition.y = (tHeight / 180.0)*latitude;
+	return rectangularPosition;
+}
+
+inline vec3 Earth::getSphericalPosition(float latitude, float longitude) {
+	vec3 sphericalPosition(0, 0, 0);
 
 	//convert lat and long to radians for trig functions
 	latitude = (latitude * M_PI) / 180.0;
@@ -159,17 +212,7 @@ inline vec3 Earth::getPosition(float latitude, float longitude) {
 	sphericalPosition.x = cos(latitude)*sin(longitude);
 	sphericalPosition.y = sin(latitude);
 	sphericalPosition.z = cos(latitude)*cos(longitude);
-
-    if (spherical == 0)
-        return rectangularPosition;
-    else if (spherical == 1)
-        return sphericalPosition;
-    else {
-
-        // TODO compute the interpolated position
-        return vec3(0,0,0);
-
-    }
+	return sphericalPosition;
 }
 /*-------------------------------------------------
 	getNormal: returns normal vec3 corresponding
@@ -182,23 +225,28 @@ inline vec3 Earth::getNormal(float latitude, float longitude) {
     vec3 rectangularNormal(0,0,0), sphericalNormal(0,0,0);
 
     // TODO compute vertex positions on rectangle and sphere
-	rectangularNormal.z = 1;//assuming z is pointing out towards the camera
-
-	//normal is the radial vector normalized
-	sphericalNormal = getPosition(latitude, longitude) - vec3(0, 0, 0);
-	sphericalNormal /= Util::getV3Magnitude(sphericalNormal);
+	rectangularNormal = getRectangularNormal(latitude, longitude);
+	sphericalNormal = getSphericalNormal(latitude, longitude);
 
     if (spherical == 0)
         return rectangularNormal;
     else if (spherical == 1)
         return sphericalNormal;
     else {
-
-        // TODO compute the interpolated normal
-        return vec3(0,0,0);
-
+        // same blend as earth.vert
+        return glm::normalize(glm::mix(rectangularNormal, sphericalNormal, spherical));
     }
 }
+inline vec3 Earth::getRectangularNormal(float, float) {
+	return vec3(0, 0, 1);//assuming z is pointing out towards the camera
+}
+
+inline vec3 Earth::getSphericalNormal(float latitude, float longitude) {
+	//normal is the radial vector normalized
+	vec3 sphericalNormal = getSphericalPosition(latitude, longitude) - vec3(0, 0, 0);
+	sphericalNormal /= Util::getV3Magnitude(sphericalNormal);
+	return sphericalNormal;
+}
 /*-------------------------------------------------
 	getTCoord: returns texCoord corresponding to
 				given latitude and longitude
@@ -217,22 +265,42 @@ inline vec2 Earth::getTCoord(float latitude, float longitude) {
 	return tCoord;
 }
 inline void Earth::draw(bool textured) {
-	engine->setVertexArray(vertexBuffer);
-	engine->setNormalArray(normalBuffer);
+	//fixed-function arrays left on by other drawing would alias the
+	//shader's generic attributes on some drivers
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glDisableClientState(GL_COLOR_ARRAY);
+
+	program.enable();
+	program.setUniform("spherical", spherical);
+	program.setAttribute("rectPosition", rectVertexBuffer, 3, GL_FLOAT);
+	program.setAttribute("spherePosition", sphereVertexBuffer, 3, GL_FLOAT);
+	program.setAttribute("rectNormal", rectNormalBuffer, 3, GL_FLOAT);
+	program.setAttribute("sphereNormal", sphereNormalBuffer, 3, GL_FLOAT);
 
     // TODO: Draw the mesh (with or without texture, depending on the input)
 	if (textured) {
-		engine->setTexCoordArray(texCoordBuffer);
-		engine->setTexture(texture);
+		program.setAttribute("texCoord", texCoordBuffer, 2, GL_FLOAT);
+		program.setTexture("earthTexture", texture, 0);
+		program.setUniform("textured", 1);
+		program.setTexture("overlayTexture", overlayTexture, 1);
+		program.setUniform("overlaid", overlayTexture != 0 ? 1 : 0);
 		engine->drawElements(GL_TRIANGLES, indexBuffer, indices.size());
-
-		//so texture does not get applied to things drawn afterward
-		engine->unsetTexture();
+		program.unsetAttribute("texCoord");
 	}
 	else { //draw mesh triangles instead
 		glLineWidth(2);
+		program.setUniform("textured", 0);
+		program.setUniform("overlaid", 0);
 		engine->drawElements(GL_TRIANGLES, indexBuffer, indices.size());
 	}
+
+	program.unsetAttribute("rectPosition");
+	program.unsetAttribute("spherePosition");
+	program.unsetAttribute("rectNormal");
+	program.unsetAttribute("sphereNormal");
+	program.disable();
 }
 
 #endif
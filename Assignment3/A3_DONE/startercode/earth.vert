@@ -0,0 +1,24 @@
+#version 120
+
+// The same mesh vertex on the flat map and on the globe
+attribute vec3 rectPosition;
+attribute vec3 spherePosition;
+attribute vec3 rectNormal;
+attribute vec3 sphereNormal;
+attribute vec2 texCoord;
+
+// 0 for the flat map, 1 for the globe
+uniform float spherical;
+
+varying vec3 position;
+varying vec3 normal;
+varying vec2 uv;
+
+void main() {
+    vec4 world = vec4(mix(rectPosition, spherePosition, spherical), 1.0);
+    position = (gl_ModelViewMatrix * world).xyz;
+    normal = gl_NormalMatrix * mix(rectNormal, sphereNormal, spherical);
+    uv = texCoord;
+    gl_FrontColor = gl_Color;
+    gl_Position = gl_ModelViewProjectionMatrix * world;
+}
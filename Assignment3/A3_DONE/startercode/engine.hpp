@@ -12,13 +12,17 @@ typedef GLuint Texture;
 
 class Engine {
 public:
+	static void errorMessage(std::string message);
+    static void die_if_opengl_error();
+
     Engine();
     ~Engine();
-    SDL_Window* createWindow(std::string title, int width, int height);
+    // A hidden window only provides the OpenGL context, for rendering
+    // offscreen
+    SDL_Window* createWindow(std::string title, int width, int height, bool visible = true);
     void destroyWindow(SDL_Window*);
     bool shouldQuit();
     void handleInput();
-	void errorMessage(std::string message);
     void waitForNextFrame(float secondsPerFrame);
     // input state
     bool isKeyDown(int scancode);
@@ -32,6 +36,7 @@ public:
     virtual void onMouseMotion(SDL_MouseMotionEvent&) {}
     virtual void onMouseButtonDown(SDL_MouseButtonEvent&) {}
     virtual void onMouseButtonUp(SDL_MouseButtonEvent&) {}
+    virtual void onMouseWheel(SDL_MouseWheelEvent&) {}
     // vertex and element buffers
     VertexBuffer allocateVertexBuffer(int bytes);
     void copyVertexData(VertexBuffer buffer, void *data, int bytes);
@@ -50,7 +55,6 @@ protected:
     bool userQuit;
     int lastFrameTime;
     void die_with_sdl_error(std::string message);
-    void die_if_opengl_error();
 };
 
 // Definitions below
@@ -84,13 +88,13 @@ inline Engine::~Engine() {
     SDL_Quit();
 }
 
-inline SDL_Window* Engine::createWindow(std::string title, int width, int height) {
+inline SDL_Window* Engine::createWindow(std::string title, int width, int height, bool visible) {
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 2);
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
     SDL_Window *window =
         SDL_CreateWindow(title.c_str(),
                          SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-                         width, height, SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN);
+                         width, height, SDL_WINDOW_OPENGL | (visible ? SDL_WINDOW_SHOWN : SDL_WINDOW_HIDDEN));
 	if (window == NULL){
 		errorMessage("Failed to create window");
 		exit(EXIT_FAILURE);
@@ -138,6 +142,9 @@ inline void Engine::handleInput() {
         case SDL_MOUSEBUTTONUP:
             onMouseButtonUp(event.button);
             break;
+        case SDL_MOUSEWHEEL:
+            onMouseWheel(event.wheel);
+            break;
         }
     }
 }
@@ -0,0 +1,449 @@
+#ifndef FILTER_HPP
+#define FILTER_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <bitset>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "quake.hpp"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FILTER_SSE2
+#endif
+
+// One bit per row of an EarthquakeDatabase, set for the rows a
+// QuakeFilter selects
+class QuakeSelection {
+public:
+    QuakeSelection(): nRows(0) {}
+    int size() const { return nRows; }
+    bool contains(int row) const { return (words[row >> 6] >> (row & 63)) & 1; }
+    // Number of selected rows
+    int count() const;
+    // Resizes to rows rows, keeping the bits of the rows that remain;
+    // new rows start unselected
+    void resize(int rows);
+    uint64_t *getWords() { return words.data(); }
+protected:
+    int nRows;
+    std::vector<uint64_t> words;
+};
+
+// Column a filter compares, and the name it goes by in expressions
+enum QuakeField { FieldMagnitude, FieldDepth, FieldLatitude, FieldLongitude, nQuakeFields };
+const char *const quakeFieldNames[nQuakeFields] = {"mag", "depth", "lat", "lon"};
+
+// Boolean expression over the catalog columns, such as
+//     mag >= 6.5 && depth < 70 && lat in [-10, 20]
+// Comparisons (<, <=, >, >=, ==, !=) and inclusive ranges ("in [lo, hi]")
+// of the fields above combine with &&, || and !, and bind as in C; '#'
+// comments out the rest of a line. compile() turns the expression into a
+// postfix program of whole-column operations, which select() runs over
+// blocks of rows: each comparison fills a byte per row from one column,
+// the logic operators combine those bytes, and the result is packed into
+// a QuakeSelection. Every step is a plain loop over arrays that the
+// compiler can vectorize, instead of walking the expression for each row.
+class QuakeFilter {
+public:
+    QuakeFilter(): maxDepth(0) {}
+    // Returns false and sets getError() if expression does not parse. An
+    // empty expression selects every row.
+    bool compile(const std::string &expression);
+    // Compiles the expression in a text file, with its comments dropped
+    // and its lines joined so getExpression() fits on one line
+    bool compileFile(const std::string &filename);
+    const std::string &getExpression() const { return expression; }
+    const std::string &getError() const { return error; }
+    bool isEmpty() const { return program.empty(); }
+    // Evaluates every row of db into selection
+    void select(const EarthquakeDatabase &db, QuakeSelection &selection) const;
+    // Re-evaluates the rows from firstRow on, e.g. after
+    // EarthquakeDatabase::insertRows returned firstRow
+    void update(const EarthquakeDatabase &db, int firstRow, QuakeSelection &selection) const;
+    // Evaluates one row by walking the program, for checking select()
+    bool matches(const EarthquakeDatabase &db, int row) const;
+protected:
+    struct Instruction {
+        enum Op { Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual, Between, And, Or, Not };
+        Op op;
+        QuakeField field;
+        float lo, hi;
+    };
+    std::string expression, error;
+    // Postfix: comparisons push a result, And/Or pop two and push one,
+    // Not replaces the top
+    std::vector<Instruction> program;
+    // Most results on the stack at once
+    int maxDepth;
+    // Rows evaluated together; a multiple of 64 so blocks fill whole words
+    static const int blockRows = 1024;
+
+    // Recursive descent parser over expression from pos, appending to
+    // program and tracking the stack depth
+    size_t pos;
+    int depth;
+    bool parseOr();
+    bool parseAnd();
+    bool parseUnary();
+    bool parseComparison();
+    bool parseNumber(float &value);
+    void skipSpace();
+    // Consumes token if it comes next
+    bool accept(const char *token);
+    bool fail(const std::string &message);
+    void emit(Instruction::Op op, QuakeField field = FieldMagnitude, float lo = 0, float hi = 0);
+
+    static const float *column(const EarthquakeDatabase &db, QuakeField field);
+    // Runs the program over n rows from row first into result
+    void evaluateBlock(const EarthquakeDatabase &db, int first, int n,
+                       uint8_t *stack, uint8_t *&result) const;
+};
+
+// Sets bit i of the n / 64 words at out from byte i of flags (0 or 1)
+void packBits(const uint8_t *flags, int n, uint64_t *out);
+
+// Definitions below
+
+inline int QuakeSelection::count() const {
+    int n = 0;
+    for (size_t w = 0; w < words.size(); w++)
+        n += std::bitset<64>(words[w]).count();
+    return n;
+}
+
+inline void QuakeSelection::resize(int rows) {
+    nRows = rows;
+    words.resize((rows + 63) / 64, 0);
+    // Clear the bits past the last row, which count() would see
+    if (rows % 64 != 0)
+        words.back() &= ((uint64_t)1 << (rows % 64)) - 1;
+}
+
+inline void packBits(const uint8_t *flags, int n, uint64_t *out) {
+    for (int w = 0; w < n / 64; w++) {
+        const uint8_t *f = flags + w * 64;
+        uint64_t bits = 0;
+#ifdef FILTER_SSE2
+        // Move each byte's low bit to its sign bit and gather 16 at a time
+        for (int k = 0; k < 4; k++) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(f + k * 16));
+            bits |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_slli_epi16(v, 7)) << (k * 16);
+        }
+#else
+        for (int i = 0; i < 64; i++)
+            bits |= (uint64_t)f[i] << i;
+#endif
+        out[w] = bits;
+    }
+}
+
+inline bool QuakeFilter::compile(const std::string &text) {
+    expression = text;
+    error.clear();
+    program.clear();
+    maxDepth = 0;
+    pos = 0;
+    depth = 0;
+    skipSpace();
+    if (pos == expression.size())
+        return true;
+    if (!parseOr())
+        return false;
+    if (pos != expression.size())
+        return fail("expected && or || here");
+    return true;
+}
+
+inline bool QuakeFilter::compileFile(const std::string &filename) {
+    std::ifstream file(filename);
+    if (!file) {
+        error = "Failed to open filter file " + filename;
+        return false;
+    }
+    std::string line, text;
+    while (std::getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        size_t first = line.find_first_not_of(" \t\r"), last = line.find_last_not_of(" \t\r");
+        if (first == std::string::npos)
+            continue;
+        if (!text.empty())
+            text += ' ';
+        text += line.substr(first, last - first + 1);
+    }
+    return compile(text);
+}
+
+inline bool QuakeFilter::fail(const std::string &message) {
+    error = "Filter column " + std::to_string(pos + 1) + ": " + message;
+    program.clear();
+    maxDepth = 0;
+    return false;
+}
+
+inline void QuakeFilter::skipSpace() {
+    while (pos < expression.size()) {
+        char c = expression[pos];
+        if (c == '#') {
+            while (pos < expression.size() && expression[pos] != '\n')
+                pos++;
+        } else if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            pos++;
+        } else {
+            break;
+        }
+    }
+}
+
+inline bool QuakeFilter::accept(const char *token) {
+    size_t n = strlen(token);
+    if (expression.compare(pos, n, token) != 0)
+        return false;
+    // A word must not run on into a longer one
+    if (isalpha((unsigned char)token[0]) && pos + n < expression.size() && isalnum((unsigned char)expression[pos + n]))
+        return false;
+    pos += n;
+    skipSpace();
+    return true;
+}
+
+inline void QuakeFilter::emit(Instruction::Op op, QuakeField field, float lo, float hi) {
+    Instruction in;
+    in.op = op;
+    in.field = field;
+    in.lo = lo;
+    in.hi = hi;
+    program.push_back(in);
+    if (op == Instruction::And || op == Instruction::Or)
+        depth--;
+    else if (op != Instruction::Not)
+        maxDepth = std::max(maxDepth, ++depth);
+}
+
+inline bool QuakeFilter::parseOr() {
+    if (!parseAnd())
+        return false;
+    while (accept("||")) {
+        if (!parseAnd())
+            return false;
+        emit(Instruction::Or);
+    }
+    return true;
+}
+
+inline bool QuakeFilter::parseAnd() {
+    if (!parseUnary())
+        return false;
+    while (accept("&&")) {
+        if (!parseUnary())
+            return false;
+        emit(Instruction::And);
+    }
+    return true;
+}
+
+inline bool QuakeFilter::parseUnary() {
+    // "!=" never starts a term, so '!' here is always a negation
+    if (accept("!")) {
+        if (!parseUnary())
+            return false;
+        emit(Instruction::Not);
+        return true;
+    }
+    if (accept("(")) {
+        if (!parseOr())
+            return false;
+        return accept(")") || fail("expected )");
+    }
+    return parseComparison();
+}
+
+inline bool QuakeFilter::parseNumber(float &value) {
+    const char *begin = expression.c_str() + pos;
+    char *end;
+    double d = strtod(begin, &end);
+    if (end == begin)
+        return fail("expected a number");
+    value = (float)d;
+    pos += end - begin;
+    skipSpace();
+    return true;
+}
+
+inline bool QuakeFilter::parseComparison() {
+    int field = 0;
+    while (field < nQuakeFields && !accept(quakeFieldNames[field]))
+        field++;
+    if (field == nQuakeFields)
+        return fail("expected mag, depth, lat or lon");
+    QuakeField f = (QuakeField)field;
+    float lo = 0, hi = 0;
+    if (accept("in")) {
+        if (!accept("["))
+            return fail("expected [");
+        if (!parseNumber(lo))
+            return false;
+        if (!accept(","))
+            return fail("expected ,");
+        if (!parseNumber(hi))
+            return false;
+        if (!accept("]"))
+            return fail("expected ]");
+        emit(Instruction::Between, f, lo, hi);
+        return true;
+    }
+    // Two-character operators first, so "<=" is not read as "<"
+    static const char *const names[6] = {"<=", ">=", "==", "!=", "<", ">"};
+    static const Instruction::Op ops[6] = {Instruction::LessEqual, Instruction::GreaterEqual,
+        Instruction::Equal, Instruction::NotEqual, Instruction::Less, Instruction::Greater};
+    for (int i = 0; i < 6; i++) {
+        if (accept(names[i])) {
+            if (!parseNumber(lo))
+                return false;
+            emit(ops[i], f, lo);
+            return true;
+        }
+    }
+    return fail("expected a comparison or in [lo, hi]");
+}
+
+inline const float *QuakeFilter::column(const EarthquakeDatabase &db, QuakeField field) {
+    const QuakeColumns &rows = db.getColumns();
+    switch (field) {
+    case FieldDepth:
+        return rows.depths.data();
+    case FieldLatitude:
+        return rows.latitudes.data();
+    case FieldLongitude:
+        return rows.longitudes.data();
+    default:
+        return rows.magnitudes.data();
+    }
+}
+
+inline void QuakeFilter::evaluateBlock(const EarthquakeDatabase &db, int first, int n,
+                                       uint8_t *stack, uint8_t *&result) const {
+    // Entry k of the stack is blockRows bytes at stack + k * blockRows
+    int k = -1;
+    uint8_t *top = stack;
+    for (size_t p = 0; p < program.size(); p++) {
+        const Instruction &in = program[p];
+        if (in.op == Instruction::And || in.op == Instruction::Or) {
+            const uint8_t *b = top;
+            top = stack + --k * blockRows;
+            if (in.op == Instruction::And) {
+                for (int i = 0; i < n; i++)
+                    top[i] &= b[i];
+            } else {
+                for (int i = 0; i < n; i++)
+                    top[i] |= b[i];
+            }
+            continue;
+        }
+        if (in.op == Instruction::Not) {
+            for (int i = 0; i < n; i++)
+                top[i] ^= 1;
+            continue;
+        }
+        top = stack + ++k * blockRows;
+        const float *x = column(db, in.field) + first;
+        float lo = in.lo, hi = in.hi;
+        // One loop per operator, so each is a single vectorizable compare
+        switch (in.op) {
+        case Instruction::Less:
+            for (int i = 0; i < n; i++)
+                top[i] = x[i] < lo;
+            break;
+        case Instruction::LessEqual:
+            for (int i = 0; i < n; i++)
+                top[i] = x[i] <= lo;
+            break;
+        case Instruction::Greater:
+            for (int i = 0; i < n; i++)
+                top[i] = x[i] > lo;
+            break;
+        case Instruction::GreaterEqual:
+            for (int i = 0; i < n; i++)
+                top[i] = x[i] >= lo;
+            break;
+        case Instruction::Equal:
+            for (int i = 0; i < n; i++)
+                top[i] = x[i] == lo;
+            break;
+        case Instruction::NotEqual:
+            for (int i = 0; i < n; i++)
+                top[i] = x[i] != lo;
+            break;
+        default:
+            for (int i = 0; i < n; i++)
+                top[i] = (x[i] >= lo) & (x[i] <= hi);
+            break;
+        }
+    }
+    result = top;
+}
+
+inline void QuakeFilter::select(const EarthquakeDatabase &db, QuakeSelection &selection) const {
+    update(db, 0, selection);
+}
+
+inline void QuakeFilter::update(const EarthquakeDatabase &db, int firstRow, QuakeSelection &selection) const {
+    int nRows = db.getMaxIndex() + 1;
+    selection.resize(nRows);
+    // Start at a word boundary, so blocks write whole words
+    int first = std::max(firstRow, 0) & ~63;
+    uint64_t *words = selection.getWords();
+    if (program.empty()) {
+        for (int w = first / 64; w < (nRows + 63) / 64; w++)
+            words[w] = ~(uint64_t)0;
+        selection.resize(nRows);
+        return;
+    }
+    std::vector<uint8_t> stack(std::max(maxDepth, 1) * blockRows);
+    for (int row = first; row < nRows; row += blockRows) {
+        int n = std::min(blockRows, nRows - row);
+        uint8_t *result;
+        evaluateBlock(db, row, n, &stack[0], result);
+        // Rows past the end pack as unselected
+        std::fill(result + n, result + (n + 63) / 64 * 64, 0);
+        packBits(result, (n + 63) / 64 * 64, words + row / 64);
+    }
+}
+
+inline bool QuakeFilter::matches(const EarthquakeDatabase &db, int row) const {
+    if (program.empty())
+        return true;
+    std::vector<bool> stack;
+    for (size_t p = 0; p < program.size(); p++) {
+        const Instruction &in = program[p];
+        if (in.op == Instruction::And || in.op == Instruction::Or) {
+            bool b = stack.back();
+            stack.pop_back();
+            stack.back() = in.op == Instruction::And ? stack.back() && b : stack.back() || b;
+            continue;
+        }
+        if (in.op == Instruction::Not) {
+            stack.back() = !stack.back();
+            continue;
+        }
+        float x = column(db, in.field)[row];
+        bool r;
+        switch (in.op) {
+        case Instruction::Less: r = x < in.lo; break;
+        case Instruction::LessEqual: r = x <= in.lo; break;
+        case Instruction::Greater: r = x > in.lo; break;
+        case Instruction::GreaterEqual: r = x >= in.lo; break;
+        case Instruction::Equal: r = x == in.lo; break;
+        case Instruction::NotEqual: r = x != in.lo; break;
+        default: r = x >= in.lo && x <= in.hi; break;
+        }
+        stack.push_back(r);
+    }
+    return stack.back();
+}
+
+#endif
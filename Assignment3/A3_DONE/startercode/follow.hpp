@@ -0,0 +1,172 @@
+#ifndef FOLLOW_HPP
+#define FOLLOW_HPP
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+#include "mappedfile.hpp"
+#include "quake.hpp"
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// Watches a catalog file that is being appended to, like tail -f, and
+// parses the new rows on a background thread. The parsed batches are
+// handed to the render thread through a single-producer single-consumer
+// ring: the worker fills a slot and then publishes it by advancing an
+// atomic counter, so the render thread never waits on a lock and only
+// sees complete batches. Uses inotify on Linux to notice writes
+// promptly, and polls the file size everywhere (also as a fallback when
+// inotify is unavailable or the file is replaced).
+class CatalogFollower {
+public:
+    CatalogFollower(): head(0), tail(0), running(false), offset(0), pollMilliseconds(500) {}
+    ~CatalogFollower() { stop(); }
+    // Starts following bytes appended to filename after offset
+    // (normally EarthquakeDatabase::getSourceBytes())
+    void start(std::string filename, long long offset, int pollMilliseconds = 500);
+    void stop();
+    bool isRunning() const { return running; }
+    // Render thread: appends every batch published since the last call
+    // to out, and returns the number of rows taken
+    int take(QuakeColumns &out);
+protected:
+    CatalogFollower(const CatalogFollower&) = delete;
+    CatalogFollower& operator=(const CatalogFollower&) = delete;
+
+    static const unsigned queueSize = 16;
+    QuakeColumns slots[queueSize];
+    // Batches head..tail-1 are published; only the worker writes tail
+    // and only the render thread writes head
+    std::atomic<unsigned> head, tail;
+    std::atomic<bool> running;
+    std::thread worker;
+
+    // Worker state
+    std::string filename;
+    long long offset;
+    int pollMilliseconds;
+    // Trailing bytes of an unfinished last line
+    std::string partial;
+    // Rows parsed while the ring was full
+    QuakeColumns pending;
+
+    void run();
+    // Parses whatever was appended since the last read into pending
+    void readAppended();
+    // Moves pending into the ring if there is room
+    void publish();
+};
+
+// Definitions below
+
+inline void CatalogFollower::start(std::string file, long long from, int pollMs) {
+    stop();
+    filename = file;
+    offset = from;
+    pollMilliseconds = pollMs;
+    partial.clear();
+    pending.clear();
+    running = true;
+    worker = std::thread(&CatalogFollower::run, this);
+}
+
+inline void CatalogFollower::stop() {
+    running = false;
+    if (worker.joinable())
+        worker.join();
+}
+
+inline int CatalogFollower::take(QuakeColumns &out) {
+    unsigned h = head.load(std::memory_order_relaxed);
+    unsigned t = tail.load(std::memory_order_acquire);
+    int count = 0;
+    for (; h != t; h++) {
+        QuakeColumns &batch = slots[h % queueSize];
+        out.append(batch);
+        count += batch.size();
+        batch.clear();
+    }
+    // Hands the slots back to the worker
+    head.store(h, std::memory_order_release);
+    return count;
+}
+
+inline void CatalogFollower::publish() {
+    if (pending.size() == 0)
+        return;
+    unsigned t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == queueSize)
+        return;
+    std::swap(slots[t % queueSize], pending);
+    pending.clear();
+    tail.store(t + 1, std::memory_order_release);
+}
+
+inline void CatalogFollower::readAppended() {
+    long long size, modified;
+    if (!getFileStamp(filename, size, modified))
+        return;
+    if (size < offset) {
+        // Truncated or replaced: rows already shown stay, follow from here
+        offset = size;
+        partial.clear();
+        return;
+    }
+    if (size == offset)
+        return;
+    std::ifstream file(filename, std::ios::in | std::ios::binary);
+    if (!file)
+        return;
+    file.seekg(offset);
+    std::string text = partial;
+    size_t start = text.size();
+    text.resize(start + (size_t)(size - offset));
+    file.read(&text[start], size - offset);
+    text.resize(start + (size_t)file.gcount());
+    offset += file.gcount();
+    // Only parse complete lines; keep the rest for the next read
+    size_t lastNewline = text.rfind('\n');
+    if (lastNewline == std::string::npos) {
+        partial = text;
+        return;
+    }
+    pending.appendRows(text.data(), lastNewline + 1);
+    partial = text.substr(lastNewline + 1);
+}
+
+inline void CatalogFollower::run() {
+#ifdef __linux__
+    int fd = inotify_init1(IN_NONBLOCK);
+    if (fd >= 0 && inotify_add_watch(fd, filename.c_str(), IN_MODIFY | IN_CLOSE_WRITE) < 0) {
+        ::close(fd);
+        fd = -1;
+    }
+#endif
+    while (running) {
+        readAppended();
+        publish();
+#ifdef __linux__
+        if (fd >= 0) {
+            // Wake on the next write, or after the poll interval anyway
+            struct pollfd p = {fd, POLLIN, 0};
+            if (poll(&p, 1, pollMilliseconds) > 0) {
+                char events[4096];
+                while (::read(fd, events, sizeof(events)) > 0) {}
+            }
+            continue;
+        }
+#endif
+        std::this_thread::sleep_for(std::chrono::milliseconds(pollMilliseconds));
+    }
+#ifdef __linux__
+    if (fd >= 0)
+        ::close(fd);
+#endif
+}
+
+#endif
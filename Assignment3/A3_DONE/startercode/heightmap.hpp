@@ -0,0 +1,85 @@
+#ifndef HEIGHTMAP_HPP
+#define HEIGHTMAP_HPP
+
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <string>
+#include <vector>
+#include "graphics.hpp"
+
+// Grayscale elevation image covering the globe in the same
+// equirectangular layout as the Earth texture, with heights in [0, 1]
+class HeightMap {
+public:
+    HeightMap(): width(0), height(0) {}
+    // Loads a BMP; returns false if it could not be read
+    bool load(std::string bmpFile);
+    // Uses the given row-major values (top row first)
+    void assign(int width, int height, const std::vector<float> &values);
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    // Bilinearly filtered height at a latitude and longitude in degrees;
+    // wraps around in longitude and clamps at the poles
+    float sample(float latitude, float longitude) const;
+protected:
+    int width, height;
+    std::vector<float> values;
+    float at(int x, int y) const;
+};
+
+// Definitions below
+
+inline bool HeightMap::load(std::string bmpFile) {
+    SDL_Surface *surface = SDL_LoadBMP(bmpFile.c_str());
+    if (surface == NULL)
+        return false;
+    // Whatever the file's pixel format, read it back as 32-bit pixels
+    SDL_Surface *rgba = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888, 0);
+    SDL_FreeSurface(surface);
+    if (rgba == NULL)
+        return false;
+    SDL_LockSurface(rgba);
+    width = rgba->w;
+    height = rgba->h;
+    values.resize(width * height);
+    for (int y = 0; y < height; y++) {
+        const Uint32 *row = (const Uint32*)((const char*)rgba->pixels + y * rgba->pitch);
+        for (int x = 0; x < width; x++) {
+            // Gray image, so any channel will do; average them anyway
+            Uint32 p = row[x];
+            values[y * width + x] = (((p >> 16) & 0xFF) + ((p >> 8) & 0xFF) + (p & 0xFF)) / (3 * 255.0f);
+        }
+    }
+    SDL_UnlockSurface(rgba);
+    SDL_FreeSurface(rgba);
+    return true;
+}
+
+inline void HeightMap::assign(int w, int h, const std::vector<float> &v) {
+    width = w;
+    height = h;
+    values = v;
+}
+
+inline float HeightMap::at(int x, int y) const {
+    x %= width;
+    if (x < 0)
+        x += width;
+    y = y < 0 ? 0 : (y >= height ? height - 1 : y);
+    return values[y * width + x];
+}
+
+inline float HeightMap::sample(float latitude, float longitude) const {
+    if (width == 0)
+        return 0;
+    // Same mapping as Earth::getTCoord, in texels with centres at +0.5
+    float u = (longitude / 360 + 0.5f) * width - 0.5f;
+    float v = (-latitude / 180 + 0.5f) * height - 0.5f;
+    int x = (int)floor(u), y = (int)floor(v);
+    float fx = u - x, fy = v - y;
+    float top = at(x, y) * (1 - fx) + at(x + 1, y) * fx;
+    float bottom = at(x, y + 1) * (1 - fx) + at(x + 1, y + 1) * fx;
+    return top * (1 - fy) + bottom * fy;
+}
+
+#endif
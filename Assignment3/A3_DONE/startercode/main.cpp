@@ -1,13 +1,23 @@
 #include "engine.hpp"
 #include "camera.hpp"
+#include "clusters.hpp"
 #include "config.hpp"
+#include "density.hpp"
 #include "draw.hpp"
 #include "earth.hpp"
+#include "filter.hpp"
+#include "follow.hpp"
+#include "markers.hpp"
+#include "offscreen.hpp"
+#include "picking.hpp"
 #include "quake.hpp"
+#include "quakebuffer.hpp"
+#include "quakestats.hpp"
+#include "terrain.hpp"
 #include "text.hpp"
+#include "bench.hpp"
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
-#include <iomanip>
 #include "util.h"
 using namespace std;
 using glm::vec3;
@@ -15,6 +25,8 @@ using glm::vec4;
 
 const int slices = 12;
 const int stacks = 6;
+// Spacing of overlay text lines in normalized device coordinates
+const float lineHeight = 2 * 16 / 720.0f;
 
 class QuakeVis: public Engine {
 public:
@@ -23,31 +35,104 @@ public:
     OrbitCamera camera;
 
     Earth earth;
+    // Shape the Earth is morphing towards: 0 rectangle, 1 sphere
+    float targetSpherical;
     bool visualizeMesh;
+    // Height-mapped globe, drawn instead of the plain sphere when enabled
+    Terrain terrain;
+    bool terrainLoaded, showTerrain;
     EarthquakeDatabase qdb;
+    TimeWindowCursor quakeWindow;
+    QuakeClusters clusters;
+    bool clustering;
+    // Picks the quake under the mouse; hovered is its row, or -1
+    QuakeSpatialIndex quakeIndex;
+    QuakePicker picker;
+    int hovered;
+    // Heatmap of the quakes in the window, overlaid on the Earth
+    DensityMap density;
+    bool showDensity;
+    // Totals over time buckets for the statistics panel
+    QuakeStatistics statistics;
+    bool showStatistics;
+    // Parses rows appended to the catalog while running
+    CatalogFollower follower;
+    // Rows kept by the --filter expression, and whether only they are shown
+    QuakeFilter filter;
+    QuakeSelection selection;
+    bool filtering;
+    std::string filterLabel;
 
-    float currentTime;
+    double currentTime;
     bool playing;
     float playSpeed;
 
     Text text;
+    MarkerRenderer markers;
+    QuakeBuffer quakes;
+    // Set when frames go to image files rather than the window
+    bool headless;
+    OffscreenTarget offscreen;
 
-    QuakeVis() {
-        window = createWindow("Earthquake Visualization", 1280, 720);
+    QuakeVis(bool follow = false, const QuakeFilter &quakeFilter = QuakeFilter(), bool renderOffscreen = false) {
+        headless = renderOffscreen;
+        window = createWindow("Earthquake Visualization", 1280, 720, !headless);
         camera = OrbitCamera(5, 0, 0, Perspective(40, 16/9., 0.1, 10));
         float isSpherical = 1;
-		float targetSph = 1; //for interpolating
+		targetSpherical = isSpherical; //for interpolating
         earth.initialize(this, slices, stacks, isSpherical);
         visualizeMesh = false;
-        qdb = EarthquakeDatabase(Config::quakeFile);
+        terrainLoaded = terrain.initialize(this, earth.getTexture(), Config::heightFiles);
+        showTerrain = false;
+        // Reuses the binary cache next to the catalog when it is up to date
+        qdb.loadCached(Config::quakeFile);
 		if (!qdb.fileFound){
 			errorMessage(("Failed to open earthquake file " + Config::quakeFile).c_str());
 			exit(EXIT_FAILURE);
 		}
         playSpeed = 30*24*3600;
-        currentTime = qdb.getByIndex(qdb.getMinIndex()).getDate().asSeconds();
+        currentTime = qdb.getSeconds(qdb.getMinIndex());
+        quakeWindow.reset(&qdb, Config::timeWindow);
+        quakeWindow.moveTo(currentTime);
+        clusters.reset(&qdb);
+        clustering = false;
+        quakeIndex.build(&qdb);
+        picker.reset(&qdb, &quakeIndex);
+        hovered = -1;
+        density.initialize(&qdb, Config::densityWidth, Config::densityHeight, Config::densityRadius);
+        showDensity = false;
+        statistics.build(&qdb);
+        showStatistics = true;
         playing = true;
         text.initialize();
+        markers.initialize(this);
+        // Keep the whole catalog on the GPU when instancing is available
+        if (instancingSupported())
+            quakes.initialize(this, &qdb, earth);
+        if (follow)
+            follower.start(Config::quakeFile, qdb.getSourceBytes(), Config::followMilliseconds);
+        filter = quakeFilter;
+        filter.select(qdb, selection);
+        filterLabel = "Filter: " + filter.getExpression();
+        filtering = false;
+        if (!filter.isEmpty())
+            setFiltering(true);
+    }
+
+    // Shows only the selected rows, or all of them
+    void setFiltering(bool on) {
+        filtering = on;
+        const QuakeSelection *s = filtering ? &selection : NULL;
+        picker.setSelection(s);
+        statistics.setSelection(s);
+        if (instancingSupported())
+            quakes.setSelection(s);
+        clusters.setSelection(s);
+        if (clustering)
+            clusters.rebuild(quakeWindow);
+        density.setSelection(s);
+        if (showDensity)
+            density.rebuild(quakeWindow);
     }
 
     ~QuakeVis() {
@@ -60,23 +145,90 @@ public:
             handleInput();
             advanceState(dt);
             drawGraphics();
+            SDL_GL_SwapWindow(window);
             waitForNextFrame(dt);
         }
     }
 
+    // Steps a fixed clock at 60 frames per second of animation, without
+    // waiting between frames, and saves each frame drawn offscreen as
+    // directory/frame00000.ppm and so on; false if any could not be saved
+    bool render(std::string directory, int frames) {
+        if (!offscreen.initialize(1280, 720)) {
+            std::cout << "Offscreen rendering needs framebuffer objects" << std::endl;
+            return false;
+        }
+        float fps = 60, dt = 1/fps;
+        char name[32];
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int f = 0; f < frames; f++) {
+            advanceState(dt);
+            offscreen.bind();
+            drawGraphics();
+            snprintf(name, sizeof(name), "/frame%05d.ppm", f);
+            offscreen.capture(directory + name);
+        }
+        bool ok = offscreen.finish();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("%d frames of 1280x720 in %.2f s: %.1f frames per second\n", frames, seconds, frames / seconds);
+        if (!ok)
+            std::cout << "Failed to write some frames to " << directory << std::endl;
+        return ok;
+    }
+
     void advanceState(float dt) {
+        // Add the rows the follower parsed since the last frame
+        QuakeColumns appended;
+        if (follower.take(appended) > 0) {
+            int first = qdb.insertRows(appended);
+            filter.update(qdb, first, selection);
+            if (instancingSupported())
+                quakes.update(earth, first);
+            statistics.update(first);
+            quakeIndex.update(first);
+            // Rows from first on may have moved, so start the window afresh
+            quakeWindow.reset(&qdb, Config::timeWindow);
+            quakeWindow.moveTo(currentTime);
+            if (clustering)
+                clusters.rebuild(quakeWindow);
+            if (showDensity)
+                density.rebuild(quakeWindow);
+        }
         if (playing) {
             currentTime += playSpeed * dt;
-            float minTime = qdb.getByIndex(qdb.getMinIndex()).getDate().asSeconds(),
-                  maxTime = qdb.getByIndex(qdb.getMaxIndex()).getDate().asSeconds();
+            double minTime = qdb.getSeconds(qdb.getMinIndex()),
+                   maxTime = qdb.getSeconds(qdb.getMaxIndex());
             if (currentTime > maxTime)
                 currentTime = minTime;
             if (currentTime < minTime)
                 currentTime = maxTime;
+            // Only walks the quakes that entered or left the window
+            quakeWindow.moveTo(currentTime);
+            if (clustering)
+                clusters.update(quakeWindow);
+            if (showDensity)
+                density.update(quakeWindow);
+        }
+        if (clustering) {
+            // Rebuilds only when zooming crosses to another cell size
+            float degrees = QuakeClusters::cellDegreesFor(camera.getDistance(), 40, 720, Config::clusterPixels);
+            clusters.setCellDegrees(degrees, quakeWindow);
         }
 
-        // TODO: Adjust the Earth's isSpherical value if necessary.
+        // There is no mouse to hover with offscreen
+        hovered = headless ? -1 : picker.pick(camera, earth, quakeWindow, mouseX(), mouseY(), 1280, 720, Config::pickPixels);
 
+        // TODO: Adjust the Earth's isSpherical value if necessary.
+        // Morph over one second; the shaders blend every frame, so
+        // this only changes a uniform
+        float s = earth.isSpherical();
+        if (s != targetSpherical) {
+            if (s < targetSpherical)
+                s = std::min(s + dt, targetSpherical);
+            else
+                s = std::max(s - dt, targetSpherical);
+            earth.setSpherical(s);
+        }
     }
 
     void addLight(GLenum light, vec4 position, vec3 color) {
@@ -99,6 +251,11 @@ public:
         addLight(GL_LIGHT0, vec4(0,0,0,1), vec3(0.8,0.8,0.8));
         // Apply camera transformation
         camera.apply();
+        // Only the rows the window changed since last frame are uploaded
+        if (showDensity)
+            density.upload();
+        earth.setOverlay(showDensity ? density.getTexture() : 0);
+        terrain.setOverlay(showDensity ? density.getTexture() : 0);
         // Draw earth
         if (visualizeMesh) {
             glColor3f(1,1,1);
@@ -111,54 +268,159 @@ public:
 			glEnable(GL_POLYGON_OFFSET_FILL);
 			glPolygonOffset(1, 1);
             glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        } else if (showTerrain && earth.isSpherical() == 1) {
+            glColor3f(1,1,1);
+            terrain.draw(camera.getEye(), 40, 720);
         } else {
             glColor3f(1,1,1);
             earth.draw(true);
         }
         // Draw quakes
-        int start = qdb.getIndexByDate(Date(currentTime - Config::timeWindow));
-        int end = qdb.getIndexByDate(Date(currentTime));
+        int start = quakeWindow.getStart();
+        int end = quakeWindow.getEnd();
 		float mag = 1, a = 0, r = 0;
 		float diff = qdb.getMaxMag() - qdb.getMinMag();
 		vec3 qPos;
 
 		glEnable(GL_BLEND);
 		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-        for (int i = start; i <= end; i++) {
-            Earthquake e = qdb.getByIndex(i);
-
-            // TODO: Draw an earthquake
-			qPos = earth.getPosition(e.getLatitude(), e.getLongitude());
-			mag = e.getMagnitude();
-
-			//determine alpha by lerp-ing between 0-0.2
-			a = Util::lerp(0, 0.7, (mag / diff));
-			glColor4f(1, 0, 0, a);
-			
-			//determine radius by lerp-ing between 0-0.06
-			r = Util::lerp(0, 0.04, (mag / diff));
-			Draw::sphere(qPos, r);
+        if (clustering) {
+            // One marker per cell, sized by the cell's total energy
+            markers.clear();
+            for (QuakeClusters::const_iterator c = clusters.begin(); c != clusters.end(); ++c) {
+                float lat, lon;
+                QuakeClusters::getLocation(c->second, lat, lon);
+                mag = QuakeClusters::getMagnitude(c->second);
+                a = Util::lerp(0, 0.7, (mag / diff));
+                r = Util::lerp(0, 0.04, (mag / diff));
+                markers.add(earth.getPosition(lat, lon), r, vec4(1, 0.5, 0, a));
+            }
+            markers.draw(vec3(0.8, 0.8, 0.8));
+        } else if (instancingSupported()) {
+            // Selection, sizing and fading happen in the shader
+            quakes.draw(start, end, currentTime, earth.isSpherical(), vec3(0.8, 0.8, 0.8));
+        } else {
+            markers.clear();
+            for (int i = start; i <= end; i++) {
+                if (filtering && !selection.contains(i))
+                    continue;
+                // TODO: Draw an earthquake
+                qPos = earth.getPosition(qdb.getLatitude(i), qdb.getLongitude(i));
+                mag = qdb.getMagnitude(i);
+
+                //determine alpha by lerp-ing between 0-0.2
+                a = Util::lerp(0, 0.7, (mag / diff));
+
+                //determine radius by lerp-ing between 0-0.06
+                r = Util::lerp(0, 0.04, (mag / diff));
+                markers.add(qPos, r, vec4(1, 0, 0, a));
+            }
+            markers.draw(vec3(0.8, 0.8, 0.8));
         }
 
         // Draw current date
         Date d(currentTime);
-        stringstream s;
-        s << std::right << std::setfill('0')
-          << "Current date: " << std::setw(2) << d.getMonth()
-          << "/" << std::setw(2) << d.getDay()
-          << "/" << d.getYear()
-          << "  " << std::setw(2) << d.getHour()
-          << ":" << std::setw(2) << d.getMinute();
+        char label[64];
+        char *labelEnd = TextFormat::append(label, "Current date: ");
+        labelEnd = TextFormat::appendDate(labelEnd, d.getMonth(), d.getDay(), d.getYear(),
+                                          d.getHour(), d.getMinute());
+        text.add(label, labelEnd - label, -0.9, 0.9);
+        float y = 0.9 - lineHeight;
+        if (filtering) {
+            text.add(filterLabel, -0.9, y);
+            y -= lineHeight;
+        }
+        if (showStatistics)
+            drawStatistics(-0.9, y);
+        if (hovered >= 0)
+            drawHoverLabel();
+        text.flush();
+    }
+
+    // Count, energy and magnitude histogram of the quakes in the window,
+    // listed downwards from (x, y); queued on text for the caller to flush
+    void drawStatistics(float x, float y) {
+        QuakeSummary s = statistics.summarize(quakeWindow.getStart(), quakeWindow.getEnd() + 1);
+        char label[64];
+        char *labelEnd = TextFormat::append(label, "Quakes in window: ");
+        labelEnd = TextFormat::appendInt(labelEnd, s.count);
+        text.add(label, labelEnd - label, x, y);
+        labelEnd = TextFormat::append(label, "Energy released: ");
+        labelEnd = TextFormat::appendScientific(labelEnd, s.energy, 1);
+        labelEnd = TextFormat::append(labelEnd, " J");
+        text.add(label, labelEnd - label, x, y -= lineHeight);
+        labelEnd = TextFormat::append(label, "Largest magnitude: ");
+        if (s.count > 0)
+            labelEnd = TextFormat::appendFixed(labelEnd, s.maxMagnitude, 1);
+        text.add(label, labelEnd - label, x, y -= lineHeight);
+
+        // One bar per magnitude bin, scaled to the fullest bin
+        int most = 1;
+        for (int b = 0; b < QuakeSummary::nBins; b++)
+            most = std::max(most, s.histogram[b]);
+        glMatrixMode(GL_PROJECTION);
+        glPushMatrix();
+        glLoadIdentity();
+        glMatrixMode(GL_MODELVIEW);
+        glPushMatrix();
+        glLoadIdentity();
+        glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT);
         glDisable(GL_LIGHTING);
-        glColor3f(1,1,1);
-        text.draw(s.str(), -0.9,0.9);
-        SDL_GL_SwapWindow(window);
+        glDisable(GL_DEPTH_TEST);
+        glBegin(GL_QUADS);
+        glColor4f(1, 0.5, 0, 0.8);
+        for (int b = 0; b < QuakeSummary::nBins; b++) {
+            float top = y - (b + 1) * lineHeight + 0.8 * lineHeight, bottom = top - 0.6 * lineHeight;
+            float left = x + 0.06, right = left + 0.3 * s.histogram[b] / most;
+            glVertex2f(left, bottom);
+            glVertex2f(right, bottom);
+            glVertex2f(right, top);
+            glVertex2f(left, top);
+        }
+        glEnd();
+        glPopAttrib();
+        glPopMatrix();
+        glMatrixMode(GL_PROJECTION);
+        glPopMatrix();
+        glMatrixMode(GL_MODELVIEW);
+        for (int b = 0; b < QuakeSummary::nBins; b++) {
+            y -= lineHeight;
+            labelEnd = TextFormat::append(label, "M");
+            labelEnd = TextFormat::appendInt(labelEnd, b);
+            if (b == QuakeSummary::nBins - 1)
+                labelEnd = TextFormat::append(labelEnd, "+");
+            text.add(label, labelEnd - label, x, y);
+            labelEnd = TextFormat::appendInt(label, s.histogram[b]);
+            text.add(label, labelEnd - label, x + 0.38, y);
+        }
+    }
+
+    // Date, magnitude and depth of the hovered quake next to the mouse
+    void drawHoverLabel() {
+        Date d(qdb.getSeconds(hovered));
+        char label[96];
+        char *labelEnd = TextFormat::appendDate(label, d.getMonth(), d.getDay(), d.getYear(),
+                                                d.getHour(), d.getMinute());
+        labelEnd = TextFormat::append(labelEnd, "  M");
+        labelEnd = TextFormat::appendFixed(labelEnd, qdb.getMagnitude(hovered), 1);
+        labelEnd = TextFormat::append(labelEnd, " ");
+        labelEnd = TextFormat::append(labelEnd, qdb.getMagnitudeType(hovered));
+        labelEnd = TextFormat::append(labelEnd, "  depth ");
+        labelEnd = TextFormat::appendFixed(labelEnd, qdb.getDepth(hovered), 0);
+        labelEnd = TextFormat::append(labelEnd, " km");
+        // Just below and to the right of the pointer
+        float x = 2 * (mouseX() + 12) / 1280.0f - 1, y = 1 - 2 * (mouseY() + 20) / 720.0f;
+        text.add(label, labelEnd - label, x, y, vec4(1, 1, 0.6, 1));
     }
 
     void onMouseMotion(SDL_MouseMotionEvent &e) {
         camera.onMouseMotion(e);
     }
 
+    void onMouseWheel(SDL_MouseWheelEvent &e) {
+        camera.onMouseWheel(e);
+    }
+
     void onKeyDown(SDL_KeyboardEvent &e) {
         if (e.keysym.scancode == SDL_SCANCODE_LEFT)
             playSpeed /= 1.4;
@@ -168,20 +430,87 @@ public:
             playing = !playing;
         if (e.keysym.scancode == SDL_SCANCODE_M)
             visualizeMesh = !visualizeMesh;
+        if (e.keysym.scancode == SDL_SCANCODE_T)
+            showTerrain = terrainLoaded && !showTerrain;
+        if (e.keysym.scancode == SDL_SCANCODE_H) {
+            showDensity = !showDensity;
+            // Like the clusters, the grid missed the updates while hidden
+            if (showDensity)
+                density.rebuild(quakeWindow);
+        }
+        if (e.keysym.scancode == SDL_SCANCODE_P)
+            showStatistics = !showStatistics;
+        if (e.keysym.scancode == SDL_SCANCODE_F && !filter.isEmpty())
+            setFiltering(!filtering);
+        if (e.keysym.scancode == SDL_SCANCODE_C) {
+            clustering = !clustering;
+            // The cells missed every update while clustering was off
+            if (clustering)
+                clusters.rebuild(quakeWindow);
+        }
 
         // TODO: Switch between rectangle and sphere on pressing S
 		if (e.keysym.scancode == SDL_SCANCODE_S)
-			if (earth.isSpherical() == 1) {
-				earth.setSpherical(0);
-			}
-			else {
-				earth.setSpherical(1);
-			}
+			targetSpherical = 1 - targetSpherical;
     }
 };
 
 int main(int argc, char **argv) {
-    QuakeVis app;
+    // Benchmark modes run without opening a window
+    std::string mode = argc > 1 ? argv[1] : "";
+    if (mode == "--bench-load")
+        return Bench::load(argc > 2 ? argv[2] : Config::quakeFile);
+    if (mode == "--bench-ingest")
+        return Bench::ingest(argc > 2 ? argv[2] : Config::quakeFile, argc > 3 ? atoi(argv[3]) : 0);
+    if (mode == "--bench-cache")
+        return Bench::cache(argc > 2 ? argv[2] : Config::quakeFile);
+    if (mode == "--bench-region")
+        return Bench::region(argc > 2 ? argv[2] : Config::quakeFile);
+    if (mode == "--bench-stats")
+        return Bench::stats(argc > 2 ? argv[2] : Config::quakeFile);
+    if (mode == "--bench-density")
+        return Bench::density(argc > 2 ? argv[2] : Config::quakeFile);
+    if (mode == "--bench-pick")
+        return Bench::pick(argc > 2 ? argv[2] : Config::quakeFile);
+    if (mode == "--bench-filter")
+        return Bench::filter(argc > 2 ? argv[2] : Config::quakeFile, argc > 3 ? argv[3] : "");
+    if (mode == "--bench-compress")
+        return Bench::compress(argc > 2 ? argv[2] : Config::quakeFile);
+    if (mode == "--bench-markers")
+        return Bench::markers();
+    if (mode == "--make-catalog" && argc > 3)
+        return Bench::makeCatalog(Config::quakeFile, argv[2], atoll(argv[3]));
+    bool follow = false;
+    QuakeFilter filter;
+    std::string renderDirectory;
+    int renderFrames = 600;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--follow") {
+            follow = true;
+        } else if (arg == "--filter" && i + 1 < argc) {
+            if (!filter.compile(argv[++i])) {
+                Engine::errorMessage(filter.getError());
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--render" && i + 1 < argc) {
+            renderDirectory = argv[++i];
+        } else if (arg == "--frames" && i + 1 < argc) {
+            renderFrames = atoi(argv[++i]);
+        } else if (arg == "--filter-file" && i + 1 < argc) {
+            if (!filter.compileFile(argv[++i])) {
+                Engine::errorMessage(filter.getError());
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    if (!renderDirectory.empty()) {
+        // SDL's offscreen driver needs no display; an explicit choice wins
+        SDL_setenv("SDL_VIDEODRIVER", "offscreen", 0);
+        QuakeVis app(follow, filter, true);
+        return app.render(renderDirectory, renderFrames) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    QuakeVis app(follow, filter);
     app.run();
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,17 @@
+#version 120
+
+// Matches the fixed-function lighting used for the rest of the scene:
+// a diffuse light at the camera plus the default global ambient
+uniform float ambient;
+uniform vec3 lightColor;
+
+varying vec3 position;
+varying vec3 normal;
+varying vec4 markerColor;
+
+void main() {
+    vec3 n = normalize(normal);
+    vec3 l = normalize(-position);
+    vec3 shade = vec3(ambient) + lightColor * max(dot(n, l), 0.0);
+    gl_FragColor = vec4(markerColor.rgb * shade, markerColor.a);
+}
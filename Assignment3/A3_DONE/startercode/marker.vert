@@ -0,0 +1,19 @@
+#version 120
+
+// Vertex of the unit sphere mesh, which is also its normal
+attribute vec3 vertex;
+// Per-instance marker data: xyz is the centre, w the radius
+attribute vec4 center;
+attribute vec4 color;
+
+varying vec3 position;
+varying vec3 normal;
+varying vec4 markerColor;
+
+void main() {
+    vec4 world = vec4(center.xyz + center.w * vertex, 1);
+    position = (gl_ModelViewMatrix * world).xyz;
+    normal = gl_NormalMatrix * vertex;
+    markerColor = color;
+    gl_Position = gl_ModelViewProjectionMatrix * world;
+}
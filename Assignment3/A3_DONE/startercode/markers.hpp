@@ -0,0 +1,146 @@
+#ifndef MARKERS_HPP
+#define MARKERS_HPP
+
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include "config.hpp"
+#include "engine.hpp"
+#include "shader.hpp"
+#include <glm/glm.hpp>
+using glm::vec3;
+using glm::vec4;
+
+// Per-instance data streamed to the GPU for each marker
+struct MarkerInstance {
+    vec4 center; // xyz position, w radius
+    vec4 color;
+};
+
+// Unit sphere centred at the origin, uploaded once and shared by the
+// instanced marker shaders. Each vertex is also its own normal.
+struct SphereMesh {
+    VertexBuffer vertices;
+    ElementBuffer indices;
+    int nIndices;
+    SphereMesh(): vertices(0), indices(0), nIndices(0) {}
+    void initialize(Engine *engine, int slices, int stacks);
+};
+
+// Draws many small lit spheres (e.g. earthquakes) with one instanced draw
+// call. The sphere mesh is uploaded once; each frame only the list of
+// instances is streamed. On contexts without instancing the same mesh is
+// drawn once per marker instead, which still avoids re-tessellating.
+class MarkerRenderer {
+public:
+    MarkerRenderer(): engine(NULL), instanceCapacity(0) {}
+    void initialize(Engine *engine, int slices = 16, int stacks = 12);
+    // Removes all markers
+    void clear();
+    void add(vec3 position, float radius, vec4 color);
+    int size() const { return instances.size(); }
+    // Draws all markers added since clear() with lighting that matches a
+    // diffuse light of the given color at the camera
+    void draw(vec3 lightColor);
+protected:
+    Engine *engine;
+    ShaderProgram program;
+    SphereMesh sphere;
+    VertexBuffer instanceBuffer;
+    int instanceCapacity;
+    std::vector<MarkerInstance> instances;
+};
+
+// Definitions below
+
+inline void SphereMesh::initialize(Engine *engine, int slices, int stacks) {
+    // Unit sphere, bottom to top; each vertex is also its normal
+    std::vector<vec3> points;
+    for (int i = 0; i <= stacks; i++) {
+        float phi = M_PI * i / stacks - M_PI / 2;
+        for (int j = 0; j <= slices; j++) {
+            float theta = 2 * M_PI * j / slices;
+            points.push_back(vec3(cos(phi) * sin(theta), sin(phi), cos(phi) * cos(theta)));
+        }
+    }
+    std::vector<int> triangles;
+    for (int i = 0; i < stacks; i++) {
+        for (int j = 0; j < slices; j++) {
+            int bottom = i * (slices + 1) + j, top = (i + 1) * (slices + 1) + j;
+            triangles.push_back(bottom);
+            triangles.push_back(bottom + 1);
+            triangles.push_back(top + 1);
+            triangles.push_back(bottom);
+            triangles.push_back(top + 1);
+            triangles.push_back(top);
+        }
+    }
+    nIndices = triangles.size();
+    vertices = engine->allocateVertexBuffer(points.size() * sizeof(vec3));
+    engine->copyVertexData(vertices, &points[0], points.size() * sizeof(vec3));
+    indices = engine->allocateElementBuffer(triangles.size() * sizeof(int));
+    engine->copyElementData(indices, &triangles[0], triangles.size() * sizeof(int));
+}
+
+inline void MarkerRenderer::initialize(Engine *e, int slices, int stacks) {
+    engine = e;
+    program = ShaderProgram(Config::markerVert, Config::markerFrag);
+    sphere.initialize(engine, slices, stacks);
+    glGenBuffers(1, &instanceBuffer);
+}
+
+inline void MarkerRenderer::clear() {
+    instances.clear();
+}
+
+inline void MarkerRenderer::add(vec3 position, float radius, vec4 color) {
+    MarkerInstance m;
+    m.center = vec4(position, radius);
+    m.color = color;
+    instances.push_back(m);
+}
+
+inline void MarkerRenderer::draw(vec3 lightColor) {
+    if (instances.empty())
+        return;
+    // The fixed-function arrays left enabled by other drawing code would
+    // alias the generic attributes on some drivers
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_COLOR_ARRAY);
+
+    program.enable();
+    program.setUniform("ambient", 0.2f);
+    program.setUniform("lightColor", lightColor);
+    program.setAttribute("vertex", sphere.vertices, 3, GL_FLOAT);
+    int count = instances.size();
+    if (instancingSupported()) {
+        // Orphan the old storage so the driver need not wait for the
+        // previous frame's draw before accepting new data
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        if (count > instanceCapacity)
+            instanceCapacity = std::max(count, 2 * instanceCapacity);
+        glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(MarkerInstance), NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(MarkerInstance), &instances[0]);
+        int stride = sizeof(MarkerInstance);
+        program.setAttribute("center", instanceBuffer, 4, GL_FLOAT, stride, 0, 1);
+        program.setAttribute("color", instanceBuffer, 4, GL_FLOAT, stride, sizeof(vec4), 1);
+        drawElementsInstanced(GL_TRIANGLES, sphere.indices, sphere.nIndices, count);
+        program.unsetAttribute("center");
+        program.unsetAttribute("color");
+    } else {
+        GLint center = program.getAttributeLocation("center");
+        GLint color = program.getAttributeLocation("color");
+        for (int i = 0; i < count; i++) {
+            glVertexAttrib4fv(center, &instances[i].center[0]);
+            glVertexAttrib4fv(color, &instances[i].color[0]);
+            engine->drawElements(GL_TRIANGLES, sphere.indices, sphere.nIndices);
+        }
+    }
+    program.unsetAttribute("vertex");
+    program.disable();
+}
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef OFFSCREEN_HPP
+#define OFFSCREEN_HPP
+
+#include "engine.hpp"
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Renders into a framebuffer object instead of a window and saves the
+// frames as PPM images. Frames are read back through two pixel pack
+// buffers: the read of the frame just drawn is queued on one while the
+// frame before is mapped from the other, so the CPU never waits for the
+// copy it just asked for. The image file is written on a worker thread
+// while the next frame renders.
+class OffscreenTarget {
+public:
+    OffscreenTarget(): width(0), height(0), framebuffer(0), frames(0), saved(0), writeFailed(false) {}
+    ~OffscreenTarget();
+    // False if the context has no framebuffer objects
+    bool initialize(int width, int height);
+    // Directs drawing into the offscreen framebuffer
+    void bind();
+    // Queues the read of the frame just drawn, to be saved to path, and
+    // saves the frame queued by the previous call
+    void capture(std::string path);
+    // Saves the last frame and waits for every file to be written; false
+    // if any could not be
+    bool finish();
+    int getFrameCount() const { return saved; }
+protected:
+    int width, height;
+    GLuint framebuffer, renderbuffers[2];
+    GLuint packBuffers[2];
+    std::string paths[2];
+    // Frames queued and frames handed to the writer
+    int frames, saved;
+    // Flipped to top-down RGB for the writer
+    std::vector<unsigned char> pixels;
+    std::thread writer;
+    bool writeFailed;
+
+    void save(int buffer);
+    static bool writePPM(std::string path, const unsigned char *rgb, int width, int height);
+};
+
+bool framebuffersSupported();
+
+// Definitions below
+
+#ifdef __APPLE__
+
+// The legacy macOS context always has the EXT framebuffer object extension
+inline bool framebuffersSupported() {
+    return true;
+}
+
+#else
+
+inline bool framebuffersSupported() {
+    return GLEW_EXT_framebuffer_object;
+}
+
+#endif
+
+inline OffscreenTarget::~OffscreenTarget() {
+    if (writer.joinable())
+        writer.join();
+    if (framebuffer != 0) {
+        glDeleteFramebuffersEXT(1, &framebuffer);
+        glDeleteRenderbuffersEXT(2, renderbuffers);
+        glDeleteBuffers(2, packBuffers);
+    }
+}
+
+inline bool OffscreenTarget::initialize(int w, int h) {
+    if (!framebuffersSupported())
+        return false;
+    width = w;
+    height = h;
+    glGenRenderbuffersEXT(2, renderbuffers);
+    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, renderbuffers[0]);
+    glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_RGBA8, width, height);
+    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, renderbuffers[1]);
+    glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, 0);
+    glGenFramebuffersEXT(1, &framebuffer);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, framebuffer);
+    glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_RENDERBUFFER_EXT, renderbuffers[0]);
+    glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, renderbuffers[1]);
+    bool complete = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT) == GL_FRAMEBUFFER_COMPLETE_EXT;
+    // Rows of 4-byte pixels need no padding
+    glGenBuffers(2, packBuffers);
+    for (int i = 0; i < 2; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, packBuffers[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 4, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    pixels.resize(width * height * 3);
+    glViewport(0, 0, width, height);
+    Engine::die_if_opengl_error();
+    return complete;
+}
+
+inline void OffscreenTarget::bind() {
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, framebuffer);
+    glViewport(0, 0, width, height);
+}
+
+inline void OffscreenTarget::capture(std::string path) {
+    int buffer = frames % 2;
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, framebuffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, packBuffers[buffer]);
+    // Into the buffer, so this returns before the copy is done
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    paths[buffer] = path;
+    frames++;
+    if (frames > 1)
+        save(1 - buffer);
+}
+
+inline bool OffscreenTarget::finish() {
+    if (frames > saved)
+        save((frames - 1) % 2);
+    if (writer.joinable())
+        writer.join();
+    return !writeFailed;
+}
+
+inline void OffscreenTarget::save(int buffer) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, packBuffers[buffer]);
+    const unsigned char *rgba = (const unsigned char*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    // The writer still owns pixels until the previous file is done
+    if (writer.joinable())
+        writer.join();
+    if (rgba != NULL) {
+        // OpenGL's rows run bottom-up
+        for (int y = 0; y < height; y++) {
+            const unsigned char *in = rgba + (size_t)(height - 1 - y) * width * 4;
+            unsigned char *out = &pixels[(size_t)y * width * 3];
+            for (int x = 0; x < width; x++, in += 4, out += 3) {
+                out[0] = in[0];
+                out[1] = in[1];
+                out[2] = in[2];
+            }
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        std::string path = paths[buffer];
+        writer = std::thread([this, path]() {
+            if (!writePPM(path, &pixels[0], width, height))
+                writeFailed = true;
+        });
+    } else {
+        writeFailed = true;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    saved++;
+}
+
+inline bool OffscreenTarget::writePPM(std::string path, const unsigned char *rgb, int width, int height) {
+    FILE *out = fopen(path.c_str(), "wb");
+    if (out == NULL)
+        return false;
+    size_t bytes = (size_t)width * height * 3;
+    bool ok = fprintf(out, "P6\n%d %d\n255\n", width, height) > 0
+        && fwrite(rgb, 1, bytes, out) == bytes;
+    return fclose(out) == 0 && ok;
+}
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef PICKING_HPP
+#define PICKING_HPP
+
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include "camera.hpp"
+#include "earth.hpp"
+#include "filter.hpp"
+#include "quake.hpp"
+#include "quakeindex.hpp"
+
+// Finds the quake under the mouse. The part of the globe or the flat map
+// drawn within the pick radius of the mouse is bounded, the spatial index
+// is asked for the quakes of the window in that region, and of those the
+// one drawn closest to the mouse on screen wins. Picking is skipped while
+// the Earth is morphing between the two shapes.
+class QuakePicker {
+public:
+    QuakePicker(): db(NULL), index(NULL), selection(NULL) {}
+    void reset(const EarthquakeDatabase *db, const QuakeSpatialIndex *index);
+    // Only picks rows selection contains (NULL for any)
+    void setSelection(const QuakeSelection *s) { selection = s; }
+    // Row of the quake in window drawn nearest to pixel (x, y) of a
+    // width x height viewport, at most radius pixels away, or -1
+    int pick(const OrbitCamera &camera, Earth &earth, const TimeWindowCursor &window,
+             int x, int y, int width, int height, float radius);
+protected:
+    const EarthquakeDatabase *db;
+    const QuakeSpatialIndex *index;
+    const QuakeSelection *selection;
+    std::vector<int> candidates;
+
+    // Adds the rows in [t0, t1] within angle (radians) of the point
+    // centre on the globe, and possibly some more, to candidates
+    void queryCap(vec3 centre, float angle, double t0, double t1);
+};
+
+// Angle at the centre of the unit globe between the point nearest to an
+// eye at distance and the point a ray from the eye, at angle from the
+// direction of the centre, first hits
+float centralAngle(float distance, float angle);
+
+// Definitions below
+
+inline float centralAngle(float distance, float angle) {
+    return asin(std::min(distance * sin(angle), 1.0f)) - angle;
+}
+
+inline void QuakePicker::reset(const EarthquakeDatabase *database, const QuakeSpatialIndex *spatialIndex) {
+    db = database;
+    index = spatialIndex;
+}
+
+inline void QuakePicker::queryCap(vec3 centre, float angle, double t0, double t1) {
+    float latitude = asin(std::min(std::max(centre.y, -1.0f), 1.0f)) * 180 / M_PI;
+    float longitude = atan2(centre.x, centre.z) * 180 / M_PI;
+    float dLat = angle * 180 / M_PI;
+    float cosLat = cos(latitude * M_PI / 180);
+    float lonMin = -180, lonMax = 180;
+    if (cosLat * 180 > dLat && dLat / cosLat < 180) {
+        // Wrapped around the antimeridian if need be
+        lonMin = longitude - dLat / cosLat;
+        lonMax = longitude + dLat / cosLat;
+        if (lonMin < -180)
+            lonMin += 360;
+        if (lonMax > 180)
+            lonMax -= 360;
+    }
+    index->queryBox(std::max(latitude - dLat, -90.0f), std::min(latitude + dLat, 90.0f),
+                    lonMin, lonMax, t0, t1, candidates);
+}
+
+inline int QuakePicker::pick(const OrbitCamera &camera, Earth &earth, const TimeWindowCursor &window,
+                             int x, int y, int width, int height, float radius) {
+    float spherical = earth.isSpherical();
+    if (db == NULL || window.getEnd() < window.getStart() || (spherical != 0 && spherical != 1))
+        return -1;
+    float ndcX = 2.0f * x / width - 1, ndcY = 1 - 2.0f * y / height;
+    vec3 eye = camera.getEye();
+    vec3 ray = camera.getRayDirection(ndcX, ndcY);
+    double t0 = db->getSeconds(window.getStart()), t1 = db->getSeconds(window.getEnd());
+
+    // Rays within alpha of the mouse's ray reach at most radius pixels
+    // from it (a pixel spans the most at the centre of the view)
+    float alpha = radius * 2 * tan(camera.getPerspective().getFov() * M_PI / 360) / height;
+    candidates.clear();
+    if (spherical == 1) {
+        // In the plane of the eye, the centre and the ray, those rays
+        // meeting the globe hit it between the central angles (from the
+        // point below the eye) of the rays at beta - alpha and
+        // beta + alpha, clamped to the silhouette. Sideways they stray at
+        // most alpha times the distance to the limb.
+        float distance = glm::length(eye);
+        vec3 up = eye / distance;
+        float cosBeta = std::min(std::max(-glm::dot(ray, up), -1.0f), 1.0f);
+        float beta = acos(cosBeta);
+        float silhouette = asin(1 / distance);
+        if (beta - alpha > silhouette)
+            return -1;
+        float sideways = alpha * sqrt(distance * distance - 1);
+        float far = centralAngle(distance, std::min(beta + alpha, silhouette));
+        vec3 side = ray + cosBeta * up;
+        if (beta <= alpha || glm::length(side) == 0) {
+            queryCap(up, far + sideways, t0, t1);
+        } else {
+            // Towards the limb this region is long and thin, so it is
+            // covered by a row of caps along the great circle below the
+            // ray rather than one large one
+            side = glm::normalize(side);
+            float near = centralAngle(distance, beta - alpha);
+            int nCaps = std::min((int)ceil((far - near) / (2 * sideways)), 16);
+            float step = (far - near) / nCaps;
+            for (int i = 0; i < nCaps; i++) {
+                float angle = near + (i + 0.5f) * step;
+                queryCap(cos(angle) * up + sin(angle) * side, sqrt(step * step / 4 + sideways * sideways), t0, t1);
+            }
+        }
+    } else {
+        // The flat map lies in the z = 0 plane. Rays at theta from its
+        // normal meet it between theta - alpha and theta + alpha along
+        // the ray's direction, and stray sideways at most alpha times the
+        // distance to the far end.
+        if (ray.z == 0 || -eye.z / ray.z <= 0)
+            return -1;
+        vec3 corner = earth.getRectangularPosition(90, 180);
+        float theta = acos(std::min((float)fabs(ray.z), 1.0f));
+        float above = fabs(eye.z);
+        vec3 hit = eye - eye.z / ray.z * ray;
+        float extent = 2 * corner.x;
+        if (theta + alpha < M_PI / 2 - 0.01) {
+            float near = above * tan(std::max(theta - alpha, 0.0f)), far = above * tan(theta + alpha);
+            float along = glm::length(vec2(ray.x, ray.y));
+            if (along > 0)
+                hit = vec3(eye.x, eye.y, 0) + (near + far) / 2 / along * vec3(ray.x, ray.y, 0);
+            extent = (far - near) / 2 + alpha * above / cos(theta + alpha);
+        }
+        float latitude = hit.y / corner.y * 90, longitude = hit.x / corner.x * 180;
+        float dLat = extent / corner.y * 90, dLon = extent / corner.x * 180;
+        if (fabs(latitude) > 90 + dLat || fabs(longitude) > 180 + dLon)
+            return -1;
+        index->queryBox(std::max(latitude - dLat, -90.0f), std::min(latitude + dLat, 90.0f),
+                        std::max(longitude - dLon, -180.0f), std::min(longitude + dLon, 180.0f),
+                        t0, t1, candidates);
+    }
+
+    // Caps may overlap, so a row can be tested twice
+    int best = -1;
+    float bestDistance = radius * radius;
+    for (size_t i = 0; i < candidates.size(); i++) {
+        int row = candidates[i];
+        // Rows sharing the window's end times can lie just outside it
+        if (row < window.getStart() || row > window.getEnd())
+            continue;
+        if (selection != NULL && !selection->contains(row))
+            continue;
+        vec3 p = earth.getPosition(db->getLatitude(row), db->getLongitude(row));
+        // The far side of the globe is hidden
+        if (spherical == 1 && glm::dot(p, eye) < 1)
+            continue;
+        float px, py;
+        if (!camera.project(p, px, py))
+            continue;
+        float dx = (px - ndcX) * width / 2, dy = (py - ndcY) * height / 2;
+        float distance = dx * dx + dy * dy;
+        if (distance <= bestDistance) {
+            bestDistance = distance;
+            best = row;
+        }
+    }
+    return best;
+}
+
+#endif
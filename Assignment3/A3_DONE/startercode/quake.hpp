@@ -1,32 +1,41 @@
 #ifndef QUAKE_HPP
 #define QUAKE_HPP
 
-#include <ctime>
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
-#include <fstream>
-#include <sstream>
 #include <string>
+#include <utility>
+#include <memory>
 #include <vector>
+#include "civil.hpp"
+#include "column.hpp"
+#include "mappedfile.hpp"
+#include "parallel.hpp"
 
+// A UTC date and time. Conversions are pure arithmetic (see civil.hpp),
+// so they do not depend on the local time zone and are thread-safe.
 class Date {
 public:
     Date();
     Date(double seconds);
     Date(int m, int d, int y);
     Date(int m, int d, int y, int hr, int min, double sec);
-    bool operator<(const Date& other);
-    bool operator>(const Date& other);
+    bool operator<(const Date& other) const;
+    bool operator>(const Date& other) const;
     double asSeconds() const;
     double secondsUntil(const Date& other) const;
-    int getYear();
-    int getMonth();
-    int getDay();
-    int getHour();
-    int getMinute();
-    double getSecond();
+    int getYear() const;
+    int getMonth() const;
+    int getDay() const;
+    int getHour() const;
+    int getMinute() const;
+    double getSecond() const;
 protected:
-    std::time_t ctime;
-    int fouryears;
+    double seconds;
     int year;
     int month;
     int day;
@@ -35,50 +44,221 @@ protected:
     double second;
 };
 
+class EarthquakeDatabase;
+
+// Lightweight view of one row of an EarthquakeDatabase. Copying an
+// Earthquake is as cheap as copying an index; all values are read
+// from the database's pre-parsed columns.
 class Earthquake {
 public:
-    Earthquake() {}
-    // Create an earthquake from a datafile's line of text
-    Earthquake(std::string s);
-    Date getDate();
-    double getLongitude();
-    double getLatitude();
-    double getMagnitude();
+    Earthquake(): db(NULL), index(0) {}
+    Earthquake(const EarthquakeDatabase *db, int index): db(db), index(index) {}
+    Date getDate() const;
+    // Seconds since the epoch, same scale as Date::asSeconds()
+    double getSeconds() const;
+    double getLongitude() const;
+    double getLatitude() const;
+    double getMagnitude() const;
+    double getDepth() const;
+    // Magnitude scale code from the catalog, e.g. "Mw" or "Ms"
+    std::string getMagnitudeType() const;
 protected:
-    std::string line;
-    double parseFloat(std::string s);
-    int parseInt(std::string s);
+    const EarthquakeDatabase *db;
+    int index;
+};
+
+// Magnitude scale code from the catalog, e.g. "Mw"; NUL terminated
+struct MagType {
+    char code[3];
 };
 
+// Structure-of-arrays storage for parsed catalog rows
+class QuakeColumns {
+public:
+    Column<double> seconds;
+    Column<float> latitudes;
+    Column<float> longitudes;
+    Column<float> magnitudes;
+    Column<float> depths;
+    Column<MagType> magTypes;
+    int size() const { return seconds.size(); }
+    void reserve(int rows);
+    void resize(int rows);
+    void clear();
+    // Parses one fixed-width catalog row (without its newline) in place
+    // and appends it. Returns false if the row is too short to hold an event.
+    bool appendRow(const char *line, int length);
+    // Parses every row of a block of catalog text
+    void appendRows(const char *text, size_t length);
+    // Appends all rows of another set of columns
+    void append(const QuakeColumns &other);
+    // Copies all rows into dest starting at row offset; dest must
+    // already be large enough
+    void copyTo(QuakeColumns &dest, int offset) const;
+    // Extends lo/hi to cover the magnitudes of rows [begin, end)
+    void magnitudeRange(int begin, int end, float &lo, float &hi) const;
+    bool isSortedByTime() const;
+    // Stable sort of all columns by time
+    void sortByTime();
+};
+
+// Column layout of the centennial catalog; offsets are 0-based
+namespace CatalogFormat {
+    const int minRowLength = 31;
+    const int yearOffset = 12, yearWidth = 4;
+    const int monthOffset = 17, monthWidth = 2;
+    const int dayOffset = 20, dayWidth = 2;
+    const int hourOffset = 24, hourWidth = 2;
+    const int minuteOffset = 27, minuteWidth = 2;
+    const int secondOffset = 30, secondWidth = 5;
+    const int latitudeOffset = 37, latitudeWidth = 7;
+    const int longitudeOffset = 44, longitudeWidth = 8;
+    const int depthOffset = 52, depthWidth = 6;
+    const int magnitudeOffset = 66, magnitudeWidth = 4;
+    const int magTypeOffset = 71, magTypeWidth = 2;
+
+    // Parse a right-aligned integer field; blanks and missing columns read as 0
+    int parseInt(const char *line, int length, int offset, int width);
+    // Parse a right-aligned decimal field such as " -105.000"
+    double parseDecimal(const char *line, int length, int offset, int width);
+}
+
 class EarthquakeDatabase {
 public:
     // Creates an empty EarthquakeDatabase
-    EarthquakeDatabase() {}
-    // Creates an EarthquakeDatabase from file
-    EarthquakeDatabase(std::string filename);
+    EarthquakeDatabase(): fileFound(false) {}
+    // Creates an EarthquakeDatabase from file, parsing it on the given
+    // number of threads (0 uses every hardware thread)
+    EarthquakeDatabase(std::string filename, int threads = 0);
+    // Loads from the binary cache next to filename (see cacheFilename)
+    // if it is up to date. Otherwise parses the text and writes a new
+    // cache for next time. Returns fileFound.
+    bool loadCached(std::string filename, int threads = 0);
+    // Name of the binary cache file for a catalog
+    static std::string cacheFilename(std::string filename);
+    // Memory-maps a cache file; fails if it is not a valid cache for
+    // a source of the given size and modification time
+    bool readCache(std::string cacheFile, long long sourceSize, long long sourceTime);
+    // Writes the columns to a cache file, tagged with the source's
+    // size and modification time
+    bool writeCache(std::string cacheFile, long long sourceSize, long long sourceTime) const;
     // Returns Earthquake given index in file
-    Earthquake getByIndex(int index);
+    Earthquake getByIndex(int index) const;
     // Returns minimum index.  Note that this is not zero!
-    int getMinIndex();
+    int getMinIndex() const;
     // Returns maximum valid index.  Running
     // getByIndex(getMaxIndex()) WILL return the last earthquake in the file
-    int getMaxIndex();
+    int getMaxIndex() const;
     // Returns the index of the most recent earthquake as of given date
-    int getIndexByDate(Date d);
+    int getIndexByDate(Date d) const;
+    // Same as getIndexByDate, but takes seconds since the epoch
+    int getIndexBySeconds(double seconds) const;
+    // Same as getIndexBySeconds, but searches outwards from a previous
+    // answer; costs O(log distance) instead of O(log n)
+    int seekIndexBySeconds(int hint, double seconds) const;
 	// Flag which is set to true if the file was successfully loaded
 	bool fileFound;
 
-	float getMaxMag();
-	float getMinMag();
+	float getMaxMag() const;
+	float getMinMag() const;
+
+    // Column accessors, one entry per row
+    double getSeconds(int index) const { return rows.seconds[index]; }
+    float getLatitude(int index) const { return rows.latitudes[index]; }
+    float getLongitude(int index) const { return rows.longitudes[index]; }
+    float getMagnitude(int index) const { return rows.magnitudes[index]; }
+    float getDepth(int index) const { return rows.depths[index]; }
+    const char *getMagnitudeType(int index) const { return rows.magTypes[index].code; }
+    // Every row, for scanning whole columns at a time
+    const QuakeColumns &getColumns() const { return rows; }
+    // Size of the catalog file when it was loaded, i.e. where newly
+    // appended rows start
+    long long getSourceBytes() const { return sourceBytes; }
+    // Adds rows (e.g. appended to the catalog since loading), keeping the
+    // rows in time order and extending the magnitude range. Returns the
+    // first index whose row changed; rows before it are untouched.
+    int insertRows(const QuakeColumns &batch);
 protected:
-    std::vector<Earthquake> earthquakes;
+    QuakeColumns rows;
 	float maxMag = 0;
 	float minMag = 0;
+    // Time of every timeFenceStride-th row, so lookups by time binary
+    // search a small array before touching the big seconds column
+    Column<double> timeFences;
+    static const int timeFenceStride = 256;
+    long long sourceBytes = 0;
+    // Cache file that the columns view when loaded by readCache
+    std::shared_ptr<MappedFile> cache;
+
+    // Parses the catalog text file on the given number of threads
+    bool loadText(std::string filename, int threads);
+    // Parses catalog text in chunks split at row boundaries
+    void load(const char *text, size_t length, int threads);
+    void buildTimeFences();
 };
 
-// Date methods
+// Half-open range of row indices [first, last)
+struct IndexRange {
+    int first, last;
+    int size() const { return last - first; }
+};
+
+// Tracks the rows shown for a sliding time window ending at the current
+// time. Each moveTo only walks the rows that entered or left the window
+// since the previous call, and reports them so that users can update
+// incrementally. Moving backwards or jumping (e.g. wrapping around at
+// the end of the catalog) works too.
+class TimeWindowCursor {
+public:
+    TimeWindowCursor(): db(NULL), length(0), start(0), end(-1), nAdded(0), nRemoved(0) {}
+    // Starts an empty window of the given length (seconds) over db
+    void reset(const EarthquakeDatabase *db, double length);
+    // Moves the window to end at time t
+    void moveTo(double t);
+    // Rows currently in the window, inclusive, matching
+    // getIndexBySeconds(t - length) and getIndexBySeconds(t)
+    int getStart() const { return start; }
+    int getEnd() const { return end; }
+    // Ranges that entered / left the window in the last moveTo
+    int getAddedCount() const { return nAdded; }
+    IndexRange getAdded(int i) const { return added[i]; }
+    int getRemovedCount() const { return nRemoved; }
+    IndexRange getRemoved(int i) const { return removed[i]; }
+protected:
+    const EarthquakeDatabase *db;
+    double length;
+    int start, end;
+    IndexRange added[2], removed[2];
+    int nAdded, nRemoved;
+    // Appends the parts of [aFirst, aLast) outside [bFirst, bLast)
+    static int subtract(int aFirst, int aLast, int bFirst, int bLast, IndexRange *out);
+};
+
+// Radiated energy in joules of a quake of the given magnitude, from the
+// Gutenberg-Richter energy-magnitude relation: log10 E = 1.5 M + 4.8
+double seismicEnergy(float magnitude);
+
+// Layout of the binary catalog cache (.qdb). The header is followed by
+// the columns in this order, each starting on an 8-byte boundary:
+// seconds, latitudes, longitudes, magnitudes, depths, magTypes, timeFences.
+// Values are stored in native byte order.
+struct QuakeCacheHeader {
+    char magic[4];
+    uint32_t version;
+    int64_t sourceSize;
+    int64_t sourceTime;
+    uint32_t rowCount;
+    uint32_t fenceStride;
+    uint32_t fenceCount;
+    float minMag, maxMag;
+    uint32_t reserved;
+};
 
-static const int SECONDS_PER_4_YEARS=126230400;
+static const char QUAKE_CACHE_MAGIC[4] = {'Q', 'D', 'B', '\0'};
+// Version 2: times are UTC rather than local time
+static const uint32_t QUAKE_CACHE_VERSION = 2;
+
+// Date methods
 
 inline Date::Date() {
     year = 0;
@@ -87,26 +267,18 @@ inline Date::Date() {
     hour = 0;
     minute = 0;
     second = 0;
-    ctime = 0;
-    fouryears = 0;
-}
-inline Date::Date(double seconds) {
-    double tweakedSeconds = seconds;
-    fouryears = 0;
-    while (tweakedSeconds < 0) {
-        tweakedSeconds += SECONDS_PER_4_YEARS;
-        fouryears++;
-    }
-    ctime = int(tweakedSeconds);
-	tm t_local;
-	tm *t = &t_local;
-	localtime_s(t, &ctime);
-    year = t->tm_year + 1900 - 4 * fouryears;
-    month = t->tm_mon + 1;
-    day = t->tm_mday;
-    hour = t->tm_hour;
-    minute = t->tm_min;
-    second = t->tm_sec + (tweakedSeconds - ctime);
+    seconds = 0;
+}
+
+inline Date::Date(double s) {
+    Civil::CivilTime t = Civil::civilFromSeconds(s);
+    seconds = s;
+    year = t.year;
+    month = t.month;
+    day = t.day;
+    hour = t.hour;
+    minute = t.minute;
+    second = t.second;
 }
 
 inline Date::Date(int m, int d, int y) {
@@ -116,18 +288,7 @@ inline Date::Date(int m, int d, int y) {
     hour = 0;
     minute = 0;
     second = 0;
-    fouryears = 0;
-    tm t;
-    while (year + fouryears*4 < 1970) {
-        fouryears++;
-    }
-    t.tm_year = year - 1900 + fouryears * 4;
-    t.tm_mon = month - 1;
-    t.tm_mday = day;
-    t.tm_hour = 0;
-    t.tm_min = 0;
-    t.tm_sec = 0;
-    ctime = mktime(&t);
+    seconds = Civil::secondsFromCivil(year, month, day, 0, 0, 0);
 }
 
 inline Date::Date(int m, int d, int y, int hr, int min, double sec) {
@@ -137,174 +298,603 @@ inline Date::Date(int m, int d, int y, int hr, int min, double sec) {
     hour = hr;
     minute = min;
     second = sec;
-    fouryears = 0;
-    tm t;
-    while (year + fouryears*4 < 1970) {
-        fouryears++;
-    }
-    t.tm_year = year - 1900 + fouryears * 4;
-    t.tm_mon = month - 1;
-    t.tm_mday = day;
-    t.tm_hour = hour;
-    t.tm_min = minute;
-    t.tm_sec = int(second);
-    ctime = mktime(&t);
+    seconds = Civil::secondsFromCivil(year, month, day, hour, minute, second);
 }
 
-inline bool Date::operator<(const Date& other) {
+inline bool Date::operator<(const Date& other) const {
     return asSeconds() < other.asSeconds();
 }
 
-inline bool Date::operator>(const Date& other) {
+inline bool Date::operator>(const Date& other) const {
     return asSeconds() > other.asSeconds();
 }
 
 inline double Date::asSeconds() const {
-    return ctime + second - int(second) - double(fouryears) * SECONDS_PER_4_YEARS;
+    return seconds;
 }
 
 inline double Date::secondsUntil(const Date& other) const {
     return asSeconds() - other.asSeconds();
 }
 
-inline int Date::getYear() {
+inline int Date::getYear() const {
     return year;
 }
 
-inline int Date::getMonth() {
+inline int Date::getMonth() const {
     return month;
 }
 
-inline int Date::getDay() {
+inline int Date::getDay() const {
     return day;
 }
 
-inline int Date::getHour() {
+inline int Date::getHour() const {
     return hour;
 }
 
-inline int Date::getMinute() {
+inline int Date::getMinute() const {
     return minute;
 }
 
-inline double Date::getSecond() {
+inline double Date::getSecond() const {
     return second;
 }
 
 // Earthquake methods
 
-inline Earthquake::Earthquake(std::string s) {
-    line = s;
+inline Date Earthquake::getDate() const {
+    return Date(db->getSeconds(index));
+}
+
+inline double Earthquake::getSeconds() const {
+    return db->getSeconds(index);
+}
+
+inline double Earthquake::getLongitude() const {
+    return db->getLongitude(index);
+}
+
+inline double Earthquake::getLatitude() const {
+    return db->getLatitude(index);
+}
+
+inline double Earthquake::getMagnitude() const {
+    return db->getMagnitude(index);
+}
+
+inline double Earthquake::getDepth() const {
+    return db->getDepth(index);
+}
+
+inline std::string Earthquake::getMagnitudeType() const {
+    return std::string(db->getMagnitudeType(index));
+}
+
+// Catalog parsing
+
+namespace CatalogFormat {
+
+    static const double powersOfTen[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+
+    inline int parseInt(const char *line, int length, int offset, int width) {
+        int end = offset + width < length ? offset + width : length;
+        int i = offset;
+        while (i < end && line[i] == ' ')
+            i++;
+        bool negative = false;
+        if (i < end && (line[i] == '-' || line[i] == '+'))
+            negative = line[i++] == '-';
+        int value = 0;
+        for (; i < end && line[i] >= '0' && line[i] <= '9'; i++)
+            value = value * 10 + (line[i] - '0');
+        return negative ? -value : value;
+    }
+
+    inline double parseDecimal(const char *line, int length, int offset, int width) {
+        int end = offset + width < length ? offset + width : length;
+        int i = offset;
+        while (i < end && line[i] == ' ')
+            i++;
+        bool negative = false;
+        if (i < end && (line[i] == '-' || line[i] == '+'))
+            negative = line[i++] == '-';
+        // Accumulate all digits as one integer mantissa, then scale once
+        long long mantissa = 0;
+        int fractionDigits = 0;
+        bool inFraction = false;
+        for (; i < end; i++) {
+            char c = line[i];
+            if (c >= '0' && c <= '9') {
+                mantissa = mantissa * 10 + (c - '0');
+                if (inFraction)
+                    fractionDigits++;
+            } else if (c == '.' && !inFraction) {
+                inFraction = true;
+            } else {
+                break;
+            }
+        }
+        double value = (double)mantissa / powersOfTen[fractionDigits];
+        return negative ? -value : value;
+    }
+
 }
 
-inline Date Earthquake::getDate() {
-    int year = parseInt(line.substr(12,4));
-    int month = parseInt(line.substr(17,2));
-    int day = parseInt(line.substr(20,2));
-    int hour = parseInt(line.substr(24,2));
-    int minute = parseInt(line.substr(27,2));
-    double second = parseFloat(line.substr(30,5));
-    return Date(month, day, year, hour, minute, second);
+// QuakeColumns methods
+
+inline void QuakeColumns::reserve(int n) {
+    seconds.reserve(n);
+    latitudes.reserve(n);
+    longitudes.reserve(n);
+    magnitudes.reserve(n);
+    depths.reserve(n);
+    magTypes.reserve(n);
 }
 
-inline double Earthquake::getLongitude() {
-    return parseFloat(line.substr(44,8));
-    //return parseFloat(line.substr(37,7));
+inline void QuakeColumns::resize(int n) {
+    seconds.resize(n);
+    latitudes.resize(n);
+    longitudes.resize(n);
+    magnitudes.resize(n);
+    depths.resize(n);
+    magTypes.resize(n);
 }
 
-inline double Earthquake::getLatitude() {
-    //return parseFloat(line.substr(44,8));
-    return parseFloat(line.substr(37,7));
+inline void QuakeColumns::clear() {
+    seconds.clear();
+    latitudes.clear();
+    longitudes.clear();
+    magnitudes.clear();
+    depths.clear();
+    magTypes.clear();
 }
 
-inline double Earthquake::getMagnitude() {
-    return parseFloat(line.substr(66,4));
+inline bool QuakeColumns::appendRow(const char *line, int length) {
+    using namespace CatalogFormat;
+    if (length < minRowLength)
+        return false;
+    int year = parseInt(line, length, yearOffset, yearWidth);
+    int month = parseInt(line, length, monthOffset, monthWidth);
+    int day = parseInt(line, length, dayOffset, dayWidth);
+    int hour = parseInt(line, length, hourOffset, hourWidth);
+    int minute = parseInt(line, length, minuteOffset, minuteWidth);
+    double second = parseDecimal(line, length, secondOffset, secondWidth);
+    seconds.push_back(Civil::secondsFromCivil(year, month, day, hour, minute, second));
+    latitudes.push_back(parseDecimal(line, length, latitudeOffset, latitudeWidth));
+    longitudes.push_back(parseDecimal(line, length, longitudeOffset, longitudeWidth));
+    depths.push_back(parseDecimal(line, length, depthOffset, depthWidth));
+    magnitudes.push_back(parseDecimal(line, length, magnitudeOffset, magnitudeWidth));
+    MagType type = {{0, 0, 0}};
+    for (int i = 0; i < magTypeWidth && magTypeOffset + i < length && line[magTypeOffset + i] != ' '; i++)
+        type.code[i] = line[magTypeOffset + i];
+    magTypes.push_back(type);
+    return true;
 }
 
-inline double Earthquake::parseFloat(std::string s) {
-    std::stringstream ss(s);
-    double f;
-    ss >> f;
-    return f;
+inline void QuakeColumns::appendRows(const char *text, size_t length) {
+    const char *p = text, *end = text + length;
+    while (p < end) {
+        const char *newline = (const char*)memchr(p, '\n', end - p);
+        const char *lineEnd = newline != NULL ? newline : end;
+        int lineLength = lineEnd - p;
+        if (lineLength > 0 && p[lineLength - 1] == '\r')
+            lineLength--;
+        appendRow(p, lineLength);
+        p = lineEnd + 1;
+    }
+}
+
+inline void QuakeColumns::append(const QuakeColumns &other) {
+    seconds.append(other.seconds.begin(), other.seconds.end());
+    latitudes.append(other.latitudes.begin(), other.latitudes.end());
+    longitudes.append(other.longitudes.begin(), other.longitudes.end());
+    magnitudes.append(other.magnitudes.begin(), other.magnitudes.end());
+    depths.append(other.depths.begin(), other.depths.end());
+    magTypes.append(other.magTypes.begin(), other.magTypes.end());
 }
 
-inline int Earthquake::parseInt(std::string s) {
-    std::stringstream ss(s);
-    int i;
-    ss >> i;
-    return i;
+inline void QuakeColumns::copyTo(QuakeColumns &dest, int offset) const {
+    std::copy(seconds.begin(), seconds.end(), dest.seconds.data() + offset);
+    std::copy(latitudes.begin(), latitudes.end(), dest.latitudes.data() + offset);
+    std::copy(longitudes.begin(), longitudes.end(), dest.longitudes.data() + offset);
+    std::copy(magnitudes.begin(), magnitudes.end(), dest.magnitudes.data() + offset);
+    std::copy(depths.begin(), depths.end(), dest.depths.data() + offset);
+    std::copy(magTypes.begin(), magTypes.end(), dest.magTypes.data() + offset);
+}
+
+inline void QuakeColumns::magnitudeRange(int begin, int end, float &lo, float &hi) const {
+    for (int i = begin; i < end; i++) {
+        float m = magnitudes[i];
+        if (m < lo)
+            lo = m;
+        if (m > hi)
+            hi = m;
+    }
+}
+
+inline bool QuakeColumns::isSortedByTime() const {
+    for (int i = 1; i < size(); i++)
+        if (seconds[i] < seconds[i - 1])
+            return false;
+    return true;
+}
+
+inline void QuakeColumns::sortByTime() {
+    std::vector<int> order(size());
+    for (int i = 0; i < size(); i++)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+        return seconds[a] < seconds[b];
+    });
+    QuakeColumns sorted;
+    sorted.resize(size());
+    for (int i = 0; i < size(); i++) {
+        sorted.seconds.data()[i] = seconds[order[i]];
+        sorted.latitudes.data()[i] = latitudes[order[i]];
+        sorted.longitudes.data()[i] = longitudes[order[i]];
+        sorted.magnitudes.data()[i] = magnitudes[order[i]];
+        sorted.depths.data()[i] = depths[order[i]];
+        sorted.magTypes.data()[i] = magTypes[order[i]];
+    }
+    std::swap(*this, sorted);
 }
 
 // Earthquake database methods
 
-inline EarthquakeDatabase::EarthquakeDatabase(std::string filename) {
-    std::ifstream in(filename.c_str());
-	if (!in) {
+inline EarthquakeDatabase::EarthquakeDatabase(std::string filename, int threads) {
+    loadText(filename, threads);
+}
+
+inline bool EarthquakeDatabase::loadText(std::string filename, int threads) {
+    MappedFile file;
+	if (!file.open(filename)) {
 		fileFound = false;
+		return false;
 	}
-	else {
-		fileFound = true;
-	}
-    std::string line;
-    while (getline(in, line)) {
-        if (line.size() > 30) {
-			Earthquake e = Earthquake(line);
-            earthquakes.push_back(e);
-
-			//store max and min values in database
-			float temp = e.getMagnitude();
-
-			if (temp < minMag) {
-				minMag = temp;
-			}
-			if (temp > maxMag) {
-				maxMag = temp;
-			}
-        }
+	fileFound = true;
+    file.adviseSequential();
+    sourceBytes = file.size();
+    load(file.data(), file.size(), threads);
+    // Lookups by time need the rows in time order
+    if (!rows.isSortedByTime())
+        rows.sortByTime();
+    buildTimeFences();
+    return true;
+}
+
+inline std::string EarthquakeDatabase::cacheFilename(std::string filename) {
+    return filename + ".qdb";
+}
+
+inline bool EarthquakeDatabase::loadCached(std::string filename, int threads) {
+    long long size, time;
+    if (!getFileStamp(filename, size, time)) {
+        fileFound = false;
+        return false;
     }
+    std::string cacheFile = cacheFilename(filename);
+    if (readCache(cacheFile, size, time))
+        return true;
+    if (!loadText(filename, threads))
+        return false;
+    // Failing to write the cache (e.g. a read-only data directory) only
+    // means the next launch parses the text again
+    writeCache(cacheFile, size, time);
+    return true;
 }
 
-inline Earthquake EarthquakeDatabase::getByIndex(int index) {
-    return earthquakes[index];
+// Round a byte offset up to the next 8-byte boundary
+inline size_t alignCacheOffset(size_t offset) {
+    return (offset + 7) & ~(size_t)7;
 }
 
-inline int EarthquakeDatabase::getMinIndex() {
+inline bool EarthquakeDatabase::readCache(std::string cacheFile, long long sourceSize, long long sourceTime) {
+    std::shared_ptr<MappedFile> file(new MappedFile(cacheFile));
+    if (!file->isOpen() || file->size() < sizeof(QuakeCacheHeader))
+        return false;
+    QuakeCacheHeader header;
+    memcpy(&header, file->data(), sizeof(header));
+    if (memcmp(header.magic, QUAKE_CACHE_MAGIC, 4) != 0
+        || header.version != QUAKE_CACHE_VERSION
+        || header.sourceSize != sourceSize
+        || header.sourceTime != sourceTime
+        || header.fenceStride != (uint32_t)timeFenceStride)
+        return false;
+
+    // Work out where each column starts and check the file holds them all
+    size_t n = header.rowCount;
+    size_t sizes[7] = {
+        n * sizeof(double), n * sizeof(float), n * sizeof(float),
+        n * sizeof(float), n * sizeof(float), n * sizeof(MagType),
+        header.fenceCount * sizeof(double)
+    };
+    size_t offsets[7];
+    size_t offset = alignCacheOffset(sizeof(header));
+    for (int c = 0; c < 7; c++) {
+        offsets[c] = offset;
+        offset = alignCacheOffset(offset + sizes[c]);
+    }
+    if (offsets[6] + sizes[6] > file->size())
+        return false;
+
+    const char *base = file->data();
+    rows.clear();
+    rows.seconds.view((const double*)(base + offsets[0]), n);
+    rows.latitudes.view((const float*)(base + offsets[1]), n);
+    rows.longitudes.view((const float*)(base + offsets[2]), n);
+    rows.magnitudes.view((const float*)(base + offsets[3]), n);
+    rows.depths.view((const float*)(base + offsets[4]), n);
+    rows.magTypes.view((const MagType*)(base + offsets[5]), n);
+    timeFences.view((const double*)(base + offsets[6]), header.fenceCount);
+    minMag = header.minMag;
+    maxMag = header.maxMag;
+    sourceBytes = header.sourceSize;
+    cache = file;
+    fileFound = true;
+    return true;
+}
+
+inline bool EarthquakeDatabase::writeCache(std::string cacheFile, long long sourceSize, long long sourceTime) const {
+    QuakeCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, QUAKE_CACHE_MAGIC, 4);
+    header.version = QUAKE_CACHE_VERSION;
+    header.sourceSize = sourceSize;
+    header.sourceTime = sourceTime;
+    header.rowCount = rows.size();
+    header.fenceStride = timeFenceStride;
+    header.fenceCount = timeFences.size();
+    header.minMag = minMag;
+    header.maxMag = maxMag;
+
+    // Write to a temporary file and rename it into place, so a crash
+    // mid-write never leaves a cache that looks valid
+    std::string tempFile = cacheFile + ".tmp";
+    FILE *out = fopen(tempFile.c_str(), "wb");
+    if (out == NULL)
+        return false;
+    const void *columns[7] = {
+        rows.seconds.data(), rows.latitudes.data(), rows.longitudes.data(),
+        rows.magnitudes.data(), rows.depths.data(), rows.magTypes.data(),
+        timeFences.data()
+    };
+    size_t n = rows.size();
+    size_t sizes[7] = {
+        n * sizeof(double), n * sizeof(float), n * sizeof(float),
+        n * sizeof(float), n * sizeof(float), n * sizeof(MagType),
+        timeFences.size() * sizeof(double)
+    };
+    static const char padding[8] = {0};
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    size_t offset = sizeof(header);
+    for (int c = 0; c < 7 && ok; c++) {
+        size_t aligned = alignCacheOffset(offset);
+        ok = fwrite(padding, 1, aligned - offset, out) == aligned - offset
+            && (sizes[c] == 0 || fwrite(columns[c], 1, sizes[c], out) == sizes[c]);
+        offset = aligned + sizes[c];
+    }
+    ok = fclose(out) == 0 && ok;
+    if (ok) {
+        remove(cacheFile.c_str());
+        ok = rename(tempFile.c_str(), cacheFile.c_str()) == 0;
+    }
+    if (!ok)
+        remove(tempFile.c_str());
+    return ok;
+}
+
+inline void EarthquakeDatabase::buildTimeFences() {
+    timeFences.clear();
+    for (int i = 0; i < rows.size(); i += timeFenceStride)
+        timeFences.push_back(rows.seconds[i]);
+}
+
+inline void EarthquakeDatabase::load(const char *text, size_t length, int threads) {
+    if (threads <= 0)
+        threads = Parallel::defaultThreads();
+    // Several chunks per thread so uneven chunks balance out, but
+    // no smaller than about 1 MB so small catalogs use fewer threads
+    const size_t minChunkBytes = 1 << 20;
+    size_t maxChunks = length / minChunkBytes + 1;
+    int nChunks = maxChunks < (size_t)threads * 4 ? (int)maxChunks : threads * 4;
+
+    // Split at newlines so that every row falls in exactly one chunk
+    std::vector<size_t> bounds(nChunks + 1);
+    bounds[0] = 0;
+    bounds[nChunks] = length;
+    for (int c = 1; c < nChunks; c++) {
+        size_t b = length / nChunks * c;
+        if (b < bounds[c - 1])
+            b = bounds[c - 1];
+        const char *newline = (const char*)memchr(text + b, '\n', length - b);
+        bounds[c] = newline != NULL ? newline + 1 - text : length;
+    }
+
+    // Parse each chunk into its own columns, and reduce its magnitude range
+    std::vector<QuakeColumns> chunks(nChunks);
+    std::vector<float> chunkMin(nChunks, minMag), chunkMax(nChunks, maxMag);
+    Parallel::forEach(nChunks, threads, [&](int c) {
+        size_t bytes = bounds[c + 1] - bounds[c];
+        // Rows are about 170 bytes; reserving up front avoids regrowing the columns
+        chunks[c].reserve(bytes / 160 + 1);
+        chunks[c].appendRows(text + bounds[c], bytes);
+        chunks[c].magnitudeRange(0, chunks[c].size(), chunkMin[c], chunkMax[c]);
+    });
+
+    // Stitch the chunks together in file order
+    if (nChunks == 1 && rows.size() == 0) {
+        rows = std::move(chunks[0]);
+    } else {
+        std::vector<int> offsets(nChunks + 1, rows.size());
+        for (int c = 0; c < nChunks; c++)
+            offsets[c + 1] = offsets[c] + chunks[c].size();
+        rows.resize(offsets[nChunks]);
+        Parallel::forEach(nChunks, threads, [&](int c) {
+            chunks[c].copyTo(rows, offsets[c]);
+        });
+    }
+    for (int c = 0; c < nChunks; c++) {
+        if (chunkMin[c] < minMag)
+            minMag = chunkMin[c];
+        if (chunkMax[c] > maxMag)
+            maxMag = chunkMax[c];
+    }
+}
+
+inline int EarthquakeDatabase::insertRows(const QuakeColumns &batch) {
+    int oldSize = rows.size();
+    if (batch.size() == 0)
+        return oldSize;
+    batch.magnitudeRange(0, batch.size(), minMag, maxMag);
+    double earliest = *std::min_element(batch.seconds.begin(), batch.seconds.end());
+    rows.append(batch);
+    if (oldSize == 0 || earliest >= rows.seconds[oldSize - 1]) {
+        // Usual case: new events are later than everything loaded
+        if (!batch.isSortedByTime())
+            rows.sortByTime();
+        for (int i = (oldSize + timeFenceStride - 1) / timeFenceStride * timeFenceStride;
+             i < rows.size(); i += timeFenceStride)
+            timeFences.push_back(rows.seconds[i]);
+        return oldSize;
+    }
+    // Late arrivals land before existing rows; the stable sort keeps
+    // rows with equal times in the order they were added
+    const double *seconds = rows.seconds.begin();
+    int first = std::upper_bound(seconds, seconds + oldSize, earliest) - seconds;
+    rows.sortByTime();
+    buildTimeFences();
+    return first;
+}
+
+inline Earthquake EarthquakeDatabase::getByIndex(int index) const {
+    return Earthquake(this, index);
+}
+
+inline int EarthquakeDatabase::getMinIndex() const {
     return 250;
 }
 
-inline int EarthquakeDatabase::getMaxIndex() {
-    return earthquakes.size() - 1;
+inline int EarthquakeDatabase::getMaxIndex() const {
+    return rows.size() - 1;
 }
 
-inline float EarthquakeDatabase::getMaxMag() {
+inline float EarthquakeDatabase::getMaxMag() const {
 	return maxMag;
 }
 
-inline float EarthquakeDatabase::getMinMag() {
+inline float EarthquakeDatabase::getMinMag() const {
 	return minMag;
 }
 
-inline int EarthquakeDatabase::getIndexByDate(Date d) {
-    double targetSeconds = d.asSeconds();
-    int start = getMinIndex();
-    int end = getMaxIndex();
-    while (start < end-1) {
-        int half = (start + end) / 2;
-        if (earthquakes[half].getDate().asSeconds() > targetSeconds) {
-            end = half - 1;
-        } else {
-            start = half;
+inline int EarthquakeDatabase::getIndexByDate(Date d) const {
+    return getIndexBySeconds(d.asSeconds());
+}
+
+inline int EarthquakeDatabase::getIndexBySeconds(double targetSeconds) const {
+    int minIndex = getMinIndex();
+    int maxIndex = getMaxIndex();
+    if (maxIndex < minIndex)
+        return minIndex;
+    // The first fence later than the target bounds a block of at most
+    // timeFenceStride rows that holds the last row at or before it
+    int fence = std::upper_bound(timeFences.begin(), timeFences.end(), targetSeconds) - timeFences.begin();
+    int blockBegin = std::max(minIndex, (fence - 1) * timeFenceStride);
+    int blockEnd = std::min(maxIndex + 1, fence * timeFenceStride);
+    if (blockEnd <= blockBegin)
+        return minIndex;
+    const double *seconds = rows.seconds.data();
+    int index = std::upper_bound(seconds + blockBegin, seconds + blockEnd, targetSeconds) - seconds - 1;
+    return std::max(minIndex, index);
+}
+
+inline int EarthquakeDatabase::seekIndexBySeconds(int hint, double targetSeconds) const {
+    int minIndex = getMinIndex();
+    int maxIndex = getMaxIndex();
+    if (maxIndex < minIndex)
+        return minIndex;
+    hint = std::min(std::max(hint, minIndex), maxIndex);
+    const double *seconds = rows.seconds.data();
+    // Gallop away from the hint in steps of 1, 2, 4, ... until the
+    // answer is bracketed, then binary search inside the bracket
+    int lo, hi;
+    if (seconds[hint] <= targetSeconds) {
+        lo = hint;
+        int step = 1;
+        hi = hint + step;
+        while (hi <= maxIndex && seconds[hi] <= targetSeconds) {
+            lo = hi;
+            step *= 2;
+            hi = hint + step;
         }
-    }
-    if (start == end)
-        return start;
-    else {
-        if (earthquakes[end].getDate().asSeconds() > targetSeconds) {
-            return start;
-        } else {
-            return end;
+        hi = std::min(hi, maxIndex + 1);
+    } else {
+        hi = hint;
+        int step = 1;
+        lo = hint - step;
+        while (lo > minIndex && seconds[lo] > targetSeconds) {
+            hi = lo;
+            step *= 2;
+            lo = hint - step;
         }
+        lo = std::max(lo, minIndex);
+        if (seconds[lo] > targetSeconds)
+            return minIndex;
+    }
+    // Now seconds[lo] <= target and every row from hi on is later
+    int index = std::upper_bound(seconds + lo, seconds + hi, targetSeconds) - seconds - 1;
+    return std::max(minIndex, index);
+}
+
+inline double seismicEnergy(float magnitude) {
+    return pow(10.0, 1.5 * magnitude + 4.8);
+}
+
+// TimeWindowCursor methods
+
+inline void TimeWindowCursor::reset(const EarthquakeDatabase *database, double windowLength) {
+    db = database;
+    length = windowLength;
+    start = db->getMinIndex();
+    end = start - 1;
+    nAdded = 0;
+    nRemoved = 0;
+}
+
+inline void TimeWindowCursor::moveTo(double t) {
+    int oldStart = start, oldEnd = end;
+    if (end < start) {
+        // First move: nothing to walk from
+        start = db->getIndexBySeconds(t - length);
+        end = db->getIndexBySeconds(t);
+    } else {
+        start = db->seekIndexBySeconds(start, t - length);
+        end = db->seekIndexBySeconds(end, t);
+    }
+    nAdded = subtract(start, end + 1, oldStart, oldEnd + 1, added);
+    nRemoved = subtract(oldStart, oldEnd + 1, start, end + 1, removed);
+}
+
+inline int TimeWindowCursor::subtract(int aFirst, int aLast, int bFirst, int bLast, IndexRange *out) {
+    if (aLast <= aFirst)
+        return 0;
+    if (bLast <= bFirst || bLast <= aFirst || aLast <= bFirst) {
+        out[0].first = aFirst;
+        out[0].last = aLast;
+        return 1;
+    }
+    int n = 0;
+    if (aFirst < bFirst) {
+        out[n].first = aFirst;
+        out[n].last = bFirst;
+        n++;
+    }
+    if (bLast < aLast) {
+        out[n].first = bLast;
+        out[n].last = aLast;
+        n++;
     }
+    return n;
 }
 
 #endif
@@ -0,0 +1,45 @@
+#version 120
+
+// Vertex of the unit sphere mesh, which is also its normal
+attribute vec3 vertex;
+// Per-instance catalog row
+attribute vec3 spherePosition;
+attribute vec3 rectPosition;
+attribute vec2 time;
+attribute float magnitude;
+// 1 if the filter keeps the row, else 0
+attribute float selected;
+
+// Seconds since the first quake, split like the time attribute
+uniform vec2 currentTime;
+uniform float timeWindow;
+uniform float magScale;
+// 0 for the flat map, 1 for the globe
+uniform float spherical;
+
+varying vec3 position;
+varying vec3 normal;
+varying vec4 markerColor;
+
+void main() {
+    // Subtract the large parts first so the small ones are not lost
+    float age = (currentTime.x - time.x) + (currentTime.y - time.y);
+    if (selected < 0.5 || age < 0.0 || age > timeWindow) {
+        // Filtered out or outside the window: put every vertex outside
+        // the clip volume
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        markerColor = vec4(0.0);
+        position = vec3(0.0);
+        normal = vec3(0.0, 0.0, 1.0);
+        return;
+    }
+    float s = magnitude * magScale;
+    float fade = 1.0 - 0.75 * age / timeWindow;
+    float radius = 0.04 * s;
+    vec3 center = mix(rectPosition, spherePosition, spherical);
+    vec4 world = vec4(center + radius * vertex, 1.0);
+    position = (gl_ModelViewMatrix * world).xyz;
+    normal = gl_NormalMatrix * vertex;
+    markerColor = vec4(1.0, 0.0, 0.0, 0.7 * s * fade);
+    gl_Position = gl_ModelViewProjectionMatrix * world;
+}
@@ -0,0 +1,175 @@
+#ifndef QUAKEBUFFER_HPP
+#define QUAKEBUFFER_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+#include "config.hpp"
+#include "earth.hpp"
+#include "engine.hpp"
+#include "filter.hpp"
+#include "markers.hpp"
+#include "quake.hpp"
+#include "shader.hpp"
+#include <glm/glm.hpp>
+using glm::vec2;
+using glm::vec3;
+
+// One row of the catalog as stored on the GPU
+struct QuakeVertex {
+    vec3 spherePosition;
+    vec3 rectPosition;
+    // Seconds since the first quake, split into a float and the remainder
+    // the float could not hold, so ages stay exact to about a second
+    vec2 time;
+    float magnitude;
+};
+
+// The whole catalog uploaded once as a static per-instance buffer. The
+// shader (quake.vert) picks positions for the current Earth shape, maps
+// magnitude to size and alpha, fades quakes with age and hides the ones
+// outside the time window or the selection (one byte per row in a second
+// buffer), so a frame only sets a few uniforms and draws the cursor's row
+// range. Requires instancing.
+class QuakeBuffer {
+public:
+    QuakeBuffer(): engine(NULL), db(NULL), selection(NULL), instanceBuffer(0), selectionBuffer(0), capacity(0) {}
+    void initialize(Engine *engine, const EarthquakeDatabase *db, Earth &earth);
+    // Re-uploads rows from firstRow on after rows were inserted into the
+    // database (see EarthquakeDatabase::insertRows)
+    void update(Earth &earth, int firstRow);
+    // Hides the rows selection does not contain (NULL shows them all);
+    // update() re-uploads the inserted rows' flags from it too
+    void setSelection(const QuakeSelection *s);
+    // Draws rows [start, end] as they look at currentTime, on an Earth
+    // blended between rectangle (0) and sphere (1) by spherical
+    void draw(int start, int end, double currentTime, float spherical, vec3 lightColor);
+protected:
+    Engine *engine;
+    const EarthquakeDatabase *db;
+    const QuakeSelection *selection;
+    ShaderProgram program;
+    SphereMesh sphere;
+    VertexBuffer instanceBuffer, selectionBuffer;
+    // Rows the buffer has room for
+    int capacity;
+    double origin;
+    float magScale;
+
+    void setMagnitudeScale();
+    void fillRows(Earth &earth, int first, int last, QuakeVertex *out) const;
+    void uploadSelection(int firstRow);
+};
+
+// Definitions below
+
+inline void QuakeBuffer::initialize(Engine *e, const EarthquakeDatabase *database, Earth &earth) {
+    engine = e;
+    db = database;
+    program = ShaderProgram(Config::quakeVert, Config::markerFrag);
+    sphere.initialize(engine, 16, 12);
+    origin = db->getMaxIndex() >= 0 ? db->getSeconds(0) : 0;
+    update(earth, 0);
+}
+
+inline void QuakeBuffer::setMagnitudeScale() {
+    // Same magnitude scaling the per-marker path uses
+    float diff = db->getMaxMag() - db->getMinMag();
+    magScale = diff > 0 ? 1 / diff : 0;
+}
+
+inline void QuakeBuffer::fillRows(Earth &earth, int first, int last, QuakeVertex *out) const {
+    for (int i = first; i < last; i++) {
+        float lat = db->getLatitude(i), lon = db->getLongitude(i);
+        double t = db->getSeconds(i) - origin;
+        QuakeVertex &v = out[i - first];
+        v.spherePosition = earth.getSphericalPosition(lat, lon);
+        v.rectPosition = earth.getRectangularPosition(lat, lon);
+        v.time = vec2((float)t, (float)(t - (float)t));
+        v.magnitude = db->getMagnitude(i);
+    }
+}
+
+inline void QuakeBuffer::update(Earth &earth, int firstRow) {
+    setMagnitudeScale();
+    int nRows = db->getMaxIndex() + 1;
+    if (nRows > capacity) {
+        // Grow with room to spare so a followed catalog rarely reallocates,
+        // and upload everything into the new buffer
+        if (instanceBuffer != 0) {
+            glDeleteBuffers(1, &instanceBuffer);
+            glDeleteBuffers(1, &selectionBuffer);
+        }
+        capacity = capacity == 0 ? nRows : std::max(nRows, capacity + capacity / 2);
+        instanceBuffer = engine->allocateVertexBuffer(capacity * sizeof(QuakeVertex));
+        selectionBuffer = engine->allocateVertexBuffer(capacity);
+        firstRow = 0;
+    }
+    if (firstRow >= nRows)
+        return;
+    std::vector<QuakeVertex> rows(nRows - firstRow);
+    fillRows(earth, firstRow, nRows, &rows[0]);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, firstRow * sizeof(QuakeVertex), rows.size() * sizeof(QuakeVertex), &rows[0]);
+    uploadSelection(firstRow);
+}
+
+inline void QuakeBuffer::setSelection(const QuakeSelection *s) {
+    selection = s;
+    uploadSelection(0);
+}
+
+inline void QuakeBuffer::uploadSelection(int firstRow) {
+    int nRows = db != NULL ? db->getMaxIndex() + 1 : 0;
+    if (selectionBuffer == 0 || firstRow >= nRows)
+        return;
+    std::vector<GLubyte> flags(nRows - firstRow, 1);
+    if (selection != NULL) {
+        for (int i = firstRow; i < nRows; i++)
+            flags[i - firstRow] = selection->contains(i);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, selectionBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, firstRow, flags.size(), &flags[0]);
+    Engine::die_if_opengl_error();
+}
+
+inline void QuakeBuffer::draw(int start, int end, double currentTime, float spherical, vec3 lightColor) {
+    if (instanceBuffer == 0 || end < start)
+        return;
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_COLOR_ARRAY);
+
+    double t = currentTime - origin;
+    program.enable();
+    program.setUniform("ambient", 0.2f);
+    program.setUniform("lightColor", lightColor);
+    program.setUniform("currentTime", vec2((float)t, (float)(t - (float)t)));
+    program.setUniform("timeWindow", Config::timeWindow);
+    program.setUniform("magScale", magScale);
+    program.setUniform("spherical", spherical);
+    program.setAttribute("vertex", sphere.vertices, 3, GL_FLOAT);
+    // Start the per-instance attributes at row start instead of using a
+    // base instance, which needs GL 4.2
+    int stride = sizeof(QuakeVertex), base = start * stride;
+    program.setAttribute("spherePosition", instanceBuffer, 3, GL_FLOAT, stride,
+                         base + offsetof(QuakeVertex, spherePosition), 1);
+    program.setAttribute("rectPosition", instanceBuffer, 3, GL_FLOAT, stride,
+                         base + offsetof(QuakeVertex, rectPosition), 1);
+    program.setAttribute("time", instanceBuffer, 2, GL_FLOAT, stride,
+                         base + offsetof(QuakeVertex, time), 1);
+    program.setAttribute("magnitude", instanceBuffer, 1, GL_FLOAT, stride,
+                         base + offsetof(QuakeVertex, magnitude), 1);
+    program.setAttribute("selected", selectionBuffer, 1, GL_UNSIGNED_BYTE, 0, start, 1);
+    drawElementsInstanced(GL_TRIANGLES, sphere.indices, sphere.nIndices, end - start + 1);
+    program.unsetAttribute("spherePosition");
+    program.unsetAttribute("rectPosition");
+    program.unsetAttribute("time");
+    program.unsetAttribute("magnitude");
+    program.unsetAttribute("selected");
+    program.unsetAttribute("vertex");
+    program.disable();
+}
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef QUAKEINDEX_HPP
+#define QUAKEINDEX_HPP
+
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include "quake.hpp"
+
+// Spatio-temporal index over an EarthquakeDatabase for regional queries.
+// The globe is divided into latitude bands of equal height, and each band
+// into longitude cells whose count shrinks with cos(latitude), so all
+// cells cover roughly the same area. Each cell stores its rows in time
+// order, so a query only visits the cells it overlaps and binary searches
+// each one for the time range.
+class QuakeSpatialIndex {
+public:
+    QuakeSpatialIndex(): db(NULL), cellDegrees(0), nBands(0), nRows(0) {}
+    // Indexes every row of db with cells about cellDegrees on a side
+    void build(const EarthquakeDatabase *db, float cellDegrees = 2);
+    // Re-indexes the rows from first on after rows were inserted into the
+    // database (see EarthquakeDatabase::insertRows); rows before first
+    // keep their cells
+    void update(int first);
+    // Appends to out the rows with latitude in [latMin, latMax], longitude
+    // in [lonMin, lonMax] and time in [t0, t1]. If lonMin > lonMax the box
+    // crosses the antimeridian. Rows come out grouped by cell, and in time
+    // order within each cell.
+    void queryBox(float latMin, float latMax, float lonMin, float lonMax,
+                  double t0, double t1, std::vector<int> &out) const;
+    // Appends to out the rows within radiusKm (great-circle distance) of
+    // the given point with time in [t0, t1]
+    void queryRadius(float latitude, float longitude, float radiusKm,
+                     double t0, double t1, std::vector<int> &out) const;
+    int getCellCount() const { return cells.size(); }
+protected:
+    // Rows of a cell in index (and so time) order, and their times
+    // alongside for the binary search
+    struct Cell {
+        std::vector<int> rows;
+        std::vector<double> times;
+    };
+
+    const EarthquakeDatabase *db;
+    float cellDegrees;
+    int nBands;
+    // Number of longitude cells in each band, and the index of its first cell
+    std::vector<int> bandCells, bandFirstCell;
+    std::vector<Cell> cells;
+    // Rows indexed so far
+    int nRows;
+
+    int bandOf(float latitude) const;
+    int cellInBand(int band, float longitude) const;
+    // Visits the rows of cells [firstCell, lastCell] of a band that fall in
+    // [t0, t1]; rows are tested against the box unless the cell lies inside it
+    void queryBandCells(int band, int firstCell, int lastCell,
+                        float latMin, float latMax, float lonMin, float lonMax,
+                        double t0, double t1, std::vector<int> &out) const;
+};
+
+static const float EARTH_RADIUS_KM = 6371.0f;
+
+// Great-circle distance in km between two points given in degrees
+float greatCircleKm(float lat1, float lon1, float lat2, float lon2);
+
+// Definitions below
+
+inline float greatCircleKm(float lat1, float lon1, float lat2, float lon2) {
+    double toRad = M_PI / 180;
+    double dLat = (lat2 - lat1) * toRad, dLon = (lon2 - lon1) * toRad;
+    double a = sin(dLat / 2) * sin(dLat / 2)
+        + cos(lat1 * toRad) * cos(lat2 * toRad) * sin(dLon / 2) * sin(dLon / 2);
+    return 2 * EARTH_RADIUS_KM * asin(std::min(1.0, sqrt(a)));
+}
+
+inline int QuakeSpatialIndex::bandOf(float latitude) const {
+    int band = (int)floor((latitude + 90) / cellDegrees);
+    return std::min(std::max(band, 0), nBands - 1);
+}
+
+inline int QuakeSpatialIndex::cellInBand(int band, float longitude) const {
+    int cell = (int)floor((longitude + 180) / 360 * bandCells[band]);
+    return std::min(std::max(cell, 0), bandCells[band] - 1);
+}
+
+inline void QuakeSpatialIndex::build(const EarthquakeDatabase *database, float degrees) {
+    db = database;
+    cellDegrees = degrees;
+    nBands = (int)ceil(180 / cellDegrees);
+    bandCells.resize(nBands);
+    bandFirstCell.resize(nBands);
+    int nCells = 0;
+    for (int b = 0; b < nBands; b++) {
+        float centre = -90 + (b + 0.5f) * cellDegrees;
+        int n = (int)floor(360 / cellDegrees * cos(centre * M_PI / 180) + 0.5);
+        bandCells[b] = std::max(n, 1);
+        bandFirstCell[b] = nCells;
+        nCells += bandCells[b];
+    }
+
+    cells.assign(nCells, Cell());
+    nRows = 0;
+    update(0);
+}
+
+inline void QuakeSpatialIndex::update(int first) {
+    if (db == NULL)
+        return;
+    // Rows are in time order, so the rows from first on are at the back
+    // of every cell; an append leaves all cells as they are
+    if (first < nRows) {
+        for (size_t c = 0; c < cells.size(); c++) {
+            Cell &cell = cells[c];
+            size_t keep = std::lower_bound(cell.rows.begin(), cell.rows.end(), first) - cell.rows.begin();
+            cell.rows.resize(keep);
+            cell.times.resize(keep);
+        }
+    }
+    nRows = db->getMaxIndex() + 1;
+    for (int i = first; i < nRows; i++) {
+        int band = bandOf(db->getLatitude(i));
+        Cell &cell = cells[bandFirstCell[band] + cellInBand(band, db->getLongitude(i))];
+        cell.rows.push_back(i);
+        cell.times.push_back(db->getSeconds(i));
+    }
+}
+
+inline void QuakeSpatialIndex::queryBandCells(int band, int firstCell, int lastCell,
+                                              float latMin, float latMax, float lonMin, float lonMax,
+                                              double t0, double t1, std::vector<int> &out) const {
+    float bandLatMin = -90 + band * cellDegrees, bandLatMax = bandLatMin + cellDegrees;
+    bool bandInside = bandLatMin >= latMin && bandLatMax <= latMax;
+    float cellWidth = 360.0f / bandCells[band];
+    for (int k = firstCell; k <= lastCell; k++) {
+        const Cell &cell = cells[bandFirstCell[band] + k];
+        if (cell.rows.empty())
+            continue;
+        const double *times = &cell.times[0];
+        int first = std::lower_bound(times, times + cell.times.size(), t0) - times;
+        int last = std::upper_bound(times + first, times + cell.times.size(), t1) - times;
+        float cellLonMin = -180 + k * cellWidth, cellLonMax = cellLonMin + cellWidth;
+        if (bandInside && cellLonMin >= lonMin && cellLonMax <= lonMax) {
+            out.insert(out.end(), cell.rows.begin() + first, cell.rows.begin() + last);
+            continue;
+        }
+        for (int j = first; j < last; j++) {
+            int row = cell.rows[j];
+            float lat = db->getLatitude(row), lon = db->getLongitude(row);
+            if (lat >= latMin && lat <= latMax && lon >= lonMin && lon <= lonMax)
+                out.push_back(row);
+        }
+    }
+}
+
+inline void QuakeSpatialIndex::queryBox(float latMin, float latMax, float lonMin, float lonMax,
+                                        double t0, double t1, std::vector<int> &out) const {
+    if (db == NULL || nRows == 0 || latMax < latMin || t1 < t0)
+        return;
+    if (lonMin > lonMax) {
+        // Split a box crossing the antimeridian into two
+        queryBox(latMin, latMax, lonMin, 180, t0, t1, out);
+        queryBox(latMin, latMax, -180, lonMax, t0, t1, out);
+        return;
+    }
+    for (int b = bandOf(latMin); b <= bandOf(latMax); b++)
+        queryBandCells(b, cellInBand(b, lonMin), cellInBand(b, lonMax),
+                       latMin, latMax, lonMin, lonMax, t0, t1, out);
+}
+
+inline void QuakeSpatialIndex::queryRadius(float latitude, float longitude, float radiusKm,
+                                           double t0, double t1, std::vector<int> &out) const {
+    if (db == NULL)
+        return;
+    // Bounding box of the circle, then an exact distance test
+    float angle = radiusKm / EARTH_RADIUS_KM;
+    float dLat = angle * 180 / M_PI;
+    float latMin = latitude - dLat, latMax = latitude + dLat;
+    float lonMin = -180, lonMax = 180;
+    if (latMin > -90 && latMax < 90 && angle < M_PI / 2) {
+        float dLon = asin(sin(angle) / cos(latitude * M_PI / 180)) * 180 / M_PI;
+        lonMin = longitude - dLon;
+        lonMax = longitude + dLon;
+        if (lonMin < -180)
+            lonMin += 360;
+        if (lonMax > 180)
+            lonMax -= 360;
+    }
+    std::vector<int> candidates;
+    queryBox(std::max(latMin, -90.0f), std::min(latMax, 90.0f), lonMin, lonMax, t0, t1, candidates);
+    for (size_t i = 0; i < candidates.size(); i++) {
+        int row = candidates[i];
+        if (greatCircleKm(latitude, longitude, db->getLatitude(row), db->getLongitude(row)) <= radiusKm)
+            out.push_back(row);
+    }
+}
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef QUAKESTATS_HPP
+#define QUAKESTATS_HPP
+
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include "config.hpp"
+#include "filter.hpp"
+#include "quake.hpp"
+
+// Totals over the quakes of a time range
+struct QuakeSummary {
+    // Magnitude bins [0, 1), [1, 2), ..., [9, inf); smaller magnitudes
+    // count in the first bin
+    static const int nBins = 10;
+    int count;
+    // Radiated energy in joules (see seismicEnergy)
+    double energy;
+    // Largest magnitude, or lowest float when count is 0
+    float maxMagnitude;
+    int histogram[nBins];
+    static int binOf(float magnitude);
+};
+
+// Per-bucket aggregates over an EarthquakeDatabase for statistics of
+// arbitrary time ranges. Time is split into fixed buckets (a day by
+// default) and the counts, energy and magnitude histogram are stored as
+// prefix sums over the buckets, with a sparse table for the maximum
+// magnitude. A range then costs O(bins) for the whole buckets it covers,
+// plus a scan of the rows in the partial buckets at its two ends.
+class QuakeStatistics {
+public:
+    QuakeStatistics(): db(NULL), selection(NULL), origin(0), bucketSeconds(0), nBuckets(0) {}
+    void build(const EarthquakeDatabase *db, double bucketSeconds = Config::statsBucketSeconds);
+    // Counts only the rows selection contains (NULL counts them all),
+    // recomputing every bucket
+    void setSelection(const QuakeSelection *s);
+    // Refreshes the buckets from the one holding firstRow on, after
+    // EarthquakeDatabase::insertRows returned firstRow
+    void update(int firstRow);
+    // Quakes with time in [t0, t1]
+    QuakeSummary query(double t0, double t1) const;
+    // Quakes in rows [first, last), e.g. a TimeWindowCursor's rows
+    QuakeSummary summarize(int first, int last) const;
+    int getBucketCount() const { return nBuckets; }
+protected:
+    const EarthquakeDatabase *db;
+    const QuakeSelection *selection;
+    double origin, bucketSeconds;
+    int nBuckets;
+    // Prefix sums: entry b covers buckets [0, b). Rows are in time order,
+    // so the prefix row count of bucket b is also its first row;
+    // bucketCounts only counts the selected rows.
+    std::vector<int> bucketRows, bucketCounts;
+    std::vector<double> bucketEnergy;
+    // nBins entries per bucket boundary
+    std::vector<int> bucketBins;
+    // maxTable[k][b] is the largest magnitude in buckets [b, b + 2^k)
+    std::vector<std::vector<float> > maxTable;
+
+    int bucketOf(double seconds) const;
+    // Recomputes every table from bucket b on
+    void accumulate(int b);
+    // Adds rows [first, last) to s one by one
+    void addRows(int first, int last, QuakeSummary &s) const;
+};
+
+// Definitions below
+
+inline int QuakeSummary::binOf(float magnitude) {
+    return std::min(std::max((int)floor(magnitude), 0), nBins - 1);
+}
+
+inline int QuakeStatistics::bucketOf(double seconds) const {
+    int b = (int)floor((seconds - origin) / bucketSeconds);
+    return std::min(std::max(b, 0), nBuckets - 1);
+}
+
+inline void QuakeStatistics::build(const EarthquakeDatabase *database, double seconds) {
+    db = database;
+    bucketSeconds = seconds;
+    nBuckets = 0;
+    bucketRows.assign(1, 0);
+    bucketCounts.assign(1, 0);
+    bucketEnergy.assign(1, 0);
+    bucketBins.assign(QuakeSummary::nBins, 0);
+    // Every row, including those before getMinIndex()
+    if (db->getMaxIndex() < 0)
+        return;
+    origin = floor(db->getSeconds(0) / bucketSeconds) * bucketSeconds;
+    accumulate(0);
+}
+
+inline void QuakeStatistics::setSelection(const QuakeSelection *s) {
+    selection = s;
+    if (db != NULL)
+        build(db, bucketSeconds);
+}
+
+inline void QuakeStatistics::update(int firstRow) {
+    if (db == NULL || firstRow > db->getMaxIndex())
+        return;
+    // Rows before firstRow are unchanged, so so are the buckets before
+    // the one it falls in; a row before the first bucket moves the origin
+    double t = db->getSeconds(firstRow);
+    if (nBuckets == 0 || t < origin) {
+        build(db, bucketSeconds);
+        return;
+    }
+    accumulate(bucketOf(t));
+}
+
+inline void QuakeStatistics::accumulate(int b) {
+    const int nBins = QuakeSummary::nBins;
+    int nRows = db->getMaxIndex() + 1;
+    nBuckets = (int)floor((db->getSeconds(nRows - 1) - origin) / bucketSeconds) + 1;
+    bucketRows.resize(nBuckets + 1);
+    bucketCounts.resize(nBuckets + 1);
+    bucketEnergy.resize(nBuckets + 1);
+    bucketBins.resize((nBuckets + 1) * nBins);
+    std::vector<float> bucketMax(nBuckets - b, std::numeric_limits<float>::lowest());
+
+    // One pass over the rows from bucket b on, carrying the running sums
+    int row = bucketRows[b];
+    int count = bucketCounts[b];
+    double energy = bucketEnergy[b];
+    int bins[nBins];
+    std::copy(&bucketBins[b * nBins], &bucketBins[b * nBins] + nBins, bins);
+    for (int k = b; k < nBuckets; k++) {
+        double end = origin + (k + 1) * bucketSeconds;
+        for (; row < nRows && (db->getSeconds(row) < end || k == nBuckets - 1); row++) {
+            if (selection != NULL && !selection->contains(row))
+                continue;
+            float m = db->getMagnitude(row);
+            count++;
+            energy += seismicEnergy(m);
+            bins[QuakeSummary::binOf(m)]++;
+            bucketMax[k - b] = std::max(bucketMax[k - b], m);
+        }
+        bucketRows[k + 1] = row;
+        bucketCounts[k + 1] = count;
+        bucketEnergy[k + 1] = energy;
+        std::copy(bins, bins + nBins, &bucketBins[(k + 1) * nBins]);
+    }
+
+    // Each level doubles the span of the one below; only entries whose
+    // span reaches bucket b change
+    int nLevels = 1;
+    while ((1 << nLevels) <= nBuckets)
+        nLevels++;
+    maxTable.resize(nLevels);
+    maxTable[0].resize(nBuckets);
+    std::copy(bucketMax.begin(), bucketMax.end(), maxTable[0].begin() + b);
+    for (int level = 1; level < nLevels; level++) {
+        int half = 1 << (level - 1);
+        int n = nBuckets - (1 << level) + 1;
+        maxTable[level].resize(n);
+        for (int i = std::max(b - (1 << level) + 1, 0); i < n; i++)
+            maxTable[level][i] = std::max(maxTable[level - 1][i], maxTable[level - 1][i + half]);
+    }
+}
+
+inline void QuakeStatistics::addRows(int first, int last, QuakeSummary &s) const {
+    for (int i = first; i < last; i++) {
+        if (selection != NULL && !selection->contains(i))
+            continue;
+        float m = db->getMagnitude(i);
+        s.count++;
+        s.energy += seismicEnergy(m);
+        s.histogram[QuakeSummary::binOf(m)]++;
+        s.maxMagnitude = std::max(s.maxMagnitude, m);
+    }
+}
+
+inline QuakeSummary QuakeStatistics::query(double t0, double t1) const {
+    if (nBuckets == 0 || t1 < t0)
+        return summarize(0, 0);
+    // Each end is found among its own bucket's rows, which summarize
+    // walks through anyway
+    int b0 = bucketOf(t0), b1 = bucketOf(t1);
+    int first = bucketRows[b0], last = bucketRows[b1];
+    while (first < bucketRows[b0 + 1] && db->getSeconds(first) < t0)
+        first++;
+    while (last < bucketRows[b1 + 1] && db->getSeconds(last) <= t1)
+        last++;
+    return summarize(first, last);
+}
+
+inline QuakeSummary QuakeStatistics::summarize(int first, int last) const {
+    QuakeSummary s;
+    s.count = 0;
+    s.energy = 0;
+    s.maxMagnitude = std::numeric_limits<float>::lowest();
+    std::fill(s.histogram, s.histogram + QuakeSummary::nBins, 0);
+    if (last <= first || nBuckets == 0)
+        return s;
+    int b0 = bucketOf(db->getSeconds(first)), b1 = bucketOf(db->getSeconds(last - 1));
+    if (b1 - b0 < 2) {
+        addRows(first, last, s);
+        return s;
+    }
+    // Partial buckets at the ends row by row, whole buckets b0+1..b1-1
+    // from the prefix sums
+    addRows(first, bucketRows[b0 + 1], s);
+    addRows(bucketRows[b1], last, s);
+    int lo = b0 + 1, hi = b1;
+    s.count += bucketCounts[hi] - bucketCounts[lo];
+    s.energy += bucketEnergy[hi] - bucketEnergy[lo];
+    for (int i = 0; i < QuakeSummary::nBins; i++)
+        s.histogram[i] += bucketBins[hi * QuakeSummary::nBins + i] - bucketBins[lo * QuakeSummary::nBins + i];
+    int level = 0;
+    while ((2 << level) <= hi - lo)
+        level++;
+    s.maxMagnitude = std::max(s.maxMagnitude, std::max(maxTable[level][lo], maxTable[level][hi - (1 << level)]));
+    return s;
+}
+
+#endif
@@ -0,0 +1,217 @@
+#ifndef SHADER_HPP
+#define SHADER_HPP
+
+#include "engine.hpp"
+#include <fstream>
+#include <sstream>
+#include <glm/glm.hpp>
+using glm::vec2;
+using glm::vec3;
+using glm::vec4;
+using glm::mat4;
+
+// GLSL program for the OpenGL 2.1 context created by Engine. Shaders can
+// use the fixed-function matrices (gl_ModelViewMatrix etc.), so they work
+// with OrbitCamera::apply() like the rest of the drawing code.
+class ShaderProgram {
+public:
+    ShaderProgram(): vertexShader(0), fragmentShader(0), program(0) {}
+    ShaderProgram(std::string vertFile, std::string fragFile);
+    bool isLoaded() const { return program != 0; }
+    // Binds a vertex attribute to a buffer. stride and offset are in bytes
+    // (stride 0 means tightly packed). A divisor of 1 advances the attribute
+    // once per instance instead of once per vertex.
+    void setAttribute(std::string name, VertexBuffer buffer, int dim, GLenum type,
+                      int stride = 0, int offset = 0, int divisor = 0);
+    void unsetAttribute(std::string name);
+    GLint getAttributeLocation(std::string name);
+    void setUniform(std::string name, int i);
+    void setUniform(std::string name, float f);
+    void setUniform(std::string name, vec2 v);
+    void setUniform(std::string name, vec3 v);
+    void setUniform(std::string name, vec4 v);
+    void setUniform(std::string name, mat4 m);
+    void setTexture(std::string name, Texture tex, int texUnit);
+    void enable();
+    void disable();
+protected:
+    GLuint vertexShader, fragmentShader;
+    GLuint program;
+    GLuint loadShader(GLenum type, std::string filename);
+};
+
+// Whether the context can draw instanced geometry with per-instance
+// attributes (OpenGL 3.3, or the ARB extensions on older contexts)
+bool instancingSupported();
+void vertexAttribDivisor(GLuint index, GLuint divisor);
+void drawElementsInstanced(GLenum mode, ElementBuffer buffer, int count, int instances);
+
+// Definitions below
+
+inline ShaderProgram::ShaderProgram(std::string vertFile, std::string fragFile) {
+    vertexShader = loadShader(GL_VERTEX_SHADER, vertFile);
+    fragmentShader = loadShader(GL_FRAGMENT_SHADER, fragFile);
+    program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    glLinkProgram(program);
+    GLint status;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+        char infolog[512];
+        glGetProgramInfoLog(program, 512, NULL, infolog);
+        Engine::errorMessage(std::string("Linking of shader program failed:\n") + infolog);
+        exit(EXIT_FAILURE);
+    }
+    Engine::die_if_opengl_error();
+}
+
+inline GLuint ShaderProgram::loadShader(GLenum type, std::string filename) {
+    std::fstream file(filename, std::ios::in);
+    if (!file) {
+        Engine::errorMessage("Failed to load file " + filename);
+        exit(EXIT_FAILURE);
+    }
+    std::stringstream sstr;
+    sstr << file.rdbuf();
+    std::string str = sstr.str();
+    const char* source = str.c_str();
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    GLint status;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (status != GL_TRUE) {
+        char infolog[512];
+        glGetShaderInfoLog(shader, 512, NULL, infolog);
+        Engine::errorMessage("Compilation of shader " + filename + " failed:\n" + infolog);
+        exit(EXIT_FAILURE);
+    }
+    Engine::die_if_opengl_error();
+    return shader;
+}
+
+inline GLint ShaderProgram::getAttributeLocation(std::string name) {
+    return glGetAttribLocation(program, name.c_str());
+}
+
+inline void ShaderProgram::setAttribute(std::string name, VertexBuffer buffer, int dim, GLenum type,
+                                        int stride, int offset, int divisor) {
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    GLint attrib = glGetAttribLocation(program, name.c_str());
+    if (attrib != -1) {
+        glVertexAttribPointer(attrib, dim, type, GL_FALSE, stride, (const GLvoid*)(size_t)offset);
+        glEnableVertexAttribArray(attrib);
+        if (instancingSupported())
+            vertexAttribDivisor(attrib, divisor);
+    }
+    Engine::die_if_opengl_error();
+}
+
+inline void ShaderProgram::unsetAttribute(std::string name) {
+    GLint attrib = glGetAttribLocation(program, name.c_str());
+    if (attrib != -1) {
+        if (instancingSupported())
+            vertexAttribDivisor(attrib, 0);
+        glDisableVertexAttribArray(attrib);
+    }
+    Engine::die_if_opengl_error();
+}
+
+inline void ShaderProgram::setUniform(std::string name, int i) {
+    GLint uniform = glGetUniformLocation(program, name.c_str());
+    glUniform1i(uniform, i);
+    Engine::die_if_opengl_error();
+}
+
+inline void ShaderProgram::setUniform(std::string name, float f) {
+    GLint uniform = glGetUniformLocation(program, name.c_str());
+    glUniform1f(uniform, f);
+    Engine::die_if_opengl_error();
+}
+
+inline void ShaderProgram::setUniform(std::string name, vec2 v) {
+    GLint uniform = glGetUniformLocation(program, name.c_str());
+    glUniform2f(uniform, v[0], v[1]);
+    Engine::die_if_opengl_error();
+}
+
+inline void ShaderProgram::setUniform(std::string name, vec3 v) {
+    GLint uniform = glGetUniformLocation(program, name.c_str());
+    glUniform3f(uniform, v[0], v[1], v[2]);
+    Engine::die_if_opengl_error();
+}
+
+inline void ShaderProgram::setUniform(std::string name, vec4 v) {
+    GLint uniform = glGetUniformLocation(program, name.c_str());
+    glUniform4f(uniform, v[0], v[1], v[2], v[3]);
+    Engine::die_if_opengl_error();
+}
+
+inline void ShaderProgram::setUniform(std::string name, mat4 m) {
+    GLint uniform = glGetUniformLocation(program, name.c_str());
+    glUniformMatrix4fv(uniform, 1, GL_FALSE, &m[0][0]);
+    Engine::die_if_opengl_error();
+}
+
+inline void ShaderProgram::setTexture(std::string name, Texture tex, int texUnit) {
+    glActiveTexture(GL_TEXTURE0 + texUnit);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    GLint uniform = glGetUniformLocation(program, name.c_str());
+    glUniform1i(uniform, texUnit);
+    glActiveTexture(GL_TEXTURE0);
+    Engine::die_if_opengl_error();
+}
+
+inline void ShaderProgram::enable() {
+    glUseProgram(program);
+    Engine::die_if_opengl_error();
+}
+
+inline void ShaderProgram::disable() {
+    glUseProgram(0);
+    Engine::die_if_opengl_error();
+}
+
+#ifdef __APPLE__
+
+// The legacy macOS context always has the ARB instancing extensions
+inline bool instancingSupported() {
+    return true;
+}
+
+inline void vertexAttribDivisor(GLuint index, GLuint divisor) {
+    glVertexAttribDivisorARB(index, divisor);
+}
+
+inline void drawElementsInstanced(GLenum mode, ElementBuffer buffer, int count, int instances) {
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+    glDrawElementsInstancedARB(mode, count, GL_UNSIGNED_INT, 0, instances);
+    Engine::die_if_opengl_error();
+}
+
+#else
+
+inline bool instancingSupported() {
+    return GLEW_VERSION_3_3 || (GLEW_ARB_instanced_arrays && GLEW_ARB_draw_instanced);
+}
+
+inline void vertexAttribDivisor(GLuint index, GLuint divisor) {
+    if (GLEW_VERSION_3_3)
+        glVertexAttribDivisor(index, divisor);
+    else
+        glVertexAttribDivisorARB(index, divisor);
+}
+
+inline void drawElementsInstanced(GLenum mode, ElementBuffer buffer, int count, int instances) {
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+    if (GLEW_VERSION_3_3)
+        glDrawElementsInstanced(mode, count, GL_UNSIGNED_INT, 0, instances);
+    else
+        glDrawElementsInstancedARB(mode, count, GL_UNSIGNED_INT, 0, instances);
+    Engine::die_if_opengl_error();
+}
+
+#endif
+
+#endif
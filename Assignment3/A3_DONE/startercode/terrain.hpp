@@ -0,0 +1,256 @@
+#ifndef TERRAIN_HPP
+#define TERRAIN_HPP
+
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "config.hpp"
+#include "engine.hpp"
+#include "heightmap.hpp"
+#include "parallel.hpp"
+#include "terrainmesh.hpp"
+#include <glm/glm.hpp>
+using glm::vec3;
+
+// Globe displaced by a height map, drawn as a quadtree of chunks whose
+// level of detail follows the camera. A chunk is split when its
+// geometric error would cover more than Config::terrainPixelError pixels
+// on screen; chunks beyond the horizon are skipped. Missing chunks are
+// built on worker threads and drawn once uploaded, with their parent
+// standing in until then. Uploaded chunks stay cached until the cache
+// exceeds Config::terrainBudgetBytes, when the least recently used ones
+// are freed.
+class Terrain {
+public:
+    Terrain(): engine(NULL), texture(0), overlayTexture(0), indexBuffer(0), nIndices(0), maxLevel(0),
+               residentBytes(0), frame(0) {}
+    ~Terrain();
+    // Loads the finest of the height maps (listed finest first) whose
+    // chunks at full detail all fit in Config::terrainBudgetBytes, or else
+    // the coarsest, and builds the root chunks; returns false if no height
+    // map could be loaded
+    bool initialize(Engine *engine, Texture texture, const std::vector<std::string> &heightFiles);
+    // Draws the terrain as seen from eye (in world coordinates) with the
+    // given vertical field of view and viewport height
+    void draw(vec3 eye, float fovDegrees, int viewportHeight);
+    // RGBA texture laid out like the Earth texture and blended over it
+    // by its alpha, or 0 for none
+    void setOverlay(Texture overlay) { overlayTexture = overlay; }
+    int getResidentCount() const { return chunks.size(); }
+    size_t getResidentBytes() const { return residentBytes; }
+    int getDrawnCount() const { return visible.size(); }
+protected:
+    struct Chunk {
+        VertexBuffer positions, normals, texCoords;
+        size_t bytes;
+        int lastUsed;
+    };
+
+    Engine *engine;
+    Texture texture, overlayTexture;
+    HeightMap heights;
+    TerrainShape shape;
+    ChunkBuilder builder;
+    ElementBuffer indexBuffer;
+    int nIndices;
+    int maxLevel;
+    std::unordered_map<uint64_t, Chunk> chunks;
+    size_t residentBytes;
+    int frame;
+    // Chunks chosen for this frame, and missing chunks it would have used
+    std::vector<ChunkKey> visible, wanted;
+
+    void upload(const ChunkMesh &mesh);
+    // Walks the quadtree below key and fills visible and wanted
+    void select(ChunkKey key, vec3 eye, float pixelsPerUnit);
+    bool isResident(ChunkKey key) const { return chunks.count(key.id()) > 0; }
+    // Frees least recently used chunks until within the budget
+    void evict();
+};
+
+// Definitions below
+
+inline Terrain::~Terrain() {
+    builder.stop();
+    for (std::unordered_map<uint64_t, Chunk>::iterator c = chunks.begin(); c != chunks.end(); ++c) {
+        GLuint buffers[3] = {c->second.positions, c->second.normals, c->second.texCoords};
+        glDeleteBuffers(3, buffers);
+    }
+    if (indexBuffer != 0)
+        glDeleteBuffers(1, &indexBuffer);
+}
+
+inline bool Terrain::initialize(Engine *e, Texture tex, const std::vector<std::string> &heightFiles) {
+    engine = e;
+    texture = tex;
+    shape.heights = &heights;
+    shape.seaLevel = Config::terrainSeaLevel;
+    shape.heightScale = Config::terrainHeight;
+    shape.resolution = Config::terrainResolution;
+    bool loaded = false;
+    for (size_t f = 0; f < heightFiles.size(); f++) {
+        if (!heights.load(heightFiles[f]))
+            continue;
+        loaded = true;
+        // No point splitting past one grid step per height map texel
+        float texelDegrees = std::min(360.0f / heights.getWidth(), 180.0f / heights.getHeight());
+        maxLevel = 0;
+        while (180.0f / (1 << maxLevel) / shape.resolution > texelDegrees)
+            maxLevel++;
+        // Every chunk has as many vertices; the two roots have 4^level
+        // descendants at each level
+        ChunkKey root = {0, 0, 0};
+        ChunkMesh mesh;
+        buildChunkMesh(shape, root, mesh);
+        size_t fullDetail = ((size_t)2 << 2*maxLevel) * mesh.positions.size() * (2 * sizeof(vec3) + sizeof(vec2));
+        if (fullDetail <= Config::terrainBudgetBytes)
+            break;
+    }
+    if (!loaded)
+        return false;
+
+    std::vector<int> indices = chunkIndices(shape.resolution);
+    nIndices = indices.size();
+    indexBuffer = engine->allocateElementBuffer(indices.size() * sizeof(int));
+    engine->copyElementData(indexBuffer, &indices[0], indices.size() * sizeof(int));
+
+    // The two roots are always resident, so there is always something to draw
+    for (int x = 0; x < 2; x++) {
+        ChunkKey root = {0, x, 0};
+        ChunkMesh mesh;
+        buildChunkMesh(shape, root, mesh);
+        upload(mesh);
+    }
+    // Leave a core for the render thread
+    builder.start(&shape, std::max(Parallel::defaultThreads() - 1, 1));
+    return true;
+}
+
+inline void Terrain::upload(const ChunkMesh &mesh) {
+    if (isResident(mesh.key))
+        return;
+    Chunk c;
+    int n = mesh.positions.size();
+    c.positions = engine->allocateVertexBuffer(n * sizeof(vec3));
+    engine->copyVertexData(c.positions, (void*)&mesh.positions[0], n * sizeof(vec3));
+    c.normals = engine->allocateVertexBuffer(n * sizeof(vec3));
+    engine->copyVertexData(c.normals, (void*)&mesh.normals[0], n * sizeof(vec3));
+    c.texCoords = engine->allocateVertexBuffer(n * sizeof(vec2));
+    engine->copyVertexData(c.texCoords, (void*)&mesh.texCoords[0], n * sizeof(vec2));
+    c.bytes = n * (2 * sizeof(vec3) + sizeof(vec2));
+    c.lastUsed = frame;
+    chunks[mesh.key.id()] = c;
+    residentBytes += c.bytes;
+}
+
+inline void Terrain::select(ChunkKey key, vec3 eye, float pixelsPerUnit) {
+    std::unordered_map<uint64_t, Chunk>::iterator found = chunks.find(key.id());
+    if (found != chunks.end())
+        found->second.lastUsed = frame;
+    vec3 centre;
+    float radius;
+    shape.bounds(key, centre, radius);
+
+    // Skip chunks entirely behind the horizon seen from eye
+    float eyeDistance = glm::length(eye);
+    float horizon = acos(std::min(1 / eyeDistance, 1.0f));
+    float angle = acos(std::min(std::max(glm::dot(centre, eye / eyeDistance), -1.0f), 1.0f));
+    if (angle > horizon + radius + 0.05f)
+        return;
+
+    float distance = std::max(glm::length(eye - centre) - radius, 1e-4f);
+    float pixels = shape.geometricError(key.level) * pixelsPerUnit / distance;
+    if (pixels > Config::terrainPixelError && key.level < maxLevel) {
+        bool ready = true;
+        for (int i = 0; i < 4; i++) {
+            if (!isResident(key.child(i))) {
+                wanted.push_back(key.child(i));
+                ready = false;
+            }
+        }
+        if (ready) {
+            for (int i = 0; i < 4; i++)
+                select(key.child(i), eye, pixelsPerUnit);
+            return;
+        }
+    }
+    visible.push_back(key);
+}
+
+inline void Terrain::evict() {
+    if (residentBytes <= Config::terrainBudgetBytes)
+        return;
+    // Only chunks the last selection did not touch, and never the roots
+    std::vector<std::pair<int, uint64_t> > candidates;
+    for (std::unordered_map<uint64_t, Chunk>::iterator c = chunks.begin(); c != chunks.end(); ++c)
+        if (c->second.lastUsed < frame && (c->first >> 48) != 0)
+            candidates.push_back(std::make_pair(c->second.lastUsed, c->first));
+    std::sort(candidates.begin(), candidates.end());
+    for (size_t i = 0; i < candidates.size() && residentBytes > Config::terrainBudgetBytes; i++) {
+        Chunk &c = chunks[candidates[i].second];
+        GLuint buffers[3] = {c.positions, c.normals, c.texCoords};
+        glDeleteBuffers(3, buffers);
+        residentBytes -= c.bytes;
+        chunks.erase(candidates[i].second);
+    }
+}
+
+inline void Terrain::draw(vec3 eye, float fovDegrees, int viewportHeight) {
+    frame++;
+    // Upload what the workers finished since the last frame
+    std::vector<ChunkMesh> finished;
+    builder.collect(finished);
+    for (size_t m = 0; m < finished.size(); m++)
+        upload(finished[m]);
+
+    visible.clear();
+    wanted.clear();
+    float pixelsPerUnit = viewportHeight / (2 * tan(fovDegrees * M_PI / 360));
+    for (int x = 0; x < 2; x++) {
+        ChunkKey root = {0, x, 0};
+        select(root, eye, pixelsPerUnit);
+    }
+    // Coarse chunks first: they unlock the finer ones
+    std::stable_sort(wanted.begin(), wanted.end(), [](const ChunkKey &a, const ChunkKey &b) {
+        return a.level < b.level;
+    });
+    builder.request(wanted);
+
+    engine->setTexture(texture);
+    if (overlayTexture != 0) {
+        // Second texture unit decals the overlay over the lit, textured
+        // surface: c = c (1 - a) + overlay a
+        glActiveTexture(GL_TEXTURE1);
+        engine->setTexture(overlayTexture);
+        glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_DECAL);
+        glActiveTexture(GL_TEXTURE0);
+    }
+    for (size_t i = 0; i < visible.size(); i++) {
+        Chunk &c = chunks[visible[i].id()];
+        engine->setVertexArray(c.positions);
+        engine->setNormalArray(c.normals);
+        engine->setTexCoordArray(c.texCoords);
+        if (overlayTexture != 0) {
+            glClientActiveTexture(GL_TEXTURE1);
+            engine->setTexCoordArray(c.texCoords);
+            glClientActiveTexture(GL_TEXTURE0);
+        }
+        engine->drawElements(GL_TRIANGLES, indexBuffer, nIndices);
+    }
+    if (overlayTexture != 0) {
+        glClientActiveTexture(GL_TEXTURE1);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glClientActiveTexture(GL_TEXTURE0);
+        glActiveTexture(GL_TEXTURE1);
+        engine->unsetTexture();
+        glActiveTexture(GL_TEXTURE0);
+    }
+    engine->unsetTexture();
+    evict();
+}
+
+#endif
@@ -0,0 +1,263 @@
+#ifndef TERRAINMESH_HPP
+#define TERRAINMESH_HPP
+
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "heightmap.hpp"
+#include <glm/glm.hpp>
+using glm::vec2;
+using glm::vec3;
+
+// A node of the terrain quadtree. Level 0 splits the globe into two
+// 180x180 degree chunks (west and east); each level halves a chunk's
+// latitude and longitude extent. x counts from longitude -180 eastwards
+// and y from latitude 90 southwards.
+struct ChunkKey {
+    int level, x, y;
+    uint64_t id() const { return ((uint64_t)level << 48) | ((uint64_t)x << 24) | (uint64_t)y; }
+    ChunkKey child(int i) const { ChunkKey c = {level + 1, 2 * x + (i & 1), 2 * y + (i >> 1)}; return c; }
+    float degrees() const { return 180.0f / (1 << level); }
+    float west() const { return -180 + x * degrees(); }
+    float north() const { return 90 - y * degrees(); }
+};
+
+// Geometry of one chunk: an (n+1) x (n+1) grid of vertices followed by a
+// skirt of 4 (n+1) vertices hanging below its edges. The skirts hide the
+// cracks where neighbours of different levels meet.
+struct ChunkMesh {
+    ChunkKey key;
+    std::vector<vec3> positions, normals;
+    std::vector<vec2> texCoords;
+};
+
+// Shape of the terrain shared by the mesh builder and the LOD selection
+struct TerrainShape {
+    const HeightMap *heights;
+    // Height map value of sea level, which stays on the unit globe, and
+    // the radius added per unit of height above it
+    float seaLevel;
+    float heightScale;
+    // Quads along each side of a chunk
+    int resolution;
+
+    // Point on the displaced surface
+    vec3 surface(float latitude, float longitude) const;
+    // Largest distance between a chunk's mesh and the finest terrain,
+    // halving with each level
+    float geometricError(int level) const;
+    // Centre and radius of a sphere containing the chunk
+    void bounds(ChunkKey key, vec3 &centre, float &radius) const;
+};
+
+// Fills mesh with the vertices of a chunk; safe to call from any thread
+void buildChunkMesh(const TerrainShape &shape, ChunkKey key, ChunkMesh &mesh);
+// Triangle indices for every chunk of the given resolution, skirts included
+std::vector<int> chunkIndices(int resolution);
+// Grid index of the k-th vertex along an edge (north, south, west, east)
+int chunkEdgeVertex(int resolution, int edge, int k);
+
+// Worker threads that build chunk meshes in the background. Each frame the
+// renderer lists the chunks it wants but does not have; finished meshes
+// are collected on the render thread and uploaded there.
+class ChunkBuilder {
+public:
+    ChunkBuilder(): shape(NULL), running(false) {}
+    ~ChunkBuilder() { stop(); }
+    void start(const TerrainShape *shape, int threads);
+    void stop();
+    // Replaces the queue of wanted chunks; chunks already being built or
+    // waiting to be collected are not requested again. Earlier entries
+    // are built first.
+    void request(const std::vector<ChunkKey> &keys);
+    // Moves finished meshes to out
+    void collect(std::vector<ChunkMesh> &out);
+protected:
+    ChunkBuilder(const ChunkBuilder&) = delete;
+    ChunkBuilder& operator=(const ChunkBuilder&) = delete;
+    const TerrainShape *shape;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool running;
+    std::deque<ChunkKey> queue;
+    std::vector<uint64_t> building;
+    std::vector<ChunkMesh> finished;
+    void run();
+};
+
+// Definitions below
+
+inline vec3 TerrainShape::surface(float latitude, float longitude) const {
+    float phi = latitude * M_PI / 180, theta = longitude * M_PI / 180;
+    float r = 1 + heightScale * (heights->sample(latitude, longitude) - seaLevel);
+    return r * vec3(cos(phi) * sin(theta), sin(phi), cos(phi) * cos(theta));
+}
+
+inline float TerrainShape::geometricError(int level) const {
+    // At level 0 a chunk can miss the whole height range, plus the gap
+    // between a flat quad and the curved globe
+    float spacing = (float)M_PI / resolution;
+    float rootError = heightScale + spacing * spacing / 8;
+    return rootError / (1 << level);
+}
+
+inline void TerrainShape::bounds(ChunkKey key, vec3 &centre, float &radius) const {
+    float d = key.degrees();
+    float lat = key.north() - d / 2, lon = key.west() + d / 2;
+    float phi = lat * M_PI / 180, theta = lon * M_PI / 180;
+    centre = vec3(cos(phi) * sin(theta), sin(phi), cos(phi) * cos(theta));
+    // The half diagonal in radians bounds the chord to any corner
+    float halfDiagonal = d * (float)M_PI / 180 * 0.7072f;
+    radius = std::min(halfDiagonal, 2.0f) + heightScale;
+}
+
+inline int chunkEdgeVertex(int n, int edge, int k) {
+    switch (edge) {
+    case 0: return k;
+    case 1: return n * (n + 1) + k;
+    case 2: return k * (n + 1);
+    default: return k * (n + 1) + n;
+    }
+}
+
+inline void buildChunkMesh(const TerrainShape &shape, ChunkKey key, ChunkMesh &mesh) {
+    int n = shape.resolution;
+    float d = key.degrees(), lon0 = key.west(), lat0 = key.north();
+    // Half a grid step for the normals' central differences
+    float h = d / n / 2;
+    float skirt = 2 * shape.geometricError(key.level);
+    int nGrid = (n + 1) * (n + 1);
+    mesh.key = key;
+    mesh.positions.resize(nGrid + 4 * (n + 1));
+    mesh.normals.resize(mesh.positions.size());
+    mesh.texCoords.resize(mesh.positions.size());
+    for (int j = 0; j <= n; j++) {
+        float lat = lat0 - d * j / n;
+        for (int i = 0; i <= n; i++) {
+            float lon = lon0 + d * i / n;
+            int v = j * (n + 1) + i;
+            mesh.positions[v] = shape.surface(lat, lon);
+            vec3 east = shape.surface(lat, lon + h) - shape.surface(lat, lon - h);
+            vec3 north = shape.surface(std::min(lat + h, 90.0f), lon)
+                - shape.surface(std::max(lat - h, -90.0f), lon);
+            vec3 normal = glm::cross(east, north);
+            float length = glm::length(normal);
+            // East vanishes at the poles; fall back to the radial direction
+            mesh.normals[v] = length > 1e-12f ? normal / length : glm::normalize(mesh.positions[v]);
+            mesh.texCoords[v] = vec2(lon / 360 + 0.5f, -lat / 180 + 0.5f);
+        }
+    }
+    // Skirts along the north, south, west and east edges
+    for (int e = 0; e < 4; e++) {
+        for (int k = 0; k <= n; k++) {
+            int v = chunkEdgeVertex(n, e, k);
+            int s = nGrid + e * (n + 1) + k;
+            mesh.positions[s] = mesh.positions[v] * (1 - skirt);
+            mesh.normals[s] = mesh.normals[v];
+            mesh.texCoords[s] = mesh.texCoords[v];
+        }
+    }
+}
+
+inline std::vector<int> chunkIndices(int n) {
+    std::vector<int> indices;
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < n; i++) {
+            int top = j * (n + 1) + i, bottom = (j + 1) * (n + 1) + i;
+            indices.push_back(top);
+            indices.push_back(bottom);
+            indices.push_back(bottom + 1);
+            indices.push_back(top);
+            indices.push_back(bottom + 1);
+            indices.push_back(top + 1);
+        }
+    }
+    int nGrid = (n + 1) * (n + 1);
+    for (int e = 0; e < 4; e++) {
+        for (int k = 0; k < n; k++) {
+            int a = chunkEdgeVertex(n, e, k), b = chunkEdgeVertex(n, e, k + 1);
+            int s = nGrid + e * (n + 1) + k;
+            indices.push_back(a);
+            indices.push_back(b);
+            indices.push_back(s + 1);
+            indices.push_back(a);
+            indices.push_back(s + 1);
+            indices.push_back(s);
+        }
+    }
+    return indices;
+}
+
+// ChunkBuilder methods
+
+inline void ChunkBuilder::start(const TerrainShape *s, int threads) {
+    stop();
+    shape = s;
+    running = true;
+    for (int t = 0; t < threads; t++)
+        workers.push_back(std::thread(&ChunkBuilder::run, this));
+}
+
+inline void ChunkBuilder::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+        queue.clear();
+    }
+    wake.notify_all();
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+    workers.clear();
+}
+
+inline void ChunkBuilder::request(const std::vector<ChunkKey> &keys) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // Drop requests the camera has moved away from
+        queue.clear();
+        for (size_t k = 0; k < keys.size(); k++) {
+            uint64_t id = keys[k].id();
+            bool pending = std::find(building.begin(), building.end(), id) != building.end();
+            for (size_t m = 0; m < finished.size() && !pending; m++)
+                pending = finished[m].key.id() == id;
+            if (!pending)
+                queue.push_back(keys[k]);
+        }
+    }
+    wake.notify_all();
+}
+
+inline void ChunkBuilder::collect(std::vector<ChunkMesh> &out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t m = 0; m < finished.size(); m++)
+        out.push_back(std::move(finished[m]));
+    finished.clear();
+}
+
+inline void ChunkBuilder::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [this]() { return !running || !queue.empty(); });
+        if (!running)
+            return;
+        ChunkKey key = queue.front();
+        queue.pop_front();
+        building.push_back(key.id());
+        lock.unlock();
+        ChunkMesh mesh;
+        buildChunkMesh(*shape, key, mesh);
+        lock.lock();
+        building.erase(std::find(building.begin(), building.end(), key.id()));
+        finished.push_back(std::move(mesh));
+    }
+}
+
+#endif
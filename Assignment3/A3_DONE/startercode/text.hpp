@@ -1,17 +1,63 @@
 #ifndef TEXT_HPP
 #define TEXT_HPP
 
+#include "engine.hpp"
 #include "graphics.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
 #include <string>
+#include <vector>
+#include <glm/glm.hpp>
+using glm::vec4;
 
+// Draws strings with the 8x13 bitmap font below. The glyphs are
+// rasterized once into an atlas texture; strings added during a frame
+// are queued as textured quads in one vertex buffer and drawn with a
+// single call by flush(), however many labels there are.
 class Text {
 public:
-    GLuint fontOffset;
+    Text(): atlas(0), vertexBuffer(0), capacity(0) {}
     void initialize();
+    // Queues a string with its raster position at (x, y) in normalized
+    // device coordinates, like glRasterPos2f
+    void add(const char *s, int length, float x, float y, vec4 color = vec4(1, 1, 1, 1));
+    void add(const std::string &s, float x, float y, vec4 color = vec4(1, 1, 1, 1));
+    // Draws everything queued since the last flush in one call
+    void flush();
+    // Draws one string right away (add + flush)
     void draw(std::string, float x, float y);
 protected:
+    struct GlyphVertex {
+        float x, y;
+        float u, v;
+        GLubyte color[4];
+    };
+    static const int glyphWidth = 8, glyphHeight = 13, glyphAdvance = 10, glyphBaseline = 2;
+    static const int atlasColumns = 16, atlasSize = 128;
+    Texture atlas;
+    VertexBuffer vertexBuffer;
+    int capacity;
+    // Quads in pixels until flush() knows the viewport
+    std::vector<GlyphVertex> vertices;
+    std::vector<float> anchors;
 };
 
+// Non-allocating formatting into a caller's buffer, for labels rebuilt
+// every frame. Each function writes at out and returns the position after
+// the last character written; nothing is null-terminated.
+namespace TextFormat {
+    char *append(char *out, const char *s);
+    // Decimal integer, padded on the left with fill to at least width
+    char *appendInt(char *out, int value, int width = 0, char fill = '0');
+    // Decimal with a fixed number of digits after the point
+    char *appendFixed(char *out, double value, int decimals);
+    // Scientific notation such as "3.2e17"
+    char *appendScientific(char *out, double value, int decimals);
+    // "MM/DD/YYYY  HH:MM"
+    char *appendDate(char *out, int month, int day, int year, int hour, int minute);
+}
+
 static const GLubyte rasters[127-32][13] = {
     {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
     {0x00,0x00,0x18,0x18,0x00,0x00,0x18,0x18,0x18,0x18,0x18,0x18,0x18},
@@ -111,32 +157,204 @@ static const GLubyte rasters[127-32][13] = {
 };
 
 inline void Text::initialize() {
-    GLuint i;
+    // Alpha-only atlas: glyph i at column i % 16, row i / 16, with rows of
+    // the font stored bottom-up like glBitmap expects
+    std::vector<GLubyte> pixels(atlasSize * atlasSize, 0);
+    for (int i = 0; i < 127 - 32; i++) {
+        int left = (i % atlasColumns) * glyphWidth, bottom = (i / atlasColumns) * glyphHeight;
+        for (int row = 0; row < glyphHeight; row++)
+            for (int bit = 0; bit < glyphWidth; bit++)
+                if (rasters[i][row] & (0x80 >> bit))
+                    pixels[(bottom + row) * atlasSize + left + bit] = 255;
+    }
+    glGenTextures(1, &atlas);
+    glBindTexture(GL_TEXTURE_2D, atlas);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    fontOffset = glGenLists(128);
-    for (i = 32; i < 127; i++) {
-	glNewList(i+fontOffset, GL_COMPILE);
-	glBitmap(8, 13, 0.0, 2.0, 10.0, 0.0, rasters[i-32]);
-	glEndList();
+    // Glyphs are drawn at whole pixels, so nearest filtering is exact
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, atlasSize, atlasSize, 0, GL_ALPHA, GL_UNSIGNED_BYTE, &pixels[0]);
+    glGenBuffers(1, &vertexBuffer);
+}
+
+inline void Text::add(const char *s, int length, float x, float y, vec4 color) {
+    GlyphVertex v;
+    for (int c = 0; c < 4; c++)
+        v.color[c] = (GLubyte)(std::min(std::max(color[c], 0.0f), 1.0f) * 255 + 0.5f);
+    for (int i = 0; i < length; i++) {
+        int g = (unsigned char)s[i] - 32;
+        if (g < 0 || g >= 127 - 32)
+            g = 0;
+        // Pixel offsets from the raster position; flush() adds the anchor
+        float left = i * glyphAdvance, bottom = -glyphBaseline;
+        float u0 = (g % atlasColumns) * glyphWidth / (float)atlasSize;
+        float v0 = (g / atlasColumns) * glyphHeight / (float)atlasSize;
+        float u1 = u0 + glyphWidth / (float)atlasSize, v1 = v0 + glyphHeight / (float)atlasSize;
+        float corners[4][4] = {
+            {left, bottom, u0, v0},
+            {left + glyphWidth, bottom, u1, v0},
+            {left + glyphWidth, bottom + glyphHeight, u1, v1},
+            {left, bottom + glyphHeight, u0, v1}
+        };
+        for (int k = 0; k < 4; k++) {
+            v.x = corners[k][0];
+            v.y = corners[k][1];
+            v.u = corners[k][2];
+            v.v = corners[k][3];
+            vertices.push_back(v);
+            anchors.push_back(x);
+            anchors.push_back(y);
+        }
     }
 }
 
-inline void Text::draw(std::string s, float x, float y) {
+inline void Text::add(const std::string &s, float x, float y, vec4 color) {
+    add(s.c_str(), s.length(), x, y, color);
+}
+
+inline void Text::flush() {
+    if (vertices.empty())
+        return;
+    // Place the quads: anchors snap to whole pixels like glRasterPos
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    float w = viewport[2], h = viewport[3];
+    for (size_t i = 0; i < vertices.size(); i++) {
+        float px = floor((anchors[2 * i] + 1) / 2 * w + 0.5f) + vertices[i].x;
+        float py = floor((anchors[2 * i + 1] + 1) / 2 * h + 0.5f) + vertices[i].y;
+        vertices[i].x = px / w * 2 - 1;
+        vertices[i].y = py / h * 2 - 1;
+    }
+
+    // Stream into a fresh buffer store so the driver need not wait on
+    // last frame's draw
+    int count = vertices.size();
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    if (count > capacity)
+        capacity = std::max(count, 2 * capacity);
+    glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(GlyphVertex), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(GlyphVertex), &vertices[0]);
+
     glMatrixMode(GL_PROJECTION);
     glPushMatrix();
     glLoadIdentity();
     glMatrixMode(GL_MODELVIEW);
     glPushMatrix();
     glLoadIdentity();
-    glRasterPos2f(x, y);
-    glPushAttrib(GL_LIST_BIT);
-    glListBase(fontOffset);
-    glCallLists(s.length(), GL_UNSIGNED_BYTE, (GLubyte*)s.c_str());
+    glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_TEXTURE_BIT);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, atlas);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    int stride = sizeof(GlyphVertex);
+    glVertexPointer(2, GL_FLOAT, stride, (const GLvoid*)offsetof(GlyphVertex, x));
+    glTexCoordPointer(2, GL_FLOAT, stride, (const GLvoid*)offsetof(GlyphVertex, u));
+    glColorPointer(4, GL_UNSIGNED_BYTE, stride, (const GLvoid*)offsetof(GlyphVertex, color));
+    glDrawArrays(GL_QUADS, 0, count);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
     glPopAttrib();
     glMatrixMode(GL_PROJECTION);
     glPopMatrix();
     glMatrixMode(GL_MODELVIEW);
     glPopMatrix();
+
+    vertices.clear();
+    anchors.clear();
+}
+
+inline void Text::draw(std::string s, float x, float y) {
+    // The fixed-function current color, as glBitmap would have used
+    GLfloat color[4];
+    glGetFloatv(GL_CURRENT_COLOR, color);
+    add(s, x, y, vec4(color[0], color[1], color[2], color[3]));
+    flush();
+}
+
+namespace TextFormat {
+
+    inline char *append(char *out, const char *s) {
+        while (*s)
+            *out++ = *s++;
+        return out;
+    }
+
+    inline char *appendInt(char *out, int value, int width, char fill) {
+        char digits[12];
+        int n = 0;
+        unsigned magnitude = value < 0 ? -(unsigned)value : value;
+        do {
+            digits[n++] = '0' + magnitude % 10;
+            magnitude /= 10;
+        } while (magnitude > 0);
+        if (value < 0)
+            *out++ = '-';
+        for (int pad = n + (value < 0 ? 1 : 0); pad < width; pad++)
+            *out++ = fill;
+        while (n > 0)
+            *out++ = digits[--n];
+        return out;
+    }
+
+    inline char *appendFixed(char *out, double value, int decimals) {
+        long long scale = 1;
+        for (int i = 0; i < decimals; i++)
+            scale *= 10;
+        long long scaled = (long long)floor(fabs(value) * scale + 0.5);
+        if (value < 0 && scaled > 0)
+            *out++ = '-';
+        long long whole = scaled / scale;
+        // Split so that values past the range of int still print
+        if (whole >= 1000000000) {
+            out = appendInt(out, (int)(whole / 1000000000));
+            out = appendInt(out, (int)(whole % 1000000000), 9);
+        } else {
+            out = appendInt(out, (int)whole);
+        }
+        if (decimals > 0) {
+            *out++ = '.';
+            out = appendInt(out, (int)(scaled % scale), decimals);
+        }
+        return out;
+    }
+
+    inline char *appendScientific(char *out, double value, int decimals) {
+        if (!std::isfinite(value))
+            return append(out, "-");
+        if (value == 0)
+            return appendFixed(out, 0, decimals);
+        int exponent = (int)floor(log10(fabs(value)));
+        double mantissa = value / pow(10.0, exponent);
+        // Rounding can carry into another digit, e.g. 9.96 -> 10.0
+        double limit = 10 - 0.5 * pow(10.0, -decimals);
+        if (fabs(mantissa) >= limit) {
+            mantissa /= 10;
+            exponent++;
+        }
+        out = appendFixed(out, mantissa, decimals);
+        *out++ = 'e';
+        return appendInt(out, exponent);
+    }
+
+    inline char *appendDate(char *out, int month, int day, int year, int hour, int minute) {
+        out = appendInt(out, month, 2);
+        *out++ = '/';
+        out = appendInt(out, day, 2);
+        *out++ = '/';
+        out = appendInt(out, year);
+        out = append(out, "  ");
+        out = appendInt(out, hour, 2);
+        *out++ = ':';
+        return appendInt(out, minute, 2);
+    }
+
 }
 
 #endif
@@ -0,0 +1,124 @@
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include "character.hpp"
+#include "config.hpp"
+#include "reader.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Command-line benchmarks for the mocap loader. They run before any
+// window is created, so they work on machines without a display.
+namespace Bench {
+
+    double secondsSince(std::chrono::steady_clock::time_point start);
+    // The skeleton an .amc file goes with: 05_01.amc plays on 05.asf in
+    // the same directory
+    std::string skeletonFile(std::string amcFile);
+    // Times StreamReader against Reader on each file, in MB/s. An .amc
+    // file is decoded into its skeleton's clip by both, checking that the
+    // clips agree; an .asf file is split into tokens.
+    int reader(std::vector<std::string> files);
+
+    // Definitions below
+
+    inline double secondsSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    inline std::string skeletonFile(std::string amcFile) {
+        size_t slash = amcFile.find_last_of("/\\");
+        size_t underscore = amcFile.find('_', slash == std::string::npos ? 0 : slash + 1);
+        if (underscore == std::string::npos)
+            return "";
+        return amcFile.substr(0, underscore) + ".asf";
+    }
+
+    template <typename R>
+    inline int countTokens(std::string filename) {
+        std::ifstream in(filename.c_str());
+        R r(&in);
+        std::string token;
+        int tokens = 0;
+        while (r.readToken(token), r.good())
+            tokens++;
+        return tokens;
+    }
+
+    inline int reader(std::vector<std::string> files) {
+        if (files.empty()) {
+            files.push_back(Config::asfFile);
+            files.push_back(Config::amcFile);
+        }
+        printf("%-16s %8s %8s %12s %12s\n", "file", "MB", "frames", "stream MB/s", "buffer MB/s");
+        double totalBytes = 0, streamTime = 0, bufferTime = 0;
+        for (size_t f = 0; f < files.size(); f++) {
+            std::string filename = files[f];
+            std::ifstream file(filename.c_str(), std::ios::binary | std::ios::ate);
+            if (!file) {
+                printf("Failed to open %s\n", filename.c_str());
+                return EXIT_FAILURE;
+            }
+            double bytes = file.tellg();
+            std::string name = filename.substr(filename.find_last_of("/\\") + 1);
+            int frames = 0;
+            double t[2];
+            if (filename.size() > 4 && filename.substr(filename.size() - 4) == ".asf") {
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                int streamTokens = countTokens<StreamReader>(filename);
+                t[0] = secondsSince(start);
+                start = std::chrono::steady_clock::now();
+                int bufferTokens = countTokens<Reader>(filename);
+                t[1] = secondsSince(start);
+                if (streamTokens != bufferTokens) {
+                    printf("%s: %d tokens from StreamReader, %d from Reader\n", name.c_str(), streamTokens, bufferTokens);
+                    return EXIT_FAILURE;
+                }
+            } else {
+                Character character(skeletonFile(filename), "", vec3(0,0,0), vec3(0,0,0));
+                if (!character.hasSkeleton()) {
+                    printf("%s: no skeleton %s\n", name.c_str(), skeletonFile(filename).c_str());
+                    return EXIT_FAILURE;
+                }
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                std::ifstream streamIn(filename.c_str());
+                StreamReader streamReader(&streamIn);
+                character.readAnimation(streamReader);
+                t[0] = secondsSince(start);
+                Clip streamClip = character.getClip();
+                start = std::chrono::steady_clock::now();
+                std::ifstream bufferIn(filename.c_str());
+                Reader bufferReader(&bufferIn);
+                character.readAnimation(bufferReader);
+                t[1] = secondsSince(start);
+                const Clip &clip = character.getClip();
+                frames = clip.getFrameCount();
+                bool same = frames == streamClip.getFrameCount();
+                for (int i = 0; same && i < frames; i++) {
+                    const float *a = clip.getFrame(i), *b = streamClip.getFrame(i);
+                    for (int c = 0; c < clip.getChannelCount(); c++)
+                        same = same && a[c] == b[c];
+                }
+                if (!same) {
+                    printf("%s: StreamReader and Reader decoded different clips\n", name.c_str());
+                    return EXIT_FAILURE;
+                }
+            }
+            printf("%-16s %8.2f %8d %12.1f %12.1f\n", name.c_str(), bytes / 1e6, frames,
+                   bytes / 1e6 / t[0], bytes / 1e6 / t[1]);
+            totalBytes += bytes;
+            streamTime += t[0];
+            bufferTime += t[1];
+        }
+        printf("%-16s %8.2f %8s %12.1f %12.1f  (%.1fx)\n", "total", totalBytes / 1e6, "",
+               totalBytes / 1e6 / streamTime, totalBytes / 1e6 / bufferTime, streamTime / bufferTime);
+        return EXIT_SUCCESS;
+    }
+
+}
+
+#endif
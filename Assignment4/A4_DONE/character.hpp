@@ -2,12 +2,17 @@
 #define CHARACTER_HPP
 
 #include <map>
+#include <stdexcept>
 #include <string>
 #include <vector>
 #include <glm/ext.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include "clip.hpp"
 #include "draw.hpp"
+#include "mappedfile.hpp"
+#include "mocapfile.hpp"
 #include "reader.hpp"
+#include "skeleton.hpp"
 using namespace std;
 using glm::vec3;
 using glm::mat4;
@@ -16,6 +21,18 @@ using glm::mat4;
 class Bone;
 class RotationBounds;
 
+// Thrown when an ASF or AMC file is malformed. Nothing in the viewer
+// catches it, so it still stops there, but the batch converter reports
+// the file and carries on.
+class MocapError: public std::runtime_error {
+public:
+    MocapError(std::string message): std::runtime_error(message) {}
+};
+
+// Whether loading a skeleton reports its progress on cerr; on by default,
+// the batch converter turns it off to keep its report readable
+bool &logLoading();
+
 // This is the root class for the animated character. You can also
 // think of this as a root node a scene graph. The class takes care of
 // loading the skeleton file and also animation file(s) needed to draw
@@ -26,8 +43,15 @@ class RotationBounds;
 class Character {
 public:
 
+    // Loads the skeleton and animation from text files, or, if
+    // asfFilename is a binary .mcap file, both from it: amcFilename then
+    // names the clip to play (the first if empty).
     Character(std::string asfFilename, std::string amcFilename,
               vec3 basePosition, vec3 baseVelocity);
+    ~Character();
+    // The character owns its bones
+    Character(const Character &) = delete;
+    Character &operator=(const Character &) = delete;
 
     // Advance the mocap data by a time dt. Note that this need not be
     // the same as the animation time in the program, if you want to
@@ -37,6 +61,28 @@ public:
     // dt = 1/120.f.
     void advance(float dt);
 
+    // Poses the character at a frame of the animation, counting from 0,
+    // solving the skeleton's palette for it. The whole file is decoded
+    // when it is loaded, so this costs the same for any frame.
+    void setFrame(int frame);
+    int getFrameCount() {return clip.getFrameCount();}
+    const Clip &getClip() {return clip;}
+    // The bones flattened, with world transforms for the current frame
+    // in the same space as getCurrentCoordinateFrame()
+    const Skeleton &getSkeleton() {return skeleton;}
+
+    // Decodes the frames of an .amc file read through r, a Reader or a
+    // StreamReader to compare the two (see Bench::reader)
+    template <typename R> void readAnimation(R &r);
+    // Decodes them into out instead, leaving the character as it is, so
+    // several threads can share one skeleton (see Convert::library)
+    template <typename R> void readAnimation(R &r, Clip &out) const;
+
+    // Writes the skeleton and clips decoded for it to a binary mocap
+    // file (see mocapfile.hpp), returning false if it could not
+    bool saveBinary(std::string filename, const std::vector<Clip> &clips,
+                    const std::vector<std::string> &clipNames) const;
+
     // This returns the current coordinate frame of the ROOT NODE of
     // the character, typically this is the character's pelvis -- all
     // of the root node bones should be drawn relative to this
@@ -52,23 +98,29 @@ public:
     // Each of these bones will, in turn, have 0 or more child bones.
     vector<Bone*> rootNodeBones;
   
-    // TODO: Implement this routine to draw all the character's bones
-    // in the correct pose based on the current animation data.
-    void draw();
+    // Draws all the character's bones in the current pose, the bone
+    // numbered highlight in the skeleton (if not -1) in another color
+    void draw(int highlight = -1);
 
-    bool hasAnimation() {return !anim->fail();}
+    bool hasAnimation() {return clip.getFrameCount() > 0;}
     bool hasSkeleton() {return !boneTable.empty();}
 
 protected:
     void loadAnimation(std::string amcFilename);
     void loadSkeleton(std::string asfFilename);  
-    void resetFile();
-    void nextFrame();
+    void assignChannels();
+    // Builds the skeleton from the bone tree once it is loaded
+    void flatten();
+    // Frames are read straight from the mapped file, so only the pages
+    // of frames played are ever loaded. Throws MocapError if the file is
+    // malformed or has no clip of that name.
+    void loadBinary(std::string filename, std::string clipName);
     // float deg2rad(float d);
     void parseUnits(Reader &r);
     void parseRoot(Reader &r);
     void parseBonedata(Reader &r);
     void parseHierarchy(Reader &r);
+    void deleteBones();
     bool deg;
     float time;
     vec3 position;
@@ -76,7 +128,12 @@ protected:
     int animationFrame;
     vec3 basePosition, baseVelocity; // to compensate for translation in amc
     std::map<string, Bone*> boneTable;
-    std::ifstream *anim;
+    // One frame per row: the root's TX TY TZ RX RY RZ in channels 0-5,
+    // then each bone's rotation DOFs from its getChannel()
+    Clip clip;
+    int channelCount;
+    MappedFile mocap;
+    Skeleton skeleton;
 };
 
 // This class just provides a data structure to store information
@@ -111,12 +168,17 @@ public:
     // This constructor is setup to read data from the CMU motion
     // capture database files.
     Bone(Reader &r, bool deg);
+    // From and to the bone's record in a binary mocap file
+    Bone(const MocapBone &record, bool deg);
+    void toRecord(MocapBone &record);
 
     // Bones are named based on parts of the body
     std::string getName();    
   
-    // Returns the rotation of this joint in the body.
-    mat4 getCurrentLocalRotation();
+    // The rotation that orients the bone's DOF axes in the body; its
+    // pose in a frame is given by the skeleton (Skeleton::getLocal)
+    const mat4 &getInitialRotation() {return initialRotation;}
+    const RotationBounds &getRotationBounds() {return rotationBounds;}
 
     // Returns a vector that is scaled to the length of the bone and
     // points in the direction of the bone. In the bone's local
@@ -129,11 +191,13 @@ public:
     // bone.
     std::vector<Bone*> children;
 
-    // This is the key routine that you need to fill in.
-    void draw();
-
     void addChild(Bone* child);
-    void readPose(Reader &r);
+
+    // Where this bone's rotation DOFs start in a frame of the clip, and
+    // how many there are
+    int getChannel() {return channel;}
+    void setChannel(int c) {channel = c;}
+    int getDofs() {return rotationBounds.dofs;}
 protected:
     //TaperedCylinder *cylinder;
     void constructFromFile(Reader &r, bool deg);
@@ -144,27 +208,58 @@ protected:
     RotationBounds rotationBounds;    
     vec3 axis;
     mat4 initialRotation;
-    mat4 currentRotation;
     int id;
+    int channel;
     bool deg;
 };
 
 inline Character::Character(std::string asfFilename, std::string amcFilename,
                             vec3 basePosition, vec3 baseVelocity) {
-    anim = NULL;
     time = 0;
-    loadSkeleton(asfFilename);
-    loadAnimation(amcFilename);
+    deg = false;
     this->basePosition = basePosition;
     this->baseVelocity = baseVelocity;
+    // The destructor does not run if the constructor throws
+    try {
+        std::string binary = ".mcap";
+        if (asfFilename.size() > binary.size()
+            && asfFilename.compare(asfFilename.size() - binary.size(), binary.size(), binary) == 0) {
+            loadBinary(asfFilename, amcFilename);
+            return;
+        }
+        loadSkeleton(asfFilename);
+        loadAnimation(amcFilename);
+    }
+    catch (...) {
+        deleteBones();
+        throw;
+    }
+}
+
+inline Character::~Character() {
+    deleteBones();
+}
+
+inline void Character::deleteBones() {
+    std::map<string, Bone*>::iterator it;
+    for (it = boneTable.begin(); it != boneTable.end(); ++it) {
+        delete it->second;
+    }
+    boneTable.clear();
+    rootNodeBones.clear();
 }
 
 inline void Character::advance(float dt) {
     float fps = 120;
-    int f0 = round(fps*time), f1 = round(fps*(time + dt));
-    for (int f = f0; f < f1; f++)
-        nextFrame();
-    time += dt;
+    int frames = clip.getFrameCount();
+    if (frames == 0)
+        return;
+    // Kept within one loop of the clip so it does not lose precision
+    float duration = frames/fps;
+    time = fmod(time + dt, duration);
+    if (time < 0)
+        time += duration;
+    setFrame((int)round(fps*time) % frames);
 }
 
 inline mat4 Character::getCurrentCoordinateFrame() {
@@ -179,70 +274,14 @@ inline mat4 Character::getCurrentCoordinateFrame() {
 inline vec3 Character::getCurrentPosition() {
     return position;
 }
-// TODO: Apply the current coordinate frame and then draw the root
-// node bones of the character.
-inline void Character::draw() {
-	//1. get current coordinate frame
-	mat4 curCoordFrame = getCurrentCoordinateFrame();
-	glPushMatrix();
-		//2. apply current coordinate fram
-		glMultMatrixf(&curCoordFrame[0][0]);
-
-		//3. draw children of root bones
-		int num_children = rootNodeBones.size();
-
-		for (int i = 0; i < num_children; i++) {
-			rootNodeBones.at(i)->draw(); //vector<Bone*> rootNodeBones
-		}
-
-	glPopMatrix();
+// Draws the palette the last setFrame solved, in one batch
+inline void Character::draw(int highlight) {
+    skeleton.draw(0.05, highlight, vec3(0.2,0.6,1.0));
 }
 
 inline Bone::Bone(Reader &r, bool deg) {
     constructFromFile(r, deg);
 }
-// TODO: Draw the bone as a capsule (a cylinder capped by
-// spheres). Translate to the end of the bone vector and draw the
-// bone's children, recursively.
-inline void Bone::draw() {
-    //1. store measurements in local variables
-	mat4 localRot = getCurrentLocalRotation();
-	vec3 boneVec = getBoneVector();
-	int num_children = children.size();
-
-	//2. apply rotation
-	glPushMatrix();
-		glMultMatrixf(&localRot[0][0]);
-
-		//3. rotate z-axis to align with boneVec
-		vec3 b = glm::normalize(boneVec);
-		vec3 z = vec3(0, 0, 1);
-		vec3 rotAxis = glm::cross(z, b);
-		float theta = acos(glm::dot(b, z))*180.0/M_PI; //deg -> radians
-		
-		glPushMatrix();
-			glRotatef(theta, rotAxis.x, rotAxis.y, rotAxis.z);
-			//4. apply scaling along z to scale unit cylinder to the correct length
-			Draw::sphere(vec3(0, 0, 0), 0.05);
-			Draw::sphere(vec3(0, 0, length), 0.05);
-			glPushMatrix();
-				glScalef(0.05, 0.05, length);
-				Draw::unitCylinderZ();
-			glPopMatrix();
-		glPopMatrix();
-
-		//5. translate to end of bone to draw children
-		glPushMatrix();
-			glTranslatef(boneVec.x, boneVec.y, boneVec.z);
-
-			//6. step through children bones
-			for (int i = 0; i < num_children; i++) {
-				children.at(i)->draw(); //vector<Bone*> children
-			}
-		glPopMatrix();
-
-	glPopMatrix();
-}
 
 // The rest of the Character, Bone, RotationBounds implementation is
 // in character_impl.hpp. You should not need to modify it.
@@ -1,6 +1,8 @@
 #ifndef CHARACTER_IMPL_HPP
 #define CHARACTER_IMPL_HPP
 
+#include <cstdio>
+#include <cstring>
 #include <map>
 #include <string>
 #include <vector>
@@ -10,12 +12,15 @@ using namespace std;
 using glm::vec3;
 using glm::mat4;
 
-mat4 fromEulerAnglesZYX(float degz, float degy, float degx) {
-    mat4 r;
-    r = glm::rotate(r, glm::radians(degz), vec3(0,0,1));
-    r = glm::rotate(r, glm::radians(degy), vec3(0,1,0));
-    r = glm::rotate(r, glm::radians(degx), vec3(1,0,0));
-    return r;
+inline bool &logLoading() {
+    static bool log = true;
+    return log;
+}
+
+inline void logProgress(const char *message) {
+    if (logLoading()) {
+        std::cerr << message << std::endl;
+    }
 }
 
 template <typename T>
@@ -28,36 +33,36 @@ inline void Character::loadSkeleton(std::string asfFilename) {
     Reader r(&in);  
     while (r.good()) {
         if (r.expect("#")) {
-            std::cerr << "Ignoring comment line" << std::endl;
+            logProgress("Ignoring comment line");
             r.swallowLine();
         }    
         else if (r.expect(":version")) {
             r.swallowLine();
         }    
         else if (r.expect(":name")) {
-            std::cerr << "Swallowing name" << std::endl;
+            logProgress("Swallowing name");
             r.swallowLine();
         }    
         else if (r.expect(":units")) {
-            std::cerr << "Reading units" << std::endl;
+            logProgress("Reading units");
             parseUnits(r);
         }    
         else if (r.expect(":documentation")) {
-            std::cerr << "Reading documentation" << std::endl;
+            logProgress("Reading documentation");
             while (r.good() && !r.peek(":")) {
                 r.swallowLine();
             }
         }    
         else if (r.expect(":root")) {
-            std::cerr << "Reading root" << std::endl;
+            logProgress("Reading root");
             parseRoot(r);
         }    
         else if (r.expect(":bonedata")) {
-            std::cerr << "Reading bonedata" << std::endl;
+            logProgress("Reading bonedata");
             parseBonedata(r);
         }    
         else if (r.expect(":hierarchy")) {
-            std::cerr << "Reading hierarchy" << std::endl;
+            logProgress("Reading hierarchy");
             parseHierarchy(r);
         }    
         else {      
@@ -66,11 +71,39 @@ inline void Character::loadSkeleton(std::string asfFilename) {
             if (!r.good()) {
                 break;
             }
-            std::cerr << "Encountered unknown token" << std::endl;
-            std::cerr << "'" << tok << "'" << std::endl;
-            std::abort();
+            throw MocapError("Encountered unknown token '" + tok + "'");
         }
     } // end while (looping over file) 
+    assignChannels();
+    flatten();
+}
+
+// Breadth first from the root, so every bone comes after its parent
+inline void Character::flatten() {
+    skeleton.clear();
+    std::vector<Bone*> bones(rootNodeBones);
+    std::vector<int> parents(bones.size(), -1);
+    for (size_t i = 0; i < bones.size(); i++) {
+        const RotationBounds &bounds = bones[i]->getRotationBounds();
+        skeleton.addBone(bones[i]->getName(), parents[i], bones[i]->getChannel(),
+                         bounds.dofRX, bounds.dofRY, bounds.dofRZ,
+                         bones[i]->getBoneVector(), bones[i]->getInitialRotation());
+        for (size_t c = 0; c < bones[i]->children.size(); c++) {
+            bones.push_back(bones[i]->children[c]);
+            parents.push_back(i);
+        }
+    }
+    skeleton.solve(getCurrentCoordinateFrame());
+}
+
+// The root's six channels come first, then each bone's DOFs in turn
+inline void Character::assignChannels() {
+    channelCount = 6;
+    std::map<string, Bone*>::iterator it;
+    for (it = boneTable.begin(); it != boneTable.end(); ++it) {
+        it->second->setChannel(channelCount);
+        channelCount += it->second->getDofs();
+    }
 }
 
 inline void Character::parseUnits(Reader &r) {
@@ -104,15 +137,13 @@ inline void Character::parseRoot(Reader &r) {
         if (r.expect("order")) {
             cont = true;
             if (!r.expect("TX TY TZ RX RY RZ")) {
-                std::cerr << "'order' not in order expected" << std::endl;
-                std::abort();
+                throw MocapError("'order' not in order expected");
             }
         }    
         if (r.expect("axis")) {
             cont = true;
             if (!r.expect("XYZ")) {
-                std::cerr << "'axis' not in order expected" << std::endl;
-                std::abort();
+                throw MocapError("'axis' not in order expected");
             }
         }    
         if (r.expect("position")) {
@@ -140,18 +171,23 @@ inline void Character::parseBonedata(Reader &r) {
 
 inline void Character::parseHierarchy(Reader &r) {
     if (!r.expect("begin")) {
-        std::cerr << "Reading hierarchy, expected 'begin', not found" << std::endl;
-        std::abort();
+        throw MocapError("Reading hierarchy, expected 'begin', not found");
     }
     while (!r.expect("end")) {
         std::string line;
         std::string parent;
         r.readToken(parent);
+        if (!r.good()) {
+            throw MocapError("File ends inside hierarchy");
+        }
         r.readLine(line);    
         std::stringstream ss(line);
         std::string child;
         ss >> child;
         while (ss) {
+            if (boneTable.count(child) == 0 || (parent != "root" && boneTable.count(parent) == 0)) {
+                throw MocapError("Unknown bone in hierarchy: '" + parent + "' '" + child + "'");
+            }
             if (parent == "root") {
                 rootNodeBones.push_back(boneTable[child]);
             }
@@ -163,57 +199,251 @@ inline void Character::parseHierarchy(Reader &r) {
     }
 }
 
+// Decodes every frame of the file into the clip up front, so playing
+// it back never touches the file again
 inline void Character::loadAnimation(std::string amcFilename) {
-    if (anim)
-        delete anim;
-    anim = new std::ifstream(amcFilename.c_str());
-    resetFile();
-    nextFrame();
+    std::ifstream in(amcFilename.c_str());
+    Reader r(&in);
+    readAnimation(r);
 }
 
-inline void Character::nextFrame() {
-    animationFrame++;
-    Reader r(anim);
-    int frame;
-    r.readInt(frame);
-    if (!r.good()) {
-        resetFile();
-        return;
+// Every bone with DOFs must appear in every frame, frames must be
+// numbered consecutively and each line must give as many values as the
+// bone has DOFs, or the values would silently shift into the wrong
+// channels. A file cut off partway through a frame fails the same checks.
+template <typename R>
+inline void Character::readAnimation(R &r) {
+    readAnimation(r, clip);
+    if (clip.getFrameCount() > 0) {
+        setFrame(0);
+    }
+}
+
+template <typename R>
+inline void Character::readAnimation(R &r, Clip &out) const {
+    out.reset(channelCount);
+    // Header lines
+    while (r.expect("#") || r.expect(":")) {
+        r.swallowLine();
     }
-    while (!r.upcomingInt()) {
-        std::string bone;
-        r.readToken(bone);
+    // Marks the bones given in the current frame by their first channel
+    std::vector<char> given;
+    int previous = 0;
+    while (r.good()) {
+        int frame;
+        r.readInt(frame);
         if (!r.good()) {
-            resetFile();
-            return;
+            break;
         }
-        if (bone == "root") {
-            r.readFloat(position.x);
-            r.readFloat(position.y);
-            r.readFloat(position.z);
-            position = amc2meter(position);
-            position -= basePosition + baseVelocity*animationFrame/120.f;
-            r.readFloat(orientation.x);
-            r.readFloat(orientation.y);
-            r.readFloat(orientation.z);
-        } 
-        else {
-            boneTable[bone]->readPose(r);
+        if (out.getFrameCount() > 0 && frame != previous + 1) {
+            std::stringstream message;
+            message << "Frame " << frame << " follows frame " << previous;
+            throw MocapError(message.str());
+        }
+        previous = frame;
+        float *values = out.addFrame();
+        given.assign(channelCount, 0);
+        while (!r.upcomingInt()) {
+            std::string bone;
+            r.readToken(bone);
+            if (!r.good()) {
+                // A bone's values always follow its name
+                if (!bone.empty()) {
+                    std::stringstream message;
+                    message << "Animation ends at '" << bone << "' in frame " << frame;
+                    throw MocapError(message.str());
+                }
+                break;
+            }
+            float *dofs = values;
+            int count = 6;
+            if (bone != "root") {
+                std::map<string, Bone*>::const_iterator it = boneTable.find(bone);
+                if (it == boneTable.end()) {
+                    throw MocapError("Unknown bone '" + bone + "' in animation");
+                }
+                dofs += it->second->getChannel();
+                count = it->second->getDofs();
+            }
+            if (count > 0) {
+                given[dofs - values] = 1;
+            }
+            for (int c = 0; c < count; c++) {
+                if (!r.readFloat(dofs[c])) {
+                    std::stringstream message;
+                    message << "'" << bone << "' has " << c << " of its " << count
+                            << " values in frame " << frame;
+                    throw MocapError(message.str());
+                }
+            }
+        }
+        std::string missing = given[0] ? "" : "root";
+        std::map<string, Bone*>::const_iterator it;
+        for (it = boneTable.begin(); it != boneTable.end() && missing.empty(); ++it) {
+            if (it->second->getDofs() > 0 && !given[it->second->getChannel()]) {
+                missing = it->first;
+            }
+        }
+        if (!missing.empty()) {
+            std::stringstream message;
+            message << "'" << missing << "' is missing from frame " << frame;
+            throw MocapError(message.str());
         }
     }
 }
 
-inline void Character::resetFile() {
-    if (!anim) {
+inline void Character::loadBinary(std::string filename, std::string clipName) {
+    if (!mocap.open(filename)) {
+        throw MocapError("Failed to open " + filename);
+    }
+    if (mocap.size() < sizeof(MocapHeader)) {
+        throw MocapError(filename + " is too short for a header");
+    }
+    const char *base = mocap.data();
+    MocapHeader header;
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, MOCAP_MAGIC, 4) != 0 || header.version != MOCAP_VERSION) {
+        throw MocapError(filename + " is not a mocap file of this version");
+    }
+    // The root alone has six channels
+    if (header.channelCount < 6) {
+        throw MocapError(filename + " has fewer channels than the root");
+    }
+    size_t bonesOffset = alignMocapOffset(sizeof(header));
+    size_t clipsOffset = alignMocapOffset(bonesOffset + header.boneCount * sizeof(MocapBone));
+    if (clipsOffset + header.clipCount * sizeof(MocapClip) > mocap.size()) {
+        throw MocapError(filename + " ends inside its bone or clip table");
+    }
+    // Check the hierarchy before building any of it
+    const MocapBone *records = (const MocapBone*)(base + bonesOffset);
+    for (uint32_t i = 0; i < header.boneCount; i++) {
+        int dofs = (records[i].dof[0] != 0) + (records[i].dof[1] != 0) + (records[i].dof[2] != 0);
+        if (records[i].parent < -1 || records[i].parent >= (int32_t)i || records[i].channel < 6
+            || records[i].channel + dofs > (int32_t)header.channelCount) {
+            std::stringstream message;
+            message << "Bone " << i << " in " << filename << " has a bad parent or channel";
+            throw MocapError(message.str());
+        }
+    }
+    deg = header.degrees != 0;
+    channelCount = header.channelCount;
+    std::vector<Bone*> bones;
+    for (uint32_t i = 0; i < header.boneCount; i++) {
+        Bone *bone = new Bone(records[i], deg);
+        bones.push_back(bone);
+        boneTable[bone->getName()] = bone;
+        if (records[i].parent < 0) {
+            rootNodeBones.push_back(bone);
+        }
+        else {
+            bones[records[i].parent]->addChild(bone);
+        }
+    }
+    flatten();
+    const MocapClip *clips = (const MocapClip*)(base + clipsOffset);
+    for (uint32_t c = 0; c < header.clipCount; c++) {
+        std::string name(clips[c].name, strnlen(clips[c].name, sizeof(clips[c].name)));
+        if (!clipName.empty() && name != clipName) {
+            continue;
+        }
+        // Written so a huge offset or frame count cannot wrap around past
+        // the check
+        size_t frameBytes = (size_t)channelCount * sizeof(float);
+        if (clips[c].offset % sizeof(float) != 0 || clips[c].offset > mocap.size()
+            || clips[c].frameCount > (mocap.size() - clips[c].offset) / frameBytes) {
+            throw MocapError(filename + " ends inside clip '" + name + "'");
+        }
+        clip.view(channelCount, (const float*)(base + clips[c].offset), clips[c].frameCount);
+        if (clip.getFrameCount() > 0) {
+            setFrame(0);
+        }
         return;
     }
-    animationFrame = 0;
-    anim->clear();
-    anim->seekg(0);
-    Reader r(anim);
-    r.swallowLine();
-    r.swallowLine();
-    r.swallowLine();
+    if (clipName.empty()) {
+        throw MocapError(filename + " has no clips");
+    }
+    throw MocapError("No clip '" + clipName + "' in " + filename);
+}
+
+inline bool Character::saveBinary(std::string filename, const std::vector<Clip> &clips,
+                                  const std::vector<std::string> &clipNames) const {
+    // Breadth first from the root, so parents come before children
+    std::vector<Bone*> bones(rootNodeBones);
+    std::vector<int> parents(bones.size(), -1);
+    for (size_t i = 0; i < bones.size(); i++) {
+        for (size_t c = 0; c < bones[i]->children.size(); c++) {
+            bones.push_back(bones[i]->children[c]);
+            parents.push_back(i);
+        }
+    }
+    MocapHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MOCAP_MAGIC, 4);
+    header.version = MOCAP_VERSION;
+    header.boneCount = bones.size();
+    header.clipCount = clips.size();
+    header.channelCount = channelCount;
+    header.degrees = deg;
+    std::vector<MocapBone> boneRecords(bones.size());
+    for (size_t i = 0; i < bones.size(); i++) {
+        bones[i]->toRecord(boneRecords[i]);
+        boneRecords[i].parent = parents[i];
+    }
+    size_t bonesOffset = alignMocapOffset(sizeof(header));
+    size_t clipsOffset = alignMocapOffset(bonesOffset + bones.size() * sizeof(MocapBone));
+    size_t offset = alignMocapOffset(clipsOffset + clips.size() * sizeof(MocapClip));
+    std::vector<MocapClip> clipRecords(clips.size());
+    for (size_t c = 0; c < clips.size(); c++) {
+        memset(&clipRecords[c], 0, sizeof(MocapClip));
+        strncpy(clipRecords[c].name, clipNames[c].c_str(), sizeof(clipRecords[c].name) - 1);
+        clipRecords[c].frameCount = clips[c].getFrameCount();
+        clipRecords[c].offset = offset;
+        offset = alignMocapOffset(offset + (size_t)clips[c].getFrameCount() * channelCount * sizeof(float));
+    }
+
+    // Write to a temporary file and rename it into place, so a crash
+    // mid-write never leaves a file that looks valid
+    std::string tempFile = filename + ".tmp";
+    FILE *out = fopen(tempFile.c_str(), "wb");
+    if (out == NULL) {
+        return false;
+    }
+    static const char padding[8] = {0};
+    size_t written = 0;
+    bool ok = true;
+    // Pads up to where the next section starts, then writes it
+    auto write = [&](size_t at, const void *data, size_t bytes) {
+        ok = ok && fwrite(padding, 1, at - written, out) == at - written
+            && (bytes == 0 || fwrite(data, 1, bytes, out) == bytes);
+        written = at + bytes;
+    };
+    write(0, &header, sizeof(header));
+    write(bonesOffset, boneRecords.data(), boneRecords.size() * sizeof(MocapBone));
+    write(clipsOffset, clipRecords.data(), clipRecords.size() * sizeof(MocapClip));
+    for (size_t c = 0; c < clips.size(); c++) {
+        size_t bytes = (size_t)clips[c].getFrameCount() * channelCount * sizeof(float);
+        write(clipRecords[c].offset, bytes > 0 ? clips[c].getFrame(0) : NULL, bytes);
+    }
+    ok = fclose(out) == 0 && ok;
+    if (ok) {
+        remove(filename.c_str());
+        ok = rename(tempFile.c_str(), filename.c_str()) == 0;
+    }
+    if (!ok) {
+        remove(tempFile.c_str());
+    }
+    return ok;
+}
+
+inline void Character::setFrame(int frame) {
+    animationFrame = frame;
+    const float *values = clip.getFrame(frame);
+    position = amc2meter(vec3(values[0], values[1], values[2]));
+    // The file numbers its frames from 1
+    position -= basePosition + baseVelocity*(frame + 1)/120.f;
+    orientation = vec3(values[3], values[4], values[5]);
+    skeleton.pose(values);
+    skeleton.solve(getCurrentCoordinateFrame());
 }
 
 inline RotationBounds::RotationBounds() {
@@ -238,7 +468,7 @@ inline void RotationBounds::setdof(bool rx, bool ry, bool rz) {
 
 inline void RotationBounds::setR(int index, float min, float max) {
     if (index > dofs) {
-        std::abort(); // Trying to set past the max index.
+        throw MocapError("Limits past the bone's DOFs");
     }
     if (index == 0) {
         if (dofRX) {
@@ -251,7 +481,7 @@ inline void RotationBounds::setR(int index, float min, float max) {
             minRZ = min;
             maxRZ = max;
         } else {
-            abort();
+            throw MocapError("Limits past the bone's DOFs");
         }
     } else if (index == 1) {
         if (dofRX && dofRY) {
@@ -264,48 +494,48 @@ inline void RotationBounds::setR(int index, float min, float max) {
             minRZ = min;
             maxRZ = max;
         } else {
-            abort();
+            throw MocapError("Limits past the bone's DOFs");
         }
     } else if (index == 2) {
         if (dofRX && dofRY && dofRZ) {
             minRZ = min;
             maxRZ = max;
         } else {
-            abort();
+            throw MocapError("Limits past the bone's DOFs");
         }
     } else {
-        abort();
+        throw MocapError("Limits past the bone's DOFs");
     }
 }
 
 const bool ABORT_ON_ERROR=true;
 
-inline void assume(bool b) {
+inline void assume(bool b, const char *message) {
     if (!b && ABORT_ON_ERROR) {
-        std::abort();
+        throw MocapError(message);
     }
 }
 
 inline void Bone::constructFromFile(Reader &r, bool deg) {
     this->deg = deg;
-    currentRotation = mat4();
+    channel = 0;
     while (!r.expect("end")) {    
         if (r.expect("id")) {
             r.readInt(id);      
         }    
-        if (r.expect("name")) {
+        else if (r.expect("name")) {
             r.readToken(name);
         }    
-        if (r.expect("direction")) {
+        else if (r.expect("direction")) {
             r.readFloat(direction.x);
             r.readFloat(direction.y);
             r.readFloat(direction.z);
         }    
-        if (r.expect("length")) {
+        else if (r.expect("length")) {
             r.readFloat(length);
             length = amc2meter(length);
         }    
-        if (r.expect("axis")) {
+        else if (r.expect("axis")) {
             float ax, ay, az;
             std::string axisType;
             r.readFloat(ax);
@@ -315,26 +545,35 @@ inline void Bone::constructFromFile(Reader &r, bool deg) {
             if (axisType == "XYZ") {
                 initialRotation = fromEulerAnglesZYX(az, ay, ax);
             } else {
-                std::abort();
+                throw MocapError("Bone '" + name + "' has unsupported axis order '" + axisType + "'");
             }      
         }    
-        if (r.expect("dof")) {
+        else if (r.expect("dof")) {
             bool rx, ry, rz;
             rx = r.expect("rx");
             ry = r.expect("ry");
             rz = r.expect("rz");
             rotationBounds.setdof(rx, ry, rz);
         }    
-        if (r.expect("limits")) {
+        else if (r.expect("limits")) {
             for (int dof=0; dof<rotationBounds.dofs; dof++) {
-                assume(r.expect("("));
+                assume(r.expect("("), "Expected '(' in bone limits");
                 float min, max;
                 r.readFloat(min);
                 r.readFloat(max);
-                assume(r.expect(")"));
+                assume(r.expect(")"), "Expected ')' in bone limits");
                 rotationBounds.setR(dof, min, max);
             }
         }    
+        else {
+            // Nothing else can be read here, so stop rather than loop
+            std::string tok;
+            r.readToken(tok);
+            if (!r.good()) {
+                throw MocapError("File ends inside bone '" + name + "'");
+            }
+            throw MocapError("Encountered unknown token '" + tok + "' in bone '" + name + "'");
+        }
     } // read "end" token  
     vec3 skin(0.8, 0.7, 0.4);
     vec3 shirt(1.0, 0.07, 0.57);
@@ -420,30 +659,50 @@ inline void Bone::constructFromFile(Reader &r, bool deg) {
     //cylinder = new TaperedCylinder(length, r1, r2, c1, c2);
 }
 
-inline std::string Bone::getName() {
-    return name;
+inline Bone::Bone(const MocapBone &record, bool deg) {
+    this->deg = deg;
+    id = 0;
+    name.assign(record.name, strnlen(record.name, sizeof(record.name)));
+    direction = vec3(record.direction[0], record.direction[1], record.direction[2]);
+    length = record.length;
+    memcpy(&initialRotation[0][0], record.initialRotation, sizeof(record.initialRotation));
+    rotationBounds.setdof(record.dof[0] != 0, record.dof[1] != 0, record.dof[2] != 0);
+    rotationBounds.minRX = record.limits[0][0];
+    rotationBounds.maxRX = record.limits[0][1];
+    rotationBounds.minRY = record.limits[1][0];
+    rotationBounds.maxRY = record.limits[1][1];
+    rotationBounds.minRZ = record.limits[2][0];
+    rotationBounds.maxRZ = record.limits[2][1];
+    channel = record.channel;
 }
 
-inline void Bone::addChild(Bone* child) {
-    children.push_back(child);
+inline void Bone::toRecord(MocapBone &record) {
+    memset(&record, 0, sizeof(record));
+    strncpy(record.name, name.c_str(), sizeof(record.name) - 1);
+    record.parent = -1;
+    record.channel = channel;
+    record.direction[0] = direction.x;
+    record.direction[1] = direction.y;
+    record.direction[2] = direction.z;
+    record.length = length;
+    memcpy(record.initialRotation, &initialRotation[0][0], sizeof(record.initialRotation));
+    record.dof[0] = rotationBounds.dofRX;
+    record.dof[1] = rotationBounds.dofRY;
+    record.dof[2] = rotationBounds.dofRZ;
+    record.limits[0][0] = rotationBounds.minRX;
+    record.limits[0][1] = rotationBounds.maxRX;
+    record.limits[1][0] = rotationBounds.minRY;
+    record.limits[1][1] = rotationBounds.maxRY;
+    record.limits[2][0] = rotationBounds.minRZ;
+    record.limits[2][1] = rotationBounds.maxRZ;
 }
 
-inline void Bone::readPose(Reader &r) {
-    float rx=0, ry=0, rz=0;
-    if (rotationBounds.dofRX) {
-        r.readFloat(rx);
-    }
-    if (rotationBounds.dofRY) {
-        r.readFloat(ry);
-    }
-    if (rotationBounds.dofRZ) {
-        r.readFloat(rz);
-    }
-    currentRotation = fromEulerAnglesZYX(rz, ry, rx);
+inline std::string Bone::getName() {
+    return name;
 }
 
-inline mat4 Bone::getCurrentLocalRotation() {
-    return initialRotation * currentRotation * glm::inverse(initialRotation);
+inline void Bone::addChild(Bone* child) {
+    children.push_back(child);
 }
 
 #endif
@@ -0,0 +1,69 @@
+#ifndef CLIP_HPP
+#define CLIP_HPP
+
+#include <algorithm>
+#include <vector>
+
+// A motion capture clip decoded into one flat array, holding a row of
+// channel values for every frame. Which channels belong to which bone
+// is up to the skeleton that fills it in (see Character::loadAnimation),
+// so reading any frame is just an index into the array.
+class Clip {
+public:
+    Clip(): channels(0), viewed(NULL), viewedFrames(0) {}
+    // Empties the clip and sets the number of channels in a frame
+    void reset(int channels);
+    // Appends a frame that starts out as a copy of the last one (all
+    // zeros for the first) and returns its row to fill in
+    float *addFrame();
+    // Shows frames stored elsewhere, such as a mapped binary mocap file,
+    // instead of holding its own; they must outlive the clip's use
+    void view(int channels, const float *frames, int frameCount);
+    const float *getFrame(int frame) const;
+    int getFrameCount() const;
+    int getChannelCount() const;
+protected:
+    int channels;
+    std::vector<float> values;
+    const float *viewed;
+    int viewedFrames;
+};
+
+// Definitions below
+
+inline void Clip::reset(int channelCount) {
+    channels = channelCount;
+    values.clear();
+    viewed = NULL;
+    viewedFrames = 0;
+}
+
+inline float *Clip::addFrame() {
+    size_t last = values.size();
+    values.resize(last + channels);
+    if (last > 0)
+        std::copy(values.begin() + last - channels, values.begin() + last, values.begin() + last);
+    return &values[last];
+}
+
+inline void Clip::view(int channelCount, const float *frames, int frameCount) {
+    reset(channelCount);
+    viewed = frames;
+    viewedFrames = frameCount;
+}
+
+inline const float *Clip::getFrame(int frame) const {
+    return (viewed ? viewed : &values[0]) + (size_t)frame * channels;
+}
+
+inline int Clip::getFrameCount() const {
+    if (viewed)
+        return viewedFrames;
+    return channels > 0 ? values.size() / channels : 0;
+}
+
+inline int Clip::getChannelCount() const {
+    return channels;
+}
+
+#endif
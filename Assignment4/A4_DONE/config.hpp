@@ -31,6 +31,16 @@ namespace Config {
     const glm::vec3 baseVelocity(0,0,0);
     */
 
+    /*
+    // Walk cycle from a binary file made with
+    //   --convert 08.mcap 08.asf 08_01_cycle.amc 08_01.amc
+    // where the second name picks the clip
+    const std::string asfFile = dataDir + "\\08.mcap";
+    const std::string amcFile = "08_01_cycle";
+    const glm::vec3 basePosition(0.421534, 0, -0.24297);
+    const glm::vec3 baseVelocity(-0.0221038, 0.0296905, 1.55497);
+    */
+
 }
 
 #endif
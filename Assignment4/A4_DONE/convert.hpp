@@ -0,0 +1,225 @@
+#ifndef CONVERT_HPP
+#define CONVERT_HPP
+
+#include "bench.hpp"
+#include "character.hpp"
+#include "parallel.hpp"
+#include "reader.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+// Converts text mocap files to the binary format in mocapfile.hpp. Like
+// the benchmarks, these run before any window is created.
+namespace Convert {
+
+    // The clip name an .amc file is stored under: 05_01.amc becomes 05_01
+    std::string clipName(std::string amcFile);
+    // Writes the skeleton in asfFile and every clip in amcFiles, decoded
+    // for it, to output
+    int files(std::string output, std::string asfFile, std::vector<std::string> amcFiles);
+    // Names of the files in directory ending in extension, sorted
+    std::vector<std::string> listFiles(std::string directory, std::string extension);
+    // Parses every .amc file in directory with its skeleton on a pool of
+    // threads (0 means one per core), checking both as they are read, and
+    // writes each to a .mcap file of its own in output. Each skeleton is
+    // parsed once and shared by its clips. A malformed file is reported
+    // and skipped; the rest are still converted.
+    int library(std::string directory, std::string output, int threads);
+
+    // Definitions below
+
+    inline std::string clipName(std::string amcFile) {
+        size_t slash = amcFile.find_last_of("/\\");
+        std::string name = amcFile.substr(slash == std::string::npos ? 0 : slash + 1);
+        return name.substr(0, name.find_last_of('.'));
+    }
+
+    inline int files(std::string output, std::string asfFile, std::vector<std::string> amcFiles) {
+        Character character(asfFile, "", vec3(0,0,0), vec3(0,0,0));
+        if (!character.hasSkeleton()) {
+            printf("Failed to load skeleton %s\n", asfFile.c_str());
+            return EXIT_FAILURE;
+        }
+        std::vector<Clip> clips;
+        std::vector<std::string> names;
+        for (size_t f = 0; f < amcFiles.size(); f++) {
+            std::ifstream in(amcFiles[f].c_str());
+            if (!in) {
+                printf("Failed to open %s\n", amcFiles[f].c_str());
+                return EXIT_FAILURE;
+            }
+            Reader r(&in);
+            character.readAnimation(r);
+            clips.push_back(character.getClip());
+            names.push_back(clipName(amcFiles[f]));
+            printf("%-16s %8d frames\n", names.back().c_str(), clips.back().getFrameCount());
+        }
+        if (!character.saveBinary(output, clips, names)) {
+            printf("Failed to write %s\n", output.c_str());
+            return EXIT_FAILURE;
+        }
+        printf("Wrote %s\n", output.c_str());
+        return EXIT_SUCCESS;
+    }
+
+#ifdef _WIN32
+
+    inline std::vector<std::string> listFiles(std::string directory, std::string extension) {
+        std::vector<std::string> names;
+        WIN32_FIND_DATAA found;
+        HANDLE search = FindFirstFileA((directory + "\\*" + extension).c_str(), &found);
+        if (search != INVALID_HANDLE_VALUE) {
+            do {
+                names.push_back(found.cFileName);
+            } while (FindNextFileA(search, &found));
+            FindClose(search);
+        }
+        std::sort(names.begin(), names.end());
+        return names;
+    }
+
+#else
+
+    inline std::vector<std::string> listFiles(std::string directory, std::string extension) {
+        std::vector<std::string> names;
+        DIR *dir = opendir(directory.c_str());
+        if (dir == NULL)
+            return names;
+        while (struct dirent *entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.size() > extension.size()
+                && name.compare(name.size() - extension.size(), extension.size(), extension) == 0)
+                names.push_back(name);
+        }
+        closedir(dir);
+        std::sort(names.begin(), names.end());
+        return names;
+    }
+
+#endif
+
+    // A skeleton shared by the clips recorded on it, or why it failed
+    struct SharedSkeleton {
+        std::string asfFile;
+        Character *character;
+        std::string error;
+    };
+
+    // What became of one .amc file
+    struct Converted {
+        int frames;
+        double bytes, seconds;
+        std::string error;
+    };
+
+    inline int library(std::string directory, std::string output, int threads) {
+        std::vector<std::string> names = listFiles(directory, ".amc");
+        if (names.empty()) {
+            printf("No .amc files in %s\n", directory.c_str());
+            return EXIT_FAILURE;
+        }
+        if (threads <= 0)
+            threads = Parallel::defaultThreads();
+        // Progress lines from every thread at once would bury the report
+        logLoading() = false;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        // Every skeleton first, then the clips against them read-only
+        std::vector<SharedSkeleton> skeletons;
+        std::vector<int> skeletonOf(names.size());
+        for (size_t i = 0; i < names.size(); i++) {
+            std::string asfFile = Bench::skeletonFile(directory + "/" + names[i]);
+            size_t k = 0;
+            while (k < skeletons.size() && skeletons[k].asfFile != asfFile)
+                k++;
+            if (k == skeletons.size()) {
+                SharedSkeleton skeleton = {asfFile, NULL, ""};
+                skeletons.push_back(skeleton);
+            }
+            skeletonOf[i] = k;
+        }
+        Parallel::forEach(skeletons.size(), threads, [&](int k) {
+            SharedSkeleton &s = skeletons[k];
+            try {
+                s.character = new Character(s.asfFile, "", vec3(0,0,0), vec3(0,0,0));
+                if (!s.character->hasSkeleton())
+                    s.error = "no skeleton " + s.asfFile.substr(directory.size() + 1);
+            }
+            catch (const MocapError &e) {
+                s.error = e.what();
+            }
+        });
+        std::vector<Converted> converted(names.size());
+        Parallel::forEach(names.size(), threads, [&](int i) {
+            Converted &c = converted[i];
+            c.frames = 0;
+            c.bytes = 0;
+            c.seconds = 0;
+            const SharedSkeleton &s = skeletons[skeletonOf[i]];
+            if (!s.error.empty()) {
+                c.error = s.error;
+                return;
+            }
+            std::string amcFile = directory + "/" + names[i];
+            try {
+                std::chrono::steady_clock::time_point parse = std::chrono::steady_clock::now();
+                std::ifstream in(amcFile.c_str());
+                Reader r(&in);
+                std::vector<Clip> clips(1);
+                s.character->readAnimation(r, clips[0]);
+                c.seconds = Bench::secondsSince(parse);
+                c.frames = clips[0].getFrameCount();
+                in.clear();
+                c.bytes = in.seekg(0, std::ios::end).tellg();
+                std::vector<std::string> clipNames(1, clipName(amcFile));
+                if (!s.character->saveBinary(output + "/" + clipNames[0] + ".mcap", clips, clipNames))
+                    c.error = "failed to write " + clipNames[0] + ".mcap";
+            }
+            catch (const MocapError &e) {
+                c.error = e.what();
+            }
+        });
+        double seconds = Bench::secondsSince(start);
+        for (size_t k = 0; k < skeletons.size(); k++)
+            delete skeletons[k].character;
+        logLoading() = true;
+
+        printf("%-16s %8s %8s %10s  %s\n", "file", "MB", "frames", "MB/s", "");
+        int failed = 0;
+        double totalBytes = 0, totalFrames = 0;
+        for (size_t i = 0; i < names.size(); i++) {
+            const Converted &c = converted[i];
+            if (!c.error.empty()) {
+                printf("%-16s %8s %8s %10s  %s\n", names[i].c_str(), "", "", "", c.error.c_str());
+                failed++;
+                continue;
+            }
+            printf("%-16s %8.2f %8d %10.1f\n", names[i].c_str(), c.bytes / 1e6, c.frames,
+                   c.bytes / 1e6 / c.seconds);
+            totalBytes += c.bytes;
+            totalFrames += c.frames;
+        }
+        printf("%d of %d files converted on %d thread%s: %.0f frames, %.2f MB in %.3f s (%.1f MB/s)\n",
+               (int)names.size() - failed, (int)names.size(), threads, threads == 1 ? "" : "s",
+               totalFrames, totalBytes / 1e6, seconds, totalBytes / 1e6 / seconds);
+        return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+}
+
+#endif
@@ -1,7 +1,9 @@
 #include "engine.hpp"
+#include "bench.hpp"
 #include "camera.hpp"
 #include "character.hpp"
 #include "config.hpp"
+#include "convert.hpp"
 #include "draw.hpp"
 #include "spline.hpp"
 #include <glm/glm.hpp>
@@ -20,12 +22,19 @@ public:
     Character *character;
     Spline3 *path;
     float time; // time along the path
+    int pickedBone; // in the character's skeleton, or -1
 
     SplineWalker() {
         window = createWindow("Walk the Spline", 1280, 720);
         camera = new OrbitCamera(5, 0, 0, Perspective(30, 16/9., 0.1, 20));
-        character = new Character(Config::asfFile, Config::amcFile,
-                                  Config::basePosition, Config::baseVelocity);
+        try {
+            character = new Character(Config::asfFile, Config::amcFile,
+                                      Config::basePosition, Config::baseVelocity);
+        }
+        catch (const MocapError &e) {
+            errorMessage(e.what());
+            exit(EXIT_FAILURE);
+        }
         if (!character->hasSkeleton()) {
             errorMessage("Failed to load file " + Config::asfFile);
             exit(EXIT_FAILURE);
@@ -60,6 +69,7 @@ public:
         path->points.push_back(SplinePoint3(20, vec3(5,0,0), vec3(0,0,1)));
         
         time = 0;
+        pickedBone = -1;
     }
 
     ~SplineWalker() {
@@ -93,6 +103,20 @@ public:
         camera->setCenter(glm::mix(c, vec3(p.x, 0.8, p.z), 10*dt));
     }
 
+    // Places the character on the path, its z-axis along the velocity
+    mat4 characterTransform() {
+        vec3 p = path->getValue(time);
+        vec3 v = glm::normalize(path->getDerivative(time));
+        vec3 z = vec3(0, 0, 1);
+        vec3 rotAxis = glm::cross(z, v);
+        mat4 transform = glm::translate(mat4(), p);
+        if (glm::length(rotAxis) > 0)
+            transform = glm::rotate(transform, acosf(glm::clamp(glm::dot(v, z), -1.f, 1.f)), glm::normalize(rotAxis));
+        else if (v.z < 0)
+            transform = glm::rotate(transform, (float)M_PI, vec3(0,1,0));
+        return transform;
+    }
+
     void setAmbientLight(vec3 color) {
         glLightModelfv(GL_LIGHT_MODEL_AMBIENT, &color[0]);
     }
@@ -130,27 +154,14 @@ public:
         glColor3f(0.8,0.2,0.2);
         drawSpline(path);
 
-        // TODO: Translate the character to align with the position
-        // obtained from the path spline, i.e. path->getValue(time).
-        // Also rotate it so its z-axis aligns with the path spline's
-        // velocity, path->getDerivative(time).
-		vec3 p = path->getValue(time);
-		vec3 v = glm::normalize(path->getDerivative(time));
-		vec3 z = vec3(0, 0, 1);
-		float theta = acos(glm::dot(v, z))*180.0 / M_PI; //deg -> radians
-		vec3 rotAxis = glm::cross(z, v);
-
-		//Draw::axes(0.5);
+        // Translate the character to align with the position obtained
+        // from the path spline and rotate it so its z-axis aligns with
+        // the path spline's velocity
+        mat4 transform = characterTransform();
         glColor3f(1,0.8,0.2);
         glPushMatrix();
-			//1. translate to position along the spline
-			glTranslatef(p.x, p.y, p.z);
-			glPushMatrix();
-				//2. rotate about +/-y axis to face along v
-				glRotatef(theta, rotAxis.x, rotAxis.y, rotAxis.z);
-				//Draw::axes(0.5);
-				character->draw();
-			glPopMatrix();
+        glMultMatrixf(&transform[0][0]);
+        character->draw(pickedBone);
         glPopMatrix();
 
         SDL_GL_SwapWindow(window);
@@ -200,9 +211,52 @@ public:
     void onMouseMotion(SDL_MouseMotionEvent &e) {
         camera->onMouseMotion(e);
     }
+
+    // Right click picks a bone and shows its name in the title bar, or
+    // clears the pick on a miss
+    void onMouseButtonDown(SDL_MouseButtonEvent &e) {
+        if (e.button != SDL_BUTTON_RIGHT)
+            return;
+        // The camera's matrices are still current from the last frame;
+        // unprojecting through the character's transform as well gives
+        // the ray in the space of the skeleton's palette
+        GLdouble view[16], projection[16];
+        GLint viewport[4];
+        glGetDoublev(GL_MODELVIEW_MATRIX, view);
+        glGetDoublev(GL_PROJECTION_MATRIX, projection);
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        mat4 transform = characterTransform();
+        GLdouble modelview[16];
+        for (int c = 0; c < 4; c++)
+            for (int r = 0; r < 4; r++) {
+                modelview[4*c + r] = 0;
+                for (int k = 0; k < 4; k++)
+                    modelview[4*c + r] += view[4*k + r]*transform[c][k];
+            }
+        double x = e.x, y = viewport[3] - e.y;
+        double nearPoint[3], farPoint[3];
+        gluUnProject(x, y, 0, modelview, projection, viewport, &nearPoint[0], &nearPoint[1], &nearPoint[2]);
+        gluUnProject(x, y, 1, modelview, projection, viewport, &farPoint[0], &farPoint[1], &farPoint[2]);
+        vec3 origin(nearPoint[0], nearPoint[1], nearPoint[2]);
+        vec3 direction = vec3(farPoint[0], farPoint[1], farPoint[2]) - origin;
+        const Skeleton &skeleton = character->getSkeleton();
+        pickedBone = skeleton.pick(origin, direction, 0.05);
+        std::string title = "Walk the Spline";
+        if (pickedBone >= 0)
+            title += " - " + skeleton.getName(pickedBone);
+        SDL_SetWindowTitle(window, title.c_str());
+    }
 };
 
 int main(int argc, char **argv) {
+    // Benchmark and conversion modes run without opening a window
+    std::string mode = argc > 1 ? argv[1] : "";
+    if (mode == "--bench-reader")
+        return Bench::reader(std::vector<std::string>(argv + 2, argv + argc));
+    if (mode == "--convert" && argc > 3)
+        return Convert::files(argv[2], argv[3], std::vector<std::string>(argv + 4, argv + argc));
+    if (mode == "--convert-library" && argc > 2)
+        return Convert::library(argv[2], argc > 3 ? argv[3] : argv[2], argc > 4 ? atoi(argv[4]) : 0);
     SplineWalker app;
     app.run();
     return EXIT_SUCCESS;
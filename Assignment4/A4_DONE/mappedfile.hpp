@@ -0,0 +1,185 @@
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <cstddef>
+#include <string>
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file. The pages are loaded
+// lazily by the OS as they are touched, and unmapped when the
+// MappedFile is closed or destroyed.
+class MappedFile {
+public:
+    MappedFile();
+    MappedFile(std::string filename);
+    ~MappedFile();
+    // Maps the file, returns false if it could not be opened
+    bool open(std::string filename);
+    void close();
+    bool isOpen() const { return opened; }
+    // Start of the mapped bytes; NULL for an empty file
+    const char *data() const { return bytes; }
+    size_t size() const { return length; }
+    // Hint that the mapping will be read front to back
+    void adviseSequential();
+private:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    const char *bytes;
+    size_t length;
+    bool opened;
+#ifdef _WIN32
+    HANDLE file, mapping;
+#endif
+};
+
+// Size in bytes and last modification time of a file, used to tell
+// whether data derived from it is out of date. The time is in
+// platform-specific units. Returns false if the file does not exist.
+bool getFileStamp(std::string filename, long long &size, long long &modified);
+
+// Definitions below
+
+inline MappedFile::MappedFile(): bytes(NULL), length(0), opened(false) {
+#ifdef _WIN32
+    file = INVALID_HANDLE_VALUE;
+    mapping = NULL;
+#endif
+}
+
+inline MappedFile::MappedFile(std::string filename): MappedFile() {
+    open(filename);
+}
+
+inline MappedFile::~MappedFile() {
+    close();
+}
+
+#ifdef _WIN32
+
+inline bool MappedFile::open(std::string filename) {
+    close();
+    file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                       NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize)) {
+        close();
+        return false;
+    }
+    length = (size_t)fileSize.QuadPart;
+    opened = true;
+    if (length == 0)
+        return true;
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        close();
+        return false;
+    }
+    bytes = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (bytes == NULL) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+inline void MappedFile::close() {
+    if (bytes != NULL)
+        UnmapViewOfFile(bytes);
+    if (mapping != NULL)
+        CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+    file = INVALID_HANDLE_VALUE;
+    mapping = NULL;
+    bytes = NULL;
+    length = 0;
+    opened = false;
+}
+
+inline void MappedFile::adviseSequential() {
+    // FILE_FLAG_SEQUENTIAL_SCAN was already passed to CreateFile
+}
+
+inline bool getFileStamp(std::string filename, long long &size, long long &modified) {
+    WIN32_FILE_ATTRIBUTE_DATA info;
+    if (!GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &info))
+        return false;
+    size = ((long long)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    modified = ((long long)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+    return true;
+}
+
+#else
+
+inline bool MappedFile::open(std::string filename) {
+    close();
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    length = (size_t)st.st_size;
+    opened = true;
+    if (length > 0) {
+        void *p = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            ::close(fd);
+            length = 0;
+            opened = false;
+            return false;
+        }
+        bytes = (const char*)p;
+    }
+    // The mapping stays valid after the descriptor is closed
+    ::close(fd);
+    return true;
+}
+
+inline void MappedFile::close() {
+    if (bytes != NULL)
+        munmap((void*)bytes, length);
+    bytes = NULL;
+    length = 0;
+    opened = false;
+}
+
+inline void MappedFile::adviseSequential() {
+    if (bytes != NULL)
+        madvise((void*)bytes, length, MADV_SEQUENTIAL);
+}
+
+inline bool getFileStamp(std::string filename, long long &size, long long &modified) {
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0)
+        return false;
+    size = (long long)st.st_size;
+#ifdef __APPLE__
+    modified = (long long)st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+    modified = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef MOCAPFILE_HPP
+#define MOCAPFILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Layout of the binary mocap file (.mcap) written by --convert. The
+// header is followed by, each starting on an 8-byte boundary: the bones
+// in hierarchy order (every parent before its children), the clips, and
+// each clip's frames as frameCount rows of channelCount floats, laid out
+// as in Clip. Values are stored in native byte order.
+struct MocapHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t boneCount;
+    uint32_t clipCount;
+    uint32_t channelCount;
+    // Nonzero if the skeleton's angles are in degrees
+    uint32_t degrees;
+};
+
+struct MocapBone {
+    char name[32];
+    // Index of the parent bone, or -1 for one attached to the root
+    int32_t parent;
+    // Channel of the bone's first DOF in a frame
+    int32_t channel;
+    float direction[3];
+    // In meters
+    float length;
+    float initialRotation[16];
+    // Whether the bone rotates about x, y and z, and the limits of each
+    uint8_t dof[3];
+    uint8_t reserved;
+    float limits[3][2];
+};
+
+struct MocapClip {
+    // Usually the .amc file's name without the extension
+    char name[32];
+    uint32_t frameCount;
+    uint32_t reserved;
+    // Where the clip's first frame starts in the file
+    uint64_t offset;
+};
+
+static const char MOCAP_MAGIC[4] = {'M', 'C', 'A', 'P'};
+static const uint32_t MOCAP_VERSION = 1;
+
+// Round a byte offset up to the next 8-byte boundary
+inline size_t alignMocapOffset(size_t offset) {
+    return (offset + 7) & ~(size_t)7;
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace Parallel {
+
+    // Number of hardware threads, at least 1
+    int defaultThreads();
+    // Calls f(i) for every i in [0, count) using up to the given number of
+    // threads (0 means defaultThreads()). Work items are handed out one at
+    // a time, so uneven items balance out. The calling thread also works
+    // and the call returns when every item is done.
+    template <typename F>
+    void forEach(int count, int threads, F f);
+
+    // Definitions below
+
+    inline int defaultThreads() {
+        int n = std::thread::hardware_concurrency();
+        return n > 0 ? n : 1;
+    }
+
+    template <typename F>
+    inline void forEach(int count, int threads, F f) {
+        if (threads <= 0)
+            threads = defaultThreads();
+        if (threads > count)
+            threads = count;
+        if (threads <= 1) {
+            for (int i = 0; i < count; i++)
+                f(i);
+            return;
+        }
+        std::atomic<int> next(0);
+        auto worker = [&]() {
+            int i;
+            while ((i = next++) < count)
+                f(i);
+        };
+        std::vector<std::thread> pool;
+        for (int t = 1; t < threads; t++)
+            pool.push_back(std::thread(worker));
+        worker();
+        for (size_t t = 0; t < pool.size(); t++)
+            pool[t].join();
+    }
+
+}
+
+#endif
@@ -1,14 +1,58 @@
 #ifndef READER_HPP
 #define READER_HPP
 
+#include <algorithm>
 #include <cctype>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <vector>
 
+// Tokenizer for the ASF and AMC files. It works on the whole input in
+// memory: lookahead is a pointer comparison, numbers are converted in
+// place, and nothing but the strings handed back is allocated. good()
+// turns false once a read runs past the end, as it did for the stream.
 class Reader {
 public:
+    // Reads the rest of the stream into memory in large blocks
     Reader(std::istream *i);
+    // Reads size bytes at data, which must outlive the reader
+    Reader(const char *data, size_t size);
+    bool expect(const char *s);
+    bool peek(const char *s);
+    void swallowWhitespace();
+    void swallowLine();
+    // False if there was no number to read
+    bool readFloat(float &f);
+    bool readInt(int &i);
+    bool readToken(std::string &s);
+    bool good();
+    bool readLine(std::string &line);
+    bool upcomingInt();
+protected:
+    bool floatChar(char c);
+    bool intChar(char c);
+    bool tokenChar(char c);
+    // isspace in the C locale, without the call
+    bool spaceChar(char c);
+    // Converts [start, stop) if its digits fit a float exactly and its
+    // exponent is small, so one multiply or divide rounds it correctly
+    bool convertFloat(const char *start, const char *stop, float &f);
+    // Copies a number's characters to a terminated buffer for strtof
+    // and strtol, which would otherwise read past them
+    const char *terminate(const char *start, char *number, size_t size);
+    std::vector<char> buffer;
+    const char *next, *end;
+    bool failed;
+};
+
+// The original reader, one istream::get at a time. Reader replaced it;
+// it is kept to compare against (see Bench::reader).
+class StreamReader {
+public:
+    StreamReader(std::istream *i);
     bool expect(std::string s);
     bool peek(std::string s);
     void swallowWhitespace();
@@ -25,12 +69,217 @@ protected:
     bool tokenChar(char c);
     std::istream *in;
 };
- 
+
+// Definitions below
+
 inline Reader::Reader(std::istream *i) {
+    const size_t block = 1 << 16;
+    size_t size = 0;
+    while (*i) {
+        buffer.resize(size + block);
+        i->read(&buffer[size], block);
+        size += i->gcount();
+    }
+    buffer.resize(size);
+    next = buffer.empty() ? NULL : &buffer[0];
+    end = next + size;
+    failed = false;
+}
+
+inline Reader::Reader(const char *data, size_t size) {
+    next = data;
+    end = data + size;
+    failed = false;
+}
+
+inline bool Reader::expect(const char *s) {
+    if (!peek(s)) {
+        return false;
+    }
+    next += strlen(s);
+    return true;
+}
+
+inline bool Reader::peek(const char *s) {
+    swallowWhitespace();
+    size_t n = strlen(s);
+    size_t left = end - next;
+    if (left >= n) {
+        return memcmp(next, s, n) == 0;
+    }
+    // Ran out of input partway through s
+    if (memcmp(next, s, left) == 0) {
+        failed = true;
+    }
+    return false;
+}
+
+inline void Reader::swallowWhitespace() {
+    while (next < end && spaceChar(*next)) {
+        next++;
+    }
+    if (next == end) {
+        failed = true;
+    }
+}
+
+inline void Reader::swallowLine() {
+    const char *newline = (const char*)memchr(next, '\n', end - next);
+    if (newline == NULL && next == end) {
+        failed = true;
+    }
+    next = newline ? newline + 1 : end;
+    swallowWhitespace();
+}
+
+inline const char *Reader::terminate(const char *start, char *number, size_t size) {
+    size_t n = std::min((size_t)(next - start), size - 1);
+    memcpy(number, start, n);
+    number[n] = 0;
+    return number;
+}
+
+inline bool Reader::readFloat(float &f) {
+    swallowWhitespace();
+    const char *start = next;
+    while (next < end && floatChar(*next)) {
+        next++;
+    }
+    if (next == end) {
+        failed = true;
+    }
+    // Most mocap values take the exact fast path
+    if (!convertFloat(start, next, f)) {
+        char number[64];
+        f = strtof(terminate(start, number, sizeof(number)), NULL);
+    }
+    return next != start;
+}
+
+inline bool Reader::convertFloat(const char *start, const char *stop, float &f) {
+    static const float powers[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+    const char *c = start;
+    bool negative = c < stop && *c == '-';
+    if (c < stop && (*c == '-' || *c == '+')) {
+        c++;
+    }
+    // Below 2^24 every integer is a float
+    unsigned mantissa = 0;
+    int exponent = 0, digits = 0;
+    bool point = false;
+    for (; c < stop && ((*c >= '0' && *c <= '9') || (*c == '.' && !point)); c++) {
+        if (*c == '.') {
+            point = true;
+            continue;
+        }
+        if (mantissa >= (1 << 24)) {
+            return false;
+        }
+        mantissa = 10*mantissa + (*c - '0');
+        exponent -= point;
+        digits++;
+    }
+    if (digits == 0) {
+        return false;
+    }
+    if (c < stop && *c == 'e') {
+        c++;
+        bool negativeExponent = c < stop && *c == '-';
+        if (c < stop && (*c == '-' || *c == '+')) {
+            c++;
+        }
+        int e = 0;
+        if (c == stop) {
+            return false;
+        }
+        for (; c < stop && *c >= '0' && *c <= '9' && e < 100; c++) {
+            e = 10*e + (*c - '0');
+        }
+        exponent += negativeExponent ? -e : e;
+    }
+    if (c != stop || mantissa > (1 << 24) || exponent < -10 || exponent > 10) {
+        return false;
+    }
+    float value = mantissa;
+    value = exponent < 0 ? value / powers[-exponent] : value * powers[exponent];
+    f = negative ? -value : value;
+    return true;
+}
+
+inline bool Reader::readInt(int &i) {
+    swallowWhitespace();
+    const char *start = next;
+    while (next < end && intChar(*next)) {
+        next++;
+    }
+    if (next == end) {
+        failed = true;
+    }
+    char number[32];
+    i = strtol(terminate(start, number, sizeof(number)), NULL, 10);
+    return true;  
+}
+
+inline bool Reader::readToken(std::string &s) {
+    swallowWhitespace();
+    const char *start = next;
+    while (next < end && tokenChar(*next)) {
+        next++;
+    }
+    if (next == end) {
+        failed = true;
+    }
+    s.assign(start, next);
+    return true;
+}
+
+inline bool Reader::good() {
+    return !failed;
+}
+
+inline bool Reader::readLine(std::string &line) {
+    if (next == end) {
+        failed = true;
+        line.clear();
+        return true;
+    }
+    const char *newline = (const char*)memchr(next, '\n', end - next);
+    line.assign(next, newline ? newline : end);
+    next = newline ? newline + 1 : end;
+    return true;
+}
+
+inline bool Reader::upcomingInt() {
+    swallowWhitespace();
+    return next < end && intChar(*next);
+}
+
+inline bool Reader::floatChar(char c) {
+    return ( c == 'e'
+             || (c >= '0' && c <= '9')
+             || c == '.'
+             || c == '+'
+             || c == '-'
+             );
+}
+
+inline bool Reader::intChar(char c) {
+    return ( (c >= '0' && c <= '9') || c == '-');
+}
+
+inline bool Reader::tokenChar(char c) {
+    return !spaceChar(c);
+}
+
+inline bool Reader::spaceChar(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+inline StreamReader::StreamReader(std::istream *i) {
     in = i;
 }
 
-inline bool Reader::expect(std::string s) {
+inline bool StreamReader::expect(std::string s) {
     swallowWhitespace();
     if (s.size() == 0) {
         return true;
@@ -56,7 +305,7 @@ inline bool Reader::expect(std::string s) {
     }
 }
 
-inline bool Reader::peek(std::string s) {
+inline bool StreamReader::peek(std::string s) {
     swallowWhitespace();
     bool retval = false;
     if (s.size() == 0) {
@@ -83,7 +332,7 @@ inline bool Reader::peek(std::string s) {
     return retval;
 }
 
-inline void Reader::swallowWhitespace() {
+inline void StreamReader::swallowWhitespace() {
     char c;
     in->get(c);
     while ((*in) && std::isspace(c)) {
@@ -92,13 +341,13 @@ inline void Reader::swallowWhitespace() {
     in->putback(c);
 }
 
-inline void Reader::swallowLine() {
+inline void StreamReader::swallowLine() {
     std::string placeholder;
     std::getline(*in, placeholder);
     swallowWhitespace();
 }
 
-inline bool Reader::readFloat(float &f) {
+inline bool StreamReader::readFloat(float &f) {
     swallowWhitespace();
     std::string accum;
     char c;
@@ -110,10 +359,10 @@ inline bool Reader::readFloat(float &f) {
     in->putback(c);
     std::stringstream ss(accum);
     ss >> f;
-    return true;
+    return !accum.empty();
 }
 
-inline bool Reader::readInt(int &i) {
+inline bool StreamReader::readInt(int &i) {
     swallowWhitespace();
     std::string accum;
     char c;
@@ -128,7 +377,7 @@ inline bool Reader::readInt(int &i) {
     return true;  
 }
 
-inline bool Reader::readToken(std::string &s) {
+inline bool StreamReader::readToken(std::string &s) {
     swallowWhitespace();
     std::string accum;
     char c;
@@ -142,16 +391,16 @@ inline bool Reader::readToken(std::string &s) {
     return true;
 }
 
-inline bool Reader::good() {
+inline bool StreamReader::good() {
     return (bool)(*in);
 }
 
-inline bool Reader::readLine(std::string &line) {
+inline bool StreamReader::readLine(std::string &line) {
     getline(*in, line);
     return true;
 }
 
-inline bool Reader::upcomingInt() {
+inline bool StreamReader::upcomingInt() {
     swallowWhitespace();
     char c;
     in->get(c);
@@ -159,7 +408,7 @@ inline bool Reader::upcomingInt() {
     return intChar(c);
 }
 
-inline bool Reader::floatChar(char c) {
+inline bool StreamReader::floatChar(char c) {
     return ( c == 'e'
              || (c >= '0' && c <= '9')
              || c == '.'
@@ -168,11 +417,11 @@ inline bool Reader::floatChar(char c) {
              );
 }
 
-inline bool Reader::intChar(char c) {
+inline bool StreamReader::intChar(char c) {
     return ( (c >= '0' && c <= '9') || c == '-');
 }
 
-inline bool Reader::tokenChar(char c) {
+inline bool StreamReader::tokenChar(char c) {
     return !std::isspace(c);
 }
 
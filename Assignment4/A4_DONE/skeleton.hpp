@@ -0,0 +1,413 @@
+#ifndef SKELETON_HPP
+#define SKELETON_HPP
+
+#define _USE_MATH_DEFINES
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "graphics.hpp"
+using glm::vec2;
+using glm::vec3;
+using glm::vec4;
+using glm::mat4;
+
+mat4 fromEulerAnglesZYX(float degz, float degy, float degx);
+
+// The character's bones flattened into arrays, one entry per bone, with
+// every bone after its parent. Posing fills in the local transforms from
+// a frame of the clip, and solve() turns them into world transforms (the
+// palette) in one pass from front to back. Drawing and picking read the
+// palette, so neither walks the bone tree.
+class Skeleton {
+public:
+    Skeleton();
+    // The skeleton owns its vertex buffer and shader
+    Skeleton(const Skeleton&) = delete;
+    Skeleton &operator=(const Skeleton&) = delete;
+    ~Skeleton();
+    void clear();
+    // Appends a bone and returns its index; parent is -1 for a bone on the
+    // root and must otherwise already have been added
+    int addBone(std::string name, int parent, int channel, bool rx, bool ry, bool rz,
+                vec3 boneVector, const mat4 &initialRotation);
+    int getBoneCount() const { return parents.size(); }
+    int getParent(int bone) const { return parents[bone]; }
+    const std::string &getName(int bone) const { return names[bone]; }
+    // Index of the bone with the name, or -1
+    int find(std::string name) const;
+    // Sets every bone's local rotation from a frame of the clip
+    void pose(const float *frame);
+    // World transforms of all bones, rootFrame placing the root
+    void solve(const mat4 &rootFrame);
+    // A bone's frame in the palette, where it starts from (0,0,0) and
+    // runs along its bone vector
+    const mat4 &getWorld(int bone) const { return world[bone]; }
+    const mat4 &getLocal(int bone) const { return local[bone]; }
+    vec3 getStart(int bone) const { return vec3(world[bone][3]); }
+    vec3 getEnd(int bone) const { return vec3(world[bone] * vec4(boneVectors[bone], 1)); }
+    // The bone nearest along a ray that passes within radius of it, or
+    // -1; the ray is in the same space as the palette
+    int pick(vec3 origin, vec3 direction, float radius) const;
+    // Draws every bone as a capsule of the given radius from the palette,
+    // with highlight (if not -1) in highlightColor
+    void draw(float radius, int highlight = -1, vec3 highlightColor = vec3(1,1,1));
+protected:
+    std::vector<std::string> names;
+    std::vector<int> parents;
+    std::vector<int> channels;
+    // Bits 1, 2 and 4 for rx, ry and rz, the order of the DOFs in a frame
+    std::vector<int> dofMasks;
+    std::vector<vec3> boneVectors;
+    std::vector<mat4> initialRotations, inverseInitialRotations;
+    // Turns z onto the bone vector, for drawing
+    std::vector<mat4> alignments;
+    std::vector<mat4> local, world;
+    // A unit cylinder along z and a unit sphere as triangles (the
+    // sphere's normals are its positions)
+    std::vector<vec3> cylinder, cylinderNormals, sphere;
+    // Each bone's cylinder, end joint and (on the root) start joint is a
+    // slot, whose transform (world x alignment x capsule scale) the shader
+    // reads from its palette uniform. The static buffer repeats the unit
+    // meshes once per slot, tagged with the slot and the bone, so one
+    // glDrawArrays draws every bone; more slots than the shader's uniforms
+    // hold are split into batches.
+    std::vector<int> slotBones, slotShapes;
+    std::vector<int> batchSlots, batchVertices;
+    std::vector<mat4> slotTransforms;
+    GLuint meshBuffer, program;
+    GLint paletteUniform, highlightUniform, highlightColorUniform;
+    GLint lightingUniform, lightsUniform, slotBoneAttribute;
+
+    void buildMeshes();
+    // Builds the buffer and the shader on the first draw after the bones
+    // are added, and releaseMeshes frees them
+    void uploadMeshes();
+    void buildProgram(int slots);
+    void releaseMeshes();
+};
+
+// Definitions below
+
+inline mat4 fromEulerAnglesZYX(float degz, float degy, float degx) {
+    mat4 r;
+    r = glm::rotate(r, glm::radians(degz), vec3(0,0,1));
+    r = glm::rotate(r, glm::radians(degy), vec3(0,1,0));
+    r = glm::rotate(r, glm::radians(degx), vec3(1,0,0));
+    return r;
+}
+
+inline Skeleton::Skeleton() {
+    meshBuffer = program = 0;
+    buildMeshes();
+}
+
+inline Skeleton::~Skeleton() {
+    releaseMeshes();
+}
+
+inline void Skeleton::clear() {
+    releaseMeshes();
+    names.clear();
+    parents.clear();
+    channels.clear();
+    dofMasks.clear();
+    boneVectors.clear();
+    initialRotations.clear();
+    inverseInitialRotations.clear();
+    alignments.clear();
+    local.clear();
+    world.clear();
+}
+
+inline int Skeleton::addBone(std::string name, int parent, int channel, bool rx, bool ry, bool rz,
+                             vec3 boneVector, const mat4 &initialRotation) {
+    names.push_back(name);
+    parents.push_back(parent);
+    channels.push_back(channel);
+    dofMasks.push_back(rx | ry << 1 | rz << 2);
+    boneVectors.push_back(boneVector);
+    initialRotations.push_back(initialRotation);
+    inverseInitialRotations.push_back(glm::inverse(initialRotation));
+    mat4 alignment;
+    float length = glm::length(boneVector);
+    if (length > 0) {
+        vec3 b = boneVector/length, z(0,0,1);
+        vec3 axis = glm::cross(z, b);
+        if (glm::length(axis) > 1e-6f)
+            alignment = glm::rotate(mat4(), acosf(glm::clamp(glm::dot(b, z), -1.f, 1.f)), glm::normalize(axis));
+        else if (b.z < 0)
+            alignment = glm::rotate(mat4(), (float)M_PI, vec3(1,0,0));
+    }
+    alignments.push_back(alignment);
+    local.push_back(mat4());
+    world.push_back(mat4());
+    return parents.size() - 1;
+}
+
+inline int Skeleton::find(std::string name) const {
+    for (size_t i = 0; i < names.size(); i++) {
+        if (names[i] == name)
+            return i;
+    }
+    return -1;
+}
+
+inline void Skeleton::pose(const float *frame) {
+    for (size_t i = 0; i < parents.size(); i++) {
+        const float *values = frame + channels[i];
+        float rx = 0, ry = 0, rz = 0;
+        if (dofMasks[i] & 1)
+            rx = *values++;
+        if (dofMasks[i] & 2)
+            ry = *values++;
+        if (dofMasks[i] & 4)
+            rz = *values++;
+        local[i] = initialRotations[i] * fromEulerAnglesZYX(rz, ry, rx) * inverseInitialRotations[i];
+    }
+}
+
+inline void Skeleton::solve(const mat4 &rootFrame) {
+    for (size_t i = 0; i < parents.size(); i++) {
+        int p = parents[i];
+        if (p < 0) {
+            world[i] = rootFrame * local[i];
+            continue;
+        }
+        // Children hang from the end of their parent
+        mat4 base = world[p];
+        base[3] = world[p] * vec4(boneVectors[p], 1);
+        world[i] = base * local[i];
+    }
+}
+
+inline int Skeleton::pick(vec3 origin, vec3 direction, float radius) const {
+    direction = glm::normalize(direction);
+    int nearest = -1;
+    float nearestT = 0;
+    for (size_t i = 0; i < parents.size(); i++) {
+        // Closest approach of the ray to the segment from a to b
+        vec3 a = getStart(i), ab = getEnd(i) - a, w = origin - a;
+        float abab = glm::dot(ab, ab), abd = glm::dot(ab, direction);
+        float denominator = abab - abd*abd;
+        float s = 0;
+        if (abab > 0) {
+            s = denominator > 1e-9f
+                ? (glm::dot(ab, w) - abd*glm::dot(direction, w)) / denominator
+                : glm::dot(ab, w) / abab;
+            s = glm::clamp(s, 0.f, 1.f);
+        }
+        vec3 onBone = a + s*ab;
+        float t = glm::dot(onBone - origin, direction);
+        if (t < 0)
+            continue;
+        if (glm::length(origin + t*direction - onBone) <= radius && (nearest < 0 || t < nearestT)) {
+            nearest = i;
+            nearestT = t;
+        }
+    }
+    return nearest;
+}
+
+inline void Skeleton::buildMeshes() {
+    // Matches the detail of the GLU cylinder the bones used to be drawn with
+    int slices = 30, stacks = 12;
+    for (int i = 0; i < slices; i++) {
+        float t0 = 2*M_PI*i/slices, t1 = 2*M_PI*(i + 1)/slices;
+        vec3 a(cos(t0), sin(t0), 0), b(cos(t1), sin(t1), 0);
+        vec3 quad[6] = {a, b, b + vec3(0,0,1), a, b + vec3(0,0,1), a + vec3(0,0,1)};
+        vec3 quadNormals[6] = {a, b, b, a, b, a};
+        cylinder.insert(cylinder.end(), quad, quad + 6);
+        cylinderNormals.insert(cylinderNormals.end(), quadNormals, quadNormals + 6);
+    }
+    slices = 16;
+    for (int j = 0; j < stacks; j++) {
+        float p0 = M_PI*j/stacks - M_PI/2, p1 = M_PI*(j + 1)/stacks - M_PI/2;
+        for (int i = 0; i < slices; i++) {
+            float t0 = 2*M_PI*i/slices, t1 = 2*M_PI*(i + 1)/slices;
+            vec3 a(cos(p0)*cos(t0), cos(p0)*sin(t0), sin(p0));
+            vec3 b(cos(p0)*cos(t1), cos(p0)*sin(t1), sin(p0));
+            vec3 c(cos(p1)*cos(t1), cos(p1)*sin(t1), sin(p1));
+            vec3 d(cos(p1)*cos(t0), cos(p1)*sin(t0), sin(p1));
+            vec3 quad[6] = {a, b, c, a, c, d};
+            sphere.insert(sphere.end(), quad, quad + 6);
+        }
+    }
+}
+
+// Places each vertex with its slot's palette matrix and lights it like
+// the fixed-function pipeline with GL_COLOR_MATERIAL (ambient and
+// diffuse follow the color). Only the cylinders are scaled unevenly, and
+// their normals have no z, so normalizing undoes the scale.
+const char *const skeletonVertexShader =
+    "uniform mat4 palette[SLOTS];\n"
+    "uniform float highlight;\n"
+    "uniform vec3 highlightColor;\n"
+    "uniform bool lighting;\n"
+    "uniform float lights[8];\n"
+    "attribute vec2 slotBone;\n"
+    "void main() {\n"
+    "    mat4 m = palette[int(slotBone.x)];\n"
+    "    vec4 eye = gl_ModelViewMatrix * (m * gl_Vertex);\n"
+    "    gl_Position = gl_ProjectionMatrix * eye;\n"
+    "    vec4 color = slotBone.y == highlight ? vec4(highlightColor, gl_Color.a) : gl_Color;\n"
+    "    if (!lighting) {\n"
+    "        gl_FrontColor = color;\n"
+    "        return;\n"
+    "    }\n"
+    "    vec3 normal = normalize(gl_NormalMatrix * (mat3(m) * gl_Normal));\n"
+    "    vec3 lit = gl_LightModel.ambient.rgb;\n"
+    "    for (int i = 0; i < 8; i++) {\n"
+    "        vec4 p = gl_LightSource[i].position;\n"
+    "        vec3 l = normalize(p.xyz - p.w*eye.xyz);\n"
+    "        lit += lights[i]*(gl_LightSource[i].ambient.rgb\n"
+    "                          + max(dot(normal, l), 0.0)*gl_LightSource[i].diffuse.rgb);\n"
+    "    }\n"
+    "    gl_FrontColor = vec4(lit*color.rgb, color.a);\n"
+    "}\n";
+
+inline void Skeleton::uploadMeshes() {
+    slotBones.clear();
+    slotShapes.clear();
+    for (size_t i = 0; i < parents.size(); i++) {
+        // The cylinder, the end joint and, on the root, the start joint; a
+        // child's first joint is its parent's last
+        int shapes = parents[i] < 0 ? 3 : 2;
+        for (int shape = 0; shape < shapes; shape++) {
+            slotBones.push_back(i);
+            slotShapes.push_back(shape);
+        }
+    }
+    // Leave room for the other uniforms and the built-in lighting state
+    GLint components;
+    glGetIntegerv(GL_MAX_VERTEX_UNIFORM_COMPONENTS, &components);
+    int capacity = std::max(1, (components - 256)/16);
+    std::vector<vec3> positions, normals;
+    std::vector<vec2> tags;
+    batchSlots.clear();
+    batchVertices.clear();
+    for (size_t i = 0; i < slotBones.size(); i++) {
+        if (i % capacity == 0) {
+            batchSlots.push_back(i);
+            batchVertices.push_back(positions.size());
+        }
+        bool isCylinder = slotShapes[i] == 0;
+        const std::vector<vec3> &mesh = isCylinder ? cylinder : sphere;
+        const std::vector<vec3> &meshNormals = isCylinder ? cylinderNormals : sphere;
+        positions.insert(positions.end(), mesh.begin(), mesh.end());
+        normals.insert(normals.end(), meshNormals.begin(), meshNormals.end());
+        tags.insert(tags.end(), mesh.size(), vec2(i % capacity, slotBones[i]));
+    }
+    batchSlots.push_back(slotBones.size());
+    batchVertices.push_back(positions.size());
+    slotTransforms.resize(slotBones.size());
+    // All positions, then all normals, then all tags
+    size_t n = positions.size();
+    glGenBuffers(1, &meshBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, meshBuffer);
+    glBufferData(GL_ARRAY_BUFFER, n*(2*sizeof(vec3) + sizeof(vec2)), NULL, GL_STATIC_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, n*sizeof(vec3), &positions[0]);
+    glBufferSubData(GL_ARRAY_BUFFER, n*sizeof(vec3), n*sizeof(vec3), &normals[0]);
+    glBufferSubData(GL_ARRAY_BUFFER, 2*n*sizeof(vec3), n*sizeof(vec2), &tags[0]);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    buildProgram(std::min<int>(capacity, slotBones.size()));
+}
+
+inline void Skeleton::buildProgram(int slots) {
+    std::ostringstream source;
+    source << "#version 120\n#define SLOTS " << slots << "\n" << skeletonVertexShader;
+    std::string text = source.str();
+    const char *pointer = text.c_str();
+    GLuint shader = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(shader, 1, &pointer, NULL);
+    glCompileShader(shader);
+    GLint status;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    char infolog[512];
+    if (status != GL_TRUE) {
+        glGetShaderInfoLog(shader, 512, NULL, infolog);
+        std::cout << "Compilation of the skeleton shader failed:\n" << infolog << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    program = glCreateProgram();
+    glAttachShader(program, shader);
+    glLinkProgram(program);
+    // Freed with the program
+    glDeleteShader(shader);
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+        glGetProgramInfoLog(program, 512, NULL, infolog);
+        std::cout << "Linking of the skeleton shader failed:\n" << infolog << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    paletteUniform = glGetUniformLocation(program, "palette");
+    highlightUniform = glGetUniformLocation(program, "highlight");
+    highlightColorUniform = glGetUniformLocation(program, "highlightColor");
+    lightingUniform = glGetUniformLocation(program, "lighting");
+    lightsUniform = glGetUniformLocation(program, "lights");
+    slotBoneAttribute = glGetAttribLocation(program, "slotBone");
+}
+
+inline void Skeleton::releaseMeshes() {
+    // Never drawn, as when converting files, means no GL calls
+    if (!meshBuffer)
+        return;
+    glDeleteBuffers(1, &meshBuffer);
+    glDeleteProgram(program);
+    meshBuffer = program = 0;
+}
+
+inline void Skeleton::draw(float radius, int highlight, vec3 highlightColor) {
+    if (parents.empty())
+        return;
+    if (!meshBuffer)
+        uploadMeshes();
+    for (size_t i = 0; i < slotTransforms.size(); i++) {
+        int bone = slotBones[i];
+        float length = glm::length(boneVectors[bone]);
+        mat4 m = world[bone] * alignments[bone];
+        if (slotShapes[i] == 0) {
+            m = glm::scale(m, vec3(radius, radius, length));
+        } else {
+            if (slotShapes[i] == 1)
+                m = glm::translate(m, vec3(0, 0, length));
+            m = glm::scale(m, vec3(radius, radius, radius));
+        }
+        slotTransforms[i] = m;
+    }
+    // The shader lights with whichever lights are enabled
+    float lights[8];
+    for (int i = 0; i < 8; i++)
+        lights[i] = glIsEnabled(GL_LIGHT0 + i) ? 1 : 0;
+    glUseProgram(program);
+    glUniform1f(highlightUniform, highlight);
+    glUniform3fv(highlightColorUniform, 1, &highlightColor[0]);
+    glUniform1i(lightingUniform, glIsEnabled(GL_LIGHTING));
+    glUniform1fv(lightsUniform, 8, lights);
+    size_t n = batchVertices.back();
+    glBindBuffer(GL_ARRAY_BUFFER, meshBuffer);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glEnableVertexAttribArray(slotBoneAttribute);
+    glVertexPointer(3, GL_FLOAT, 0, 0);
+    glNormalPointer(GL_FLOAT, 0, (const GLvoid*)(n*sizeof(vec3)));
+    glVertexAttribPointer(slotBoneAttribute, 2, GL_FLOAT, GL_FALSE, 0, (const GLvoid*)(2*n*sizeof(vec3)));
+    // One batch, one upload and one draw unless the uniforms are too few
+    for (size_t b = 0; b + 1 < batchSlots.size(); b++) {
+        glUniformMatrix4fv(paletteUniform, batchSlots[b + 1] - batchSlots[b], GL_FALSE,
+                           &slotTransforms[batchSlots[b]][0][0]);
+        glDrawArrays(GL_TRIANGLES, batchVertices[b], batchVertices[b + 1] - batchVertices[b]);
+    }
+    glDisableVertexAttribArray(slotBoneAttribute);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glUseProgram(0);
+}
+
+#endif